@@ -17,17 +17,48 @@ extern "C" {
 #endif
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
+#ifdef ARENA_STATS
+#include <stdio.h>
+#endif
+
+// Blocks are anonymous mappings. The first holds DEFAULT_CAPACITY words and
+// every block after it is twice the one it follows, up to ARENA_MAX_BLOCK, so a
+// big run ends up with a few dozen blocks rather than thousands. Build with
+// -DARENA_HUGEPAGES to madvise blocks of a huge page or more, or with
+// -DARENA_HUGETLB to ask for MAP_HUGETLB first and fall back to normal pages
+// when none are reserved.
+//
+// Build with -DARENA_STATS to count what the arenas do, see the end of this
+// file and arena_stats.c.
 #define DEFAULT_CAPACITY (2 * 1024) 
 
+#ifndef ARENA_PAGE_SIZE
+#define ARENA_PAGE_SIZE 4096
+#endif
+
+#ifndef ARENA_HUGE_PAGE_SIZE
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+#ifndef ARENA_MAX_BLOCK
+#define ARENA_MAX_BLOCK (64 * 1024 * 1024)
+#endif
+
 #define arena_array(arena, type, count) \
     (type*) arena_alloc(arena, sizeof(type) * (count)) 
 
 #define arena_array_zero(arena, type, count) \
     (type*) arena_memset(arena_alloc(arena, sizeof(type) * (count)), 0, sizeof(type) * (count)) 
 
+#define arena_array_aligned(arena, type, count, alignment) \
+    (type*) arena_alloc_aligned(arena, sizeof(type) * (count), alignment)
+
 typedef struct ArenaBlock {
     struct ArenaBlock* next;
     size_t usage;
@@ -40,68 +71,144 @@ typedef struct {
     ArenaBlock* end;
 } Arena;
 
-static ArenaBlock* new_block(size_t size);
+// Where the arena stood, arena_rewind frees everything allocated since
+typedef struct {
+    ArenaBlock* block;
+    size_t usage;
+} ArenaMark;
+
+static ArenaBlock* new_block(size_t size, size_t previous);
 static void free_block(ArenaBlock* block);
 
-static void* arena_alloc(Arena* arena, size_t size);
+static inline void* arena_alloc(Arena* arena, size_t size);
+static void* arena_alloc_slow(Arena* arena, size_t size);
+static void* arena_alloc_aligned(Arena* arena, size_t size, size_t alignment);
 static void* arena_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size);
-static void* arena_memset(void* ptr, int value, size_t len);
-static void* arena_memcpy(void* dest, const void* src, size_t len);
+static inline void* arena_memset(void* ptr, int value, size_t len);
+static inline void* arena_memcpy(void* dest, const void* src, size_t len);
 static char* arena_strdup(Arena* arena, const char* str);
 
 static void arena_reset(Arena* arena);
+static inline ArenaMark arena_mark(const Arena* arena);
+static void arena_rewind(Arena* arena, ArenaMark mark);
 static void arena_free(Arena* arena); 
 
 static size_t total_capacity(Arena* arena);
 static size_t total_usage(Arena* arena); 
 
+#ifdef ARENA_STATS
+void arena_stats_block(ptrdiff_t bytes);
+void arena_stats_alloc(const char* tag, size_t size, size_t abandoned);
+void arena_stats_usage(const char* name, size_t usage, size_t capacity);
+void arena_stats_write(FILE* out);
+#endif
+
 static inline size_t align_size(size_t size) {
     return (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
 }
 
-static inline size_t _strlen(const char* str) {
-    size_t len = 0;
-    while (*str++) len++;
-    return len;
+static inline size_t round_size(size_t size, size_t granularity) {
+    return (size + granularity - 1) & ~(granularity - 1);
 }
 
-static ArenaBlock* new_block(size_t size) {
-    size_t capacity = DEFAULT_CAPACITY;
+// Maps *size bytes and widens it to what was actually mapped
+static void* map_block(size_t* size) {
+    void* memory = MAP_FAILED;
+
+#ifdef ARENA_HUGETLB
+    if (*size >= ARENA_HUGE_PAGE_SIZE) {
+        size_t huge = round_size(*size, ARENA_HUGE_PAGE_SIZE);
+        memory = mmap(NULL, huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
 
-    while (size > capacity * sizeof(uintptr_t)) capacity *= 2;
+        if (memory != MAP_FAILED) {
+            *size = huge;
+            return memory;
+        }
+    }
+#endif
 
-    size_t bytes = capacity * sizeof(uintptr_t);
-    size_t total_size = sizeof(ArenaBlock) + bytes;
-    ArenaBlock* block = (ArenaBlock*) malloc(total_size);
+    memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+
+#ifdef ARENA_HUGEPAGES
+    if (*size >= ARENA_HUGE_PAGE_SIZE) {
+        madvise(memory, *size, MADV_HUGEPAGE);
+    }
+#endif
+
+    return memory;
+}
+
+// previous is the capacity of the block this one follows, 0 for the first
+static ArenaBlock* new_block(size_t size, size_t previous) {
+    size_t bytes = DEFAULT_CAPACITY * sizeof(uintptr_t);
+
+    if (previous >= bytes) {
+        bytes = previous < ARENA_MAX_BLOCK / 2 ? previous * 2 : ARENA_MAX_BLOCK;
+    }
+
+    if (bytes < size) {
+        bytes = size;
+    }
+
+    size_t total_size = round_size(sizeof(ArenaBlock) + bytes, ARENA_PAGE_SIZE);
+    ArenaBlock* block = (ArenaBlock*) map_block(&total_size);
     assert(block);
 
+#ifdef ARENA_STATS
+    arena_stats_block((ptrdiff_t) total_size);
+#endif
+
     block -> next = NULL;
     block -> usage =  0;
-    block -> capacity = bytes;
+    block -> capacity = total_size - sizeof(ArenaBlock);
 
     return block;
 }
 
 static inline void free_block(ArenaBlock* block) {
-    free(block);
+#ifdef ARENA_STATS
+    arena_stats_block(-(ptrdiff_t) (sizeof(ArenaBlock) + block -> capacity));
+#endif
+
+    munmap(block, sizeof(ArenaBlock) + block -> capacity);
 }
 
-static void* arena_alloc(Arena* arena, size_t size) {
+// The bump of the current block is the whole fast path, everything else
+// lives in arena_alloc_slow
+static inline void* arena_alloc(Arena* arena, size_t size) {
     size = align_size(size);
+    ArenaBlock* block = arena -> end;
 
-    if (arena -> end == NULL && arena -> start == NULL) {
-        arena -> end = new_block(size);
-        arena -> start = arena -> end;
+    if (__builtin_expect(block != NULL && size <= block -> capacity - block -> usage, 1)) {
+        void* result = (char*) block -> data + block -> usage;
+        block -> usage += size;
+        return result;
     }
 
-    while (arena -> end -> usage + size > arena -> end -> capacity && arena -> end -> next != NULL) {
-        arena -> end = arena -> end -> next;
-    } 
+    return arena_alloc_slow(arena, size);
+}
 
-    if (arena -> end -> usage + size > arena -> end -> capacity) {
-            ArenaBlock* block = new_block(size);
+// Moves on to the block after the current one, which after arena_reset is a
+// kept block with nothing in it. When that one is missing or too small a new
+// block goes in front of it, so the chain is never walked.
+static void* arena_alloc_slow(Arena* arena, size_t size) {
+    if (arena -> end == NULL) {
+        arena -> end = new_block(size, 0);
+        arena -> start = arena -> end;
+    } else {
+        ArenaBlock* next = arena -> end -> next;
+
+        if (next == NULL || size > next -> capacity - next -> usage) {
+            ArenaBlock* block = new_block(size, arena -> end -> capacity);
+            block -> next = next;
             arena -> end -> next = block;
-            arena -> end = block;
+            next = block;
+        }
+
+        arena -> end = next;
     }
 
     void* result = (char*) &arena -> end -> data + arena -> end -> usage;
@@ -110,50 +217,63 @@ static void* arena_alloc(Arena* arena, size_t size) {
     return result;
 }
 
+// alignment is a power of two, e.g. 32 or 64 for rows that SIMD loads touch.
+// The padding comes out of the current block when it fits, otherwise the
+// allocation is over-sized by alignment - 1 and rounded up.
+static void* arena_alloc_aligned(Arena* arena, size_t size, size_t alignment) {
+    ArenaBlock* block = arena -> end;
+
+    if (block != NULL) {
+        uintptr_t at = (uintptr_t) block -> data + block -> usage;
+        size_t padding = (alignment - (at & (alignment - 1))) & (alignment - 1);
+
+        if (padding + align_size(size) <= block -> capacity - block -> usage) {
+            block -> usage += padding;
+            return arena_alloc(arena, size);
+        }
+    }
+
+    uintptr_t result = (uintptr_t) arena_alloc(arena, size + alignment - 1);
+    return (void*) ((result + alignment - 1) & ~(uintptr_t) (alignment - 1));
+}
+
+// The last allocation of the current block grows where it is, anything else is
+// copied. Either way the grown part is zeroed.
 static void* arena_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
     if (new_size <= old_size) return ptr;
 
-    void* result = arena_alloc(arena, new_size);
-    char* new_ptr = (char*) result;
-    char* old_ptr = (char*) ptr;
+    ArenaBlock* block = arena -> end;
+    size_t old_aligned = align_size(old_size);
+    size_t new_aligned = align_size(new_size);
 
-    for (size_t i = 0; i < old_size; i++) {
-        new_ptr[i] = old_ptr[i];
+    if (ptr != NULL && block != NULL
+        && (char*) ptr + old_aligned == (char*) block -> data + block -> usage
+        && new_aligned - old_aligned <= block -> capacity - block -> usage) {
+        block -> usage += new_aligned - old_aligned;
+        memset((char*) ptr + old_size, 0, new_size - old_size);
+        return ptr;
     }
 
-    for (size_t i = old_size; i < new_size; i++) {
-        new_ptr[i] = 0;
+    char* result = (char*) arena_alloc(arena, new_size);
+
+    if (old_size > 0) {
+        memcpy(result, ptr, old_size);
     }
+    memset(result + old_size, 0, new_size - old_size);
 
     return result;
 }
 
-static void* arena_memset(void* ptr, int value, size_t len) {
-    char* p = (char*) ptr;
-    char byte_value = (char) value;
-
-    while (len > 0) {
-        *p++ = byte_value;
-        len--;
-    }
-
-    return ptr;
+static inline void* arena_memset(void* ptr, int value, size_t len) {
+    return memset(ptr, value, len);
 } 
 
-static void* arena_memcpy(void* dest, const void* src, size_t len) {
-    char* d = dest;
-    const char* s = src;
-
-    while (len > 0) {
-        *d++ = *s++;
-        len--;
-    }
-
-    return dest;
+static inline void* arena_memcpy(void* dest, const void* src, size_t len) {
+    return memcpy(dest, src, len);
 }
 
 static char* arena_strdup(Arena* arena, const char* str) {
-    size_t len = _strlen(str);
+    size_t len = strlen(str);
     char* duplicate = (char*) arena_alloc(arena, len + 1);
 
     arena_memcpy(duplicate, str, len + 1);
@@ -162,6 +282,8 @@ static char* arena_strdup(Arena* arena, const char* str) {
     return duplicate;
 }
 
+// Blocks are kept, a long-running caller that resets between runs allocates
+// out of the same mappings every time
 static inline void arena_reset(Arena* arena) {
     for (ArenaBlock* block = arena -> start; block != NULL; block = block -> next) {
         block -> usage = 0;
@@ -169,6 +291,28 @@ static inline void arena_reset(Arena* arena) {
     arena -> end = arena -> start;
 }
 
+static inline ArenaMark arena_mark(const Arena* arena) {
+    ArenaMark mark = { arena -> end, arena -> end ? arena -> end -> usage : 0 };
+    return mark;
+}
+
+// Blocks taken since the mark are emptied but kept, like arena_reset. A mark of
+// an empty arena rewinds to its first block.
+static void arena_rewind(Arena* arena, ArenaMark mark) {
+    ArenaBlock* keep = mark.block ? mark.block : arena -> start;
+    if (keep == NULL) {
+        return;
+    }
+
+    for (ArenaBlock* block = keep; block != arena -> end; ) {
+        block = block -> next;
+        block -> usage = 0;
+    }
+
+    keep -> usage = mark.usage;
+    arena -> end = keep;
+}
+
 static void arena_free(Arena* arena) {
     ArenaBlock* block = arena -> start;
 
@@ -206,6 +350,49 @@ static size_t total_usage(Arena* arena) {
     return total;
 }
 
+#ifdef ARENA_STATS
+
+// Every allocation below this point is counted under the file and line that
+// made it. A realloc that had to copy counts the old size as abandoned, the
+// bytes stay in the arena until it is reset.
+#define ARENA_STRINGIFY(x) #x
+#define ARENA_TAG_LINE(line) __FILE__ ":" ARENA_STRINGIFY(line)
+#define ARENA_TAG ARENA_TAG_LINE(__LINE__)
+
+static inline void* arena_alloc_tagged(Arena* arena, size_t size, const char* tag) {
+    arena_stats_alloc(tag, size, 0);
+    return arena_alloc(arena, size);
+}
+
+static inline void* arena_alloc_aligned_tagged(Arena* arena, size_t size, size_t alignment, const char* tag) {
+    arena_stats_alloc(tag, size, 0);
+    return arena_alloc_aligned(arena, size, alignment);
+}
+
+static inline void* arena_realloc_tagged(Arena* arena, void* ptr, size_t old_size, size_t new_size, const char* tag) {
+    void* result = arena_realloc(arena, ptr, old_size, new_size);
+
+    if (result != ptr) {
+        arena_stats_alloc(tag, new_size, old_size);
+    } else if (new_size > old_size) {
+        arena_stats_alloc(tag, new_size - old_size, 0);
+    }
+
+    return result;
+}
+
+static inline char* arena_strdup_tagged(Arena* arena, const char* str, const char* tag) {
+    arena_stats_alloc(tag, strlen(str) + 1, 0);
+    return arena_strdup(arena, str);
+}
+
+#define arena_alloc(arena, size) arena_alloc_tagged(arena, size, ARENA_TAG)
+#define arena_alloc_aligned(arena, size, alignment) arena_alloc_aligned_tagged(arena, size, alignment, ARENA_TAG)
+#define arena_realloc(arena, ptr, old_size, new_size) arena_realloc_tagged(arena, ptr, old_size, new_size, ARENA_TAG)
+#define arena_strdup(arena, str) arena_strdup_tagged(arena, str, ARENA_TAG)
+
+#endif // ARENA_STATS
+
 #ifdef __cplusplus 
 }
 #endif
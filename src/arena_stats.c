@@ -0,0 +1,210 @@
+#include "arena.h"
+
+// Counters behind -DARENA_STATS, an empty file in a normal build. Workers
+// allocate concurrently, so tags claim slots with a compare and swap and every
+// counter is an atomic add.
+//
+// At exit one tab separated line is written per counter and per call site, to
+// the file named by CATALYZE_ARENA_STATS or to stderr:
+//
+//     blocks       <live> <peak live> <mapped> <mapped over the run>
+//     block_count  <blocks mapped over the run>
+//     mapped_peak  <bytes>
+//     abandoned    <bytes>
+//     arena        <name> <usage> <capacity>
+//     site         <file:line> <allocations> <bytes> <abandoned>
+//     dropped      <allocations from sites past ARENA_STATS_SITES>
+//
+// Sites are sorted by bytes, largest first, dropped only shows when non-zero.
+// arena_stats_write writes the same lines to any stream at any point.
+
+#ifdef ARENA_STATS
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_STATS_SITES 4096
+#define ARENA_STATS_ARENAS 16
+
+typedef struct {
+    const char* tag;
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t abandoned;
+} ArenaSite;
+
+typedef struct {
+    const char* name;
+    size_t usage;
+    size_t capacity;
+} ArenaUsage;
+
+static ArenaSite sites[ARENA_STATS_SITES];
+static uint64_t dropped_sites = 0;
+
+static ArenaUsage usages[ARENA_STATS_ARENAS];
+static size_t usage_count = 0;
+
+static uint64_t live_blocks = 0;
+static uint64_t peak_blocks = 0;
+static uint64_t total_blocks = 0;
+static uint64_t mapped = 0;
+static uint64_t mapped_peak = 0;
+static uint64_t total_mapped = 0;
+static uint64_t abandoned = 0;
+
+static pthread_once_t dump_once = PTHREAD_ONCE_INIT;
+
+static void raise_peak(uint64_t* peak, uint64_t value) {
+    uint64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+    while (value > seen && !__atomic_compare_exchange_n(peak, &seen, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Tags are string literals, one call site may still show up under two
+// pointers when the compiler does not merge them, arena_stats_dump adds
+// those together
+static ArenaSite* find_site(const char* tag) {
+    uint64_t hash = (uint64_t) (uintptr_t) tag * 0x9E3779B97F4A7C15ULL;
+
+    for (size_t probe = 0; probe < ARENA_STATS_SITES; probe++) {
+        ArenaSite* site = &sites[(hash + probe) & (ARENA_STATS_SITES - 1)];
+        const char* owner = __atomic_load_n(&site -> tag, __ATOMIC_ACQUIRE);
+
+        if (owner == NULL) {
+            const char* expected = NULL;
+            if (__atomic_compare_exchange_n(&site -> tag, &expected, tag, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return site;
+            }
+
+            owner = expected;
+        }
+
+        if (owner == tag) {
+            return site;
+        }
+    }
+
+    return NULL;
+}
+
+static int compare_tags(const void* a, const void* b) {
+    return strcmp(((const ArenaSite*) a) -> tag, ((const ArenaSite*) b) -> tag);
+}
+
+static int compare_bytes(const void* a, const void* b) {
+    uint64_t left = ((const ArenaSite*) a) -> bytes;
+    uint64_t right = ((const ArenaSite*) b) -> bytes;
+
+    if (left != right) {
+        return left > right ? -1 : 1;
+    }
+
+    return compare_tags(a, b);
+}
+
+// Sorts and merges a copy, the sites keep counting afterwards
+void arena_stats_write(FILE* out) {
+    static ArenaSite sorted[ARENA_STATS_SITES];
+
+    size_t count = 0;
+    for (size_t i = 0; i < ARENA_STATS_SITES; i++) {
+        if (sites[i].tag) {
+            sorted[count++] = sites[i];
+        }
+    }
+
+    qsort(sorted, count, sizeof(ArenaSite), compare_tags);
+
+    size_t merged = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (merged > 0 && strcmp(sorted[merged - 1].tag, sorted[i].tag) == 0) {
+            sorted[merged - 1].count += sorted[i].count;
+            sorted[merged - 1].bytes += sorted[i].bytes;
+            sorted[merged - 1].abandoned += sorted[i].abandoned;
+        } else {
+            sorted[merged++] = sorted[i];
+        }
+    }
+
+    qsort(sorted, merged, sizeof(ArenaSite), compare_bytes);
+
+    fprintf(out, "blocks\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n", live_blocks, peak_blocks, mapped, total_mapped);
+    fprintf(out, "block_count\t%" PRIu64 "\n", total_blocks);
+    fprintf(out, "mapped_peak\t%" PRIu64 "\n", mapped_peak);
+    fprintf(out, "abandoned\t%" PRIu64 "\n", abandoned);
+
+    for (size_t i = 0; i < usage_count; i++) {
+        fprintf(out, "arena\t%s\t%zu\t%zu\n", usages[i].name, usages[i].usage, usages[i].capacity);
+    }
+
+    for (size_t i = 0; i < merged; i++) {
+        fprintf(out, "site\t%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n", sorted[i].tag, sorted[i].count, sorted[i].bytes, sorted[i].abandoned);
+    }
+
+    if (dropped_sites > 0) {
+        fprintf(out, "dropped\t%" PRIu64 "\n", dropped_sites);
+    }
+}
+
+static void arena_stats_dump(void) {
+    const char* path = getenv("CATALYZE_ARENA_STATS");
+    FILE* out = path && path[0] ? fopen(path, "w") : NULL;
+
+    arena_stats_write(out ? out : stderr);
+
+    if (out) {
+        fclose(out);
+    }
+}
+
+static void register_dump(void) {
+    atexit(arena_stats_dump);
+}
+
+void arena_stats_block(ptrdiff_t bytes) {
+    pthread_once(&dump_once, register_dump);
+
+    if (bytes > 0) {
+        uint64_t live = __atomic_add_fetch(&live_blocks, 1, __ATOMIC_RELAXED);
+        uint64_t now = __atomic_add_fetch(&mapped, (uint64_t) bytes, __ATOMIC_RELAXED);
+
+        __atomic_add_fetch(&total_blocks, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&total_mapped, (uint64_t) bytes, __ATOMIC_RELAXED);
+        raise_peak(&peak_blocks, live);
+        raise_peak(&mapped_peak, now);
+    } else {
+        __atomic_sub_fetch(&live_blocks, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&mapped, (uint64_t) -bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void arena_stats_alloc(const char* tag, size_t size, size_t wasted) {
+    ArenaSite* site = find_site(tag);
+
+    if (wasted > 0) {
+        __atomic_add_fetch(&abandoned, wasted, __ATOMIC_RELAXED);
+    }
+
+    if (!site) {
+        __atomic_add_fetch(&dropped_sites, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_add_fetch(&site -> count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site -> bytes, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&site -> abandoned, wasted, __ATOMIC_RELAXED);
+}
+
+// Called from one thread, before the arena is freed
+void arena_stats_usage(const char* name, size_t usage, size_t capacity) {
+    if (usage_count < ARENA_STATS_ARENAS) {
+        usages[usage_count++] = (ArenaUsage) { name, usage, capacity };
+    }
+}
+
+#endif // ARENA_STATS
@@ -0,0 +1,484 @@
+#include "cache.h"
+
+#include "arena.h"
+#include "hash.h"
+#include "hashtable.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static int section_fits(uint64_t offset, uint64_t count, uint64_t width, size_t size) {
+    if (offset > size || count > (size - offset) / width) {
+        return 0;
+    }
+
+    return 1;
+}
+
+static uint32_t header_crc(const CacheHeader* header) {
+    return crc32c(header, offsetof(CacheHeader, header_crc));
+}
+
+static int checksums_match(const CacheHeader* header, const char* base) {
+    return header_crc(header) == header -> header_crc &&
+           crc32c(base + header -> records_offset, (size_t) header -> record_count * sizeof(CacheRecord)) == header -> records_crc &&
+           crc32c(base + header -> edges_offset, (size_t) header -> edge_count * sizeof(uint32_t)) == header -> edges_crc &&
+           crc32c(base + header -> strings_offset, header -> strings_size) == header -> strings_crc &&
+           crc32c(base + header -> spellings_offset, (size_t) header -> spelling_count * sizeof(uint32_t)) == header -> spellings_crc &&
+           crc32c(base + header -> spelling_text_offset, header -> spelling_text_size) == header -> spelling_text_crc &&
+           crc32c(base + header -> content_offset, (size_t) header -> content_count * sizeof(ContentEntry)) == header -> content_crc;
+}
+
+CachedFiles* cache_load(Arena* arena, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const CacheHeader* header = map;
+    if (header -> magic != CACHE_MAGIC || header -> version != CACHE_VERSION ||
+        !section_fits(header -> records_offset, header -> record_count, sizeof(CacheRecord), size) ||
+        !section_fits(header -> edges_offset, header -> edge_count, sizeof(uint32_t), size) ||
+        !section_fits(header -> strings_offset, header -> strings_size, 1, size) ||
+        !section_fits(header -> spellings_offset, header -> spelling_count, sizeof(uint32_t), size) ||
+        !section_fits(header -> spelling_text_offset, header -> spelling_text_size, 1, size) ||
+        !section_fits(header -> content_offset, header -> content_count, sizeof(ContentEntry), size) ||
+        !checksums_match(header, map)) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    CachedFiles* cache = arena_alloc(arena, sizeof(*cache));
+    cache -> header = header;
+    cache -> records = (const CacheRecord*) ((const char*) map + header -> records_offset);
+    cache -> edges = (const uint32_t*) ((const char*) map + header -> edges_offset);
+    cache -> strings = (const char*) map + header -> strings_offset;
+    cache -> spellings = (const uint32_t*) ((const char*) map + header -> spellings_offset);
+    cache -> spelling_text = (const char*) map + header -> spelling_text_offset;
+    cache -> content = (const ContentEntry*) ((const char*) map + header -> content_offset);
+    cache -> size = size;
+
+    return cache;
+}
+
+void cache_unload(CachedFiles* cache) {
+    if (cache && cache -> header) {
+        munmap((void*) cache -> header, cache -> size);
+        cache -> header = NULL;
+    }
+}
+
+const char* cache_record_path(const CachedFiles* cache, const CacheRecord* record) {
+    uint64_t end = (uint64_t) record -> path_offset + record -> path_len;
+    if (end >= cache -> header -> strings_size || cache -> strings[end] != '\0') {
+        return NULL;
+    }
+
+    return cache -> strings + record -> path_offset;
+}
+
+// Must run on an empty HashTable, fails when a path does not land on its record index
+int cache_intern(HashTable* ht, const CachedFiles* cache) {
+    for (uint32_t i = 0; i < cache -> header -> record_count; i++) {
+        const char* path = cache_record_path(cache, &cache -> records[i]);
+        if (!path || intern_path(ht, path) != i) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+const CacheRecord* cache_record(const CachedFiles* cache, FileId id) {
+    if (id >= cache -> header -> record_count) {
+        return NULL;
+    }
+
+    return &cache -> records[id];
+}
+
+const CacheRecord* cache_record_dependency(const CachedFiles* cache, const CacheRecord* record, uint32_t i) {
+    uint64_t slot = (uint64_t) record -> edge_offset + i;
+    if (i >= record -> edge_count || slot >= cache -> header -> edge_count) {
+        return NULL;
+    }
+
+    uint32_t idx = cache -> edges[slot];
+    if (idx >= cache -> header -> record_count) {
+        return NULL;
+    }
+
+    return &cache -> records[idx];
+}
+
+const char* cache_record_spelling(const CachedFiles* cache, const CacheRecord* record, uint32_t i) {
+    uint64_t slot = (uint64_t) record -> spelling_offset + i;
+    if (i >= record -> spelling_count || slot >= cache -> header -> spelling_count) {
+        return NULL;
+    }
+
+    uint32_t offset = cache -> spellings[slot];
+    const char* end = offset < cache -> header -> spelling_text_size ? memchr(cache -> spelling_text + offset, 0, cache -> header -> spelling_text_size - offset) : NULL;
+
+    return end ? cache -> spelling_text + offset : NULL;
+}
+
+// Any scanned record with the same bytes, its spellings hold for this content
+const CacheRecord* cache_find_content(const CachedFiles* cache, uint64_t content_hash) {
+    const ContentEntry* base = cache -> content;
+    size_t count = cache -> header -> content_count;
+
+    while (count > 1) {
+        size_t half = count / 2;
+        base = (base[half - 1].content_hash < content_hash) ? base + half : base;
+        count -= half;
+    }
+
+    if (count == 0 || base -> content_hash != content_hash || base -> record >= cache -> header -> record_count) {
+        return NULL;
+    }
+
+    return &cache -> records[base -> record];
+}
+
+// An entry whose mtime is not older than the cache itself is racy: the file may
+// have been rewritten within the same timestamp tick after it was hashed.
+int cache_stat_matches(const CachedFiles* cache, const CacheRecord* record, const FileStat* st) {
+    const FileStat* cached = &record -> stat;
+
+    if (cached -> mtime_ns >= cache -> header -> written_ns) {
+        return 0;
+    }
+
+    return cached -> mtime_ns == st -> mtime_ns &&
+           cached -> size == st -> size &&
+           cached -> ino == st -> ino &&
+           cached -> dev == st -> dev;
+}
+
+// Assigns record indices in FileId order to every node worth keeping: the
+// discovered sources and whatever they include. Returns the record count,
+// record_of[id] is UINT32_MAX for dropped nodes.
+uint32_t cache_record_map(HashTable* ht, uint32_t* record_of) {
+    memset(record_of, 0, sizeof(uint32_t) * ht -> node_count);
+
+    for (FileId id = 0; id < ht -> node_count; id++) {
+        Node* node = ht_node(ht, id);
+        for (size_t k = 0; k < node -> dep_count; k++) {
+            record_of[node -> dependencies[k]] = 1;
+        }
+    }
+
+    uint32_t count = 0;
+    for (FileId id = 0; id < ht -> node_count; id++) {
+        record_of[id] = (record_of[id] || ht_node(ht, id) -> discovered) ? count++ : UINT32_MAX;
+    }
+
+    return count;
+}
+
+// A signal landing mid-write is retried, not taken for a failed write
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (written <= 0) {
+            return -1;
+        }
+
+        data += written;
+        len -= written;
+    }
+
+    return 0;
+}
+
+static int sync_parent_dir(const char* path) {
+    char dir[4096];
+    const char* slash = strrchr(path, '/');
+
+    if (!slash) {
+        strcpy(dir, ".");
+    } else {
+        size_t len = slash - path;
+        if (len >= sizeof(dir)) {
+            return -1;
+        }
+
+        memcpy(dir, path, len);
+        dir[len ? len : 1] = 0;
+        if (!len) {
+            dir[0] = '/';
+        }
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+static uint32_t temp_counter = 0;
+
+// Temp names are unique per process and per call, so threads writing the same
+// path never share one
+static int open_temp(const char* path, char* tmp_path, size_t capacity, int make_parent) {
+    uint32_t n = __atomic_fetch_add(&temp_counter, 1, __ATOMIC_RELAXED);
+    if (snprintf(tmp_path, capacity, "%s.tmp.%d.%u", path, (int) getpid(), n) >= (int) capacity) {
+        return -1;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 && errno == ENOENT && make_parent) {
+        char dir[4096];
+        const char* slash = strrchr(path, '/');
+        size_t len = slash ? (size_t) (slash - path) : 0;
+
+        if (len > 0 && len < sizeof(dir)) {
+            memcpy(dir, path, len);
+            dir[len] = 0;
+
+            if (mkdir(dir, 0755) == 0 || errno == EEXIST) {
+                fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            }
+        }
+    }
+
+    return fd;
+}
+
+// Writes parts to a temp file and renames it over path. NULL options is the
+// durable write the cache and the closure use, see AtomicWrite.
+int write_file_atomic(const char* path, const struct iovec* parts, int count, const AtomicWrite* options) {
+    static const AtomicWrite durable = { .durable = 1 };
+    if (!options) {
+        options = &durable;
+    }
+
+    char tmp_path[4096];
+    int fd = open_temp(path, tmp_path, sizeof(tmp_path), options -> make_parent);
+    if (fd == -1) {
+        return -1;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count && !failed; i++) {
+        failed = write_all(fd, parts[i].iov_base, parts[i].iov_len) != 0;
+    }
+
+    int finished = 0;
+    if (!failed && options -> finish) {
+        finished = options -> finish(fd, options -> ctx);
+        failed = finished < 0;
+    }
+
+    failed = failed || (options -> durable && fsync(fd) != 0);
+    failed = close(fd) != 0 || failed;
+
+    if (failed || finished > 0) {
+        unlink(tmp_path);
+        return failed ? -1 : 0;
+    }
+
+    if (rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return options -> durable ? sync_parent_dir(path) : 0;
+}
+
+static int compare_content(const void* lhs, const void* rhs) {
+    const ContentEntry* a = lhs;
+    const ContentEntry* b = rhs;
+
+    if (a -> content_hash != b -> content_hash) {
+        return a -> content_hash < b -> content_hash ? -1 : 1;
+    }
+
+    return a -> record < b -> record ? -1 : (a -> record > b -> record);
+}
+
+static inline uint64_t align_offset(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// The cache is stamped with its own mtime, the clock file mtimes are compared
+// against, so the header goes in last
+static int stamp_header(int fd, void* ctx) {
+    CacheHeader* header = ctx;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    header -> written_ns = (uint64_t) st.st_mtim.tv_sec * 1000000000ULL + (uint64_t) st.st_mtim.tv_nsec;
+    header -> header_crc = header_crc(header);
+
+    ssize_t written;
+    do {
+        written = pwrite(fd, header, sizeof(*header), 0);
+    } while (written < 0 && errno == EINTR);
+
+    return written == (ssize_t) sizeof(*header) ? 0 : -1;
+}
+
+// written_crc, when given, receives the header_crc of the cache on disk
+int cache_write(HashTable* ht, uint64_t conditions_hash, const char* path, uint32_t* written_crc) {
+    uint32_t* record_of = malloc(sizeof(*record_of) * (ht -> node_count ? ht -> node_count : 1));
+    if (!record_of) {
+        return -1;
+    }
+
+    size_t count = cache_record_map(ht, record_of);
+    size_t edge_count = 0;
+    size_t strings_size = 0;
+    size_t spelling_count = 0;
+    size_t spelling_text_size = 0;
+    size_t content_count = 0;
+
+    for (FileId id = 0; id < ht -> node_count; id++) {
+        if (record_of[id] == UINT32_MAX) {
+            continue;
+        }
+
+        Node* node = ht_node(ht, id);
+        edge_count += node -> dep_count;
+        strings_size += strlen(node -> path) + 1;
+        spelling_count += node -> spelling_count;
+        content_count += node -> scanned;
+
+        for (size_t k = 0; k < node -> spelling_count; k++) {
+            spelling_text_size += strlen(node -> spellings[k]) + 1;
+        }
+    }
+
+    CacheHeader header = {0};
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.conditions_hash = conditions_hash;
+    header.record_count = (uint32_t) count;
+    header.edge_count = (uint32_t) edge_count;
+    header.spelling_count = (uint32_t) spelling_count;
+    header.content_count = (uint32_t) content_count;
+    header.records_offset = sizeof(CacheHeader);
+    header.edges_offset = header.records_offset + count * sizeof(CacheRecord);
+    header.strings_offset = header.edges_offset + edge_count * sizeof(uint32_t);
+    header.strings_size = strings_size;
+    header.spellings_offset = align_offset(header.strings_offset + strings_size, sizeof(uint32_t));
+    header.spelling_text_offset = header.spellings_offset + spelling_count * sizeof(uint32_t);
+    header.spelling_text_size = spelling_text_size;
+    header.content_offset = align_offset(header.spelling_text_offset + spelling_text_size, sizeof(uint64_t));
+
+    size_t size = header.content_offset + content_count * sizeof(ContentEntry);
+    char* buffer = calloc(1, size);
+    if (!buffer) {
+        free(record_of);
+        return -1;
+    }
+
+    CacheRecord* records = (CacheRecord*) (buffer + header.records_offset);
+    uint32_t* edges = (uint32_t*) (buffer + header.edges_offset);
+    char* strings = buffer + header.strings_offset;
+    uint32_t* spellings = (uint32_t*) (buffer + header.spellings_offset);
+    char* spelling_text = buffer + header.spelling_text_offset;
+    ContentEntry* content = (ContentEntry*) (buffer + header.content_offset);
+
+    uint32_t edge_offset = 0;
+    uint32_t string_offset = 0;
+    uint32_t spelling_offset = 0;
+    uint32_t text_offset = 0;
+    size_t content_index = 0;
+
+    for (FileId id = 0; id < ht -> node_count; id++) {
+        if (record_of[id] == UINT32_MAX) {
+            continue;
+        }
+
+        Node* node = ht_node(ht, id);
+        CacheRecord* record = &records[record_of[id]];
+        size_t path_len = strlen(node -> path);
+
+        record -> stat = node -> stat;
+        record -> content_hash = node -> content_hash;
+        record -> path_offset = string_offset;
+        record -> path_len = (uint32_t) path_len;
+        record -> edge_offset = edge_offset;
+        record -> edge_count = (uint32_t) node -> dep_count;
+        record -> spelling_offset = spelling_offset;
+        record -> spelling_count = (uint32_t) node -> spelling_count;
+
+        memcpy(strings + string_offset, node -> path, path_len + 1);
+        string_offset += path_len + 1;
+
+        for (size_t k = 0; k < node -> dep_count; k++) {
+            edges[edge_offset++] = record_of[node -> dependencies[k]];
+        }
+
+        for (size_t k = 0; k < node -> spelling_count; k++) {
+            size_t len = strlen(node -> spellings[k]);
+            memcpy(spelling_text + text_offset, node -> spellings[k], len + 1);
+            spellings[spelling_offset++] = text_offset;
+            text_offset += len + 1;
+        }
+
+        if (node -> scanned) {
+            content[content_index].content_hash = node -> content_hash;
+            content[content_index].record = record_of[id];
+            content_index++;
+        }
+    }
+
+    free(record_of);
+    qsort(content, content_count, sizeof(ContentEntry), compare_content);
+
+    header.records_crc = crc32c(records, count * sizeof(CacheRecord));
+    header.edges_crc = crc32c(edges, edge_count * sizeof(uint32_t));
+    header.strings_crc = crc32c(strings, strings_size);
+    header.spellings_crc = crc32c(spellings, spelling_count * sizeof(uint32_t));
+    header.spelling_text_crc = crc32c(spelling_text, spelling_text_size);
+    header.content_crc = crc32c(content, content_count * sizeof(ContentEntry));
+
+    struct iovec part = { buffer, size };
+    AtomicWrite options = { .finish = stamp_header, .ctx = &header, .durable = 1 };
+
+    int result = write_file_atomic(path, &part, 1, &options);
+    free(buffer);
+
+    if (result == 0 && written_crc) {
+        *written_crc = header.header_crc;
+    }
+
+    return result;
+}
@@ -0,0 +1,131 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "arena.h"
+#include "hashtable.h"
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+// catalyze.cache is mapped read-only and queried in place:
+//
+//   CacheHeader
+//   CacheRecord[record_count]       in FileId order
+//   uint32_t[edge_count]            record indices, grouped per record
+//   char[strings_size]              NUL terminated paths, in record order
+//   uint32_t[spelling_count]        offsets into the spelling text, grouped per record
+//   char[spelling_text_size]        NUL terminated include spellings
+//   ContentEntry[content_count]     scanned records sorted by content_hash
+//
+// A spelling is the text between the include's delimiters, prefixed with the
+// opening one, so #include "lib/x.h" is stored as "lib/x.h. The conditionals
+// around includes are kept in between as "#ifdef NAME" and the like, see
+// cond.h. The include list of a file depends only on its bytes: a file whose content hash is found in
+// the content index gets that record's spellings resolved against its own path
+// instead of being scanned. Edges depend on the include search path and on
+// which headers exist along it, so a file's edges are always resolved again
+// from its spellings and only compared with the stored ones. Edges keep no
+// variant masks, a -p run drops the includes no variant compiles, so
+// conditions_hash records the variants they were resolved under, 0 without -p,
+// and edges from other variants are not compared.
+//
+// All offsets are from the start of the file and all integers are little endian.
+// Every section carries a CRC32C and the header checksums itself, a cache that
+// fails any check is ignored. The writer goes through a temp file, fsync and
+// rename, so a killed build leaves either the old cache or the new one.
+//
+// cache_intern interns every cached path before anything else touches the
+// HashTable, so record i is FileId i for the whole run and cached edges are
+// FileIds as they are. Files that are neither a source nor included by one are
+// dropped on write.
+//
+// Loading is not O(pages touched): cache_load checks every section CRC and
+// cache_intern walks every path, so startup reads the whole file once. A run
+// compares every cached file's stat and so touches each record anyway, and
+// checking up front keeps a damaged cache from being half used.
+
+#define CACHE_MAGIC 0x43544143 // "CATC"
+#define CACHE_VERSION 9
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t written_ns;
+    uint64_t conditions_hash;
+    uint32_t record_count;
+    uint32_t edge_count;
+    uint32_t spelling_count;
+    uint32_t content_count;
+    uint64_t records_offset;
+    uint64_t edges_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t spellings_offset;
+    uint64_t spelling_text_offset;
+    uint64_t spelling_text_size;
+    uint64_t content_offset;
+    uint32_t records_crc;
+    uint32_t edges_crc;
+    uint32_t strings_crc;
+    uint32_t spellings_crc;
+    uint32_t spelling_text_crc;
+    uint32_t content_crc;
+    uint32_t reserved;
+    uint32_t header_crc;
+} CacheHeader;
+
+typedef struct {
+    FileStat stat;
+    uint64_t content_hash;
+    uint32_t path_offset;
+    uint32_t path_len;
+    uint32_t edge_offset;
+    uint32_t edge_count;
+    uint32_t spelling_offset;
+    uint32_t spelling_count;
+} CacheRecord;
+
+typedef struct {
+    uint64_t content_hash;
+    uint32_t record;
+    uint32_t reserved;
+} ContentEntry;
+
+typedef struct {
+    const CacheHeader* header;
+    const CacheRecord* records;
+    const uint32_t* edges;
+    const char* strings;
+    const uint32_t* spellings;
+    const char* spelling_text;
+    const ContentEntry* content;
+    size_t size;
+} CachedFiles;
+
+CachedFiles* cache_load(Arena* arena, const char* path);
+void cache_unload(CachedFiles* cache);
+int cache_intern(HashTable* ht, const CachedFiles* cache);
+int cache_write(HashTable* ht, uint64_t conditions_hash, const char* path, uint32_t* written_crc);
+uint32_t cache_record_map(HashTable* ht, uint32_t* record_of);
+// How write_file_atomic treats the temp file. finish runs on it once the parts
+// are written, e.g. to stamp a header with the file's own mtime: a negative
+// return fails the write, a positive one drops it without an error. durable
+// fsyncs the file and its directory, make_parent creates a missing parent
+// directory, one level.
+typedef struct {
+    int (*finish)(int fd, void* ctx);
+    void* ctx;
+    int durable;
+    int make_parent;
+} AtomicWrite;
+
+int write_file_atomic(const char* path, const struct iovec* parts, int count, const AtomicWrite* options);
+
+const CacheRecord* cache_record(const CachedFiles* cache, FileId id);
+const char* cache_record_path(const CachedFiles* cache, const CacheRecord* record);
+const CacheRecord* cache_record_dependency(const CachedFiles* cache, const CacheRecord* record, uint32_t i);
+const char* cache_record_spelling(const CachedFiles* cache, const CacheRecord* record, uint32_t i);
+const CacheRecord* cache_find_content(const CachedFiles* cache, uint64_t content_hash);
+int cache_stat_matches(const CachedFiles* cache, const CacheRecord* record, const FileStat* st);
+
+#endif // !CACHE_H
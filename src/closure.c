@@ -0,0 +1,313 @@
+#include "closure.h"
+
+#include "arena.h"
+#include "cache.h"
+#include "graph.h"
+#include "hash.h"
+#include "hashtable.h"
+
+#include <fcntl.h>
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+typedef void (*OrKernel)(uint64_t* dst, const uint64_t* src, size_t words);
+
+static void or_scalar(uint64_t* dst, const uint64_t* src, size_t words) {
+    for (size_t i = 0; i < words; i++) {
+        dst[i] |= src[i];
+    }
+}
+
+__attribute__((target("avx2")))
+static void or_avx2(uint64_t* dst, const uint64_t* src, size_t words) {
+    size_t i = 0;
+
+    for (; i + 8 <= words; i += 8) {
+        __m256i lo = _mm256_or_si256(_mm256_loadu_si256((const __m256i*) (dst + i)), _mm256_loadu_si256((const __m256i*) (src + i)));
+        __m256i hi = _mm256_or_si256(_mm256_loadu_si256((const __m256i*) (dst + i + 4)), _mm256_loadu_si256((const __m256i*) (src + i + 4)));
+
+        _mm256_storeu_si256((__m256i*) (dst + i), lo);
+        _mm256_storeu_si256((__m256i*) (dst + i + 4), hi);
+    }
+
+    for (; i < words; i++) {
+        dst[i] |= src[i];
+    }
+}
+
+static OrKernel get_or_kernel(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? or_avx2 : or_scalar;
+}
+
+typedef struct {
+    const ClosureHeader* header;
+    const uint32_t* component;
+    const uint64_t* rows;
+    size_t size;
+} PreviousClosure;
+
+static uint32_t header_crc(const ClosureHeader* header) {
+    return crc32c(header, offsetof(ClosureHeader, header_crc));
+}
+
+static int section_fits(uint64_t offset, uint64_t count, uint64_t width, size_t size) {
+    return offset <= size && count <= (size - offset) / width;
+}
+
+// The previous closure is only usable with the cache written right before it,
+// the records it is indexed by are this run's first FileIds and their edges are
+// what stale_files compares against.
+static int load_previous(PreviousClosure* previous, const CachedFiles* cache, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(ClosureHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    const ClosureHeader* header = map;
+    const char* base = map;
+    uint64_t row_words = (uint64_t) header -> component_count * header -> words;
+
+    if (header -> magic != CLOSURE_MAGIC || header -> version != CLOSURE_VERSION ||
+        header_crc(header) != header -> header_crc ||
+        header -> node_count != cache -> header -> record_count ||
+        header -> words != (header -> node_count + 63) / 64 ||
+        (header -> words && header -> component_count > UINT64_MAX / header -> words) ||
+        !section_fits(header -> components_offset, header -> node_count, sizeof(uint32_t), size) ||
+        !section_fits(header -> rows_offset, row_words, sizeof(uint64_t), size) ||
+        header -> rows_offset % sizeof(uint64_t) != 0 ||
+        crc32c(base + header -> components_offset, (size_t) header -> node_count * sizeof(uint32_t)) != header -> components_crc ||
+        crc32c(base + header -> rows_offset, (size_t) row_words * sizeof(uint64_t)) != header -> rows_crc ||
+        header -> cache_crc != cache -> header -> header_crc) {
+        munmap(map, size);
+        return -1;
+    }
+
+    previous -> header = header;
+    previous -> component = (const uint32_t*) (base + header -> components_offset);
+    previous -> rows = (const uint64_t*) (base + header -> rows_offset);
+    previous -> size = size;
+
+    return 0;
+}
+
+static int includes_changed(const Graph* graph, const CachedFiles* cache, FileId id) {
+    const CacheRecord* record = cache_record(cache, id);
+    uint32_t degree = graph_degree(&graph -> forward, id);
+
+    if (!record || record -> edge_count != degree) {
+        return 1;
+    }
+
+    const FileId* deps = graph_edges(&graph -> forward, id);
+    for (uint32_t k = 0; k < degree; k++) {
+        const CacheRecord* dep = cache_record_dependency(cache, record, k);
+        if (!dep || (FileId) (dep - cache -> records) != deps[k]) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Marks every file whose old row may be stale: the ones whose includes changed
+// or that are new, plus everything that reaches them. A file reaching none of
+// them has the same closure as last run.
+static uint64_t* stale_files(const Graph* graph, const Components* components, const CachedFiles* cache, size_t words) {
+    uint64_t* stale = calloc(words ? words : 1, sizeof(uint64_t));
+    if (!stale) {
+        return NULL;
+    }
+
+    for (FileId id = 0; id < graph -> node_count; id++) {
+        if (includes_changed(graph, cache, id)) {
+            stale[id >> 6] |= 1ULL << (id & 63);
+        }
+    }
+
+    if (components_expand_reverse(graph, components, stale, NULL) != 0) {
+        free(stale);
+        return NULL;
+    }
+
+    return stale;
+}
+
+Closure* closure_build(Arena* arena, const Graph* graph, const Components* components, const CachedFiles* cache, const char* path) {
+    size_t count = graph -> node_count;
+    size_t words = (count + 63) / 64;
+    size_t component_count = components -> count;
+    size_t row_words = component_count * words;
+
+    Closure* closure = arena_alloc(arena, sizeof(*closure));
+    uint64_t* rows = arena_array_aligned(arena, uint64_t, row_words ? row_words : 1, 32);
+
+    if (!closure || !rows) {
+        return NULL;
+    }
+
+    PreviousClosure previous = {0};
+    uint64_t* stale = NULL;
+
+    if (cache && load_previous(&previous, cache, path) == 0) {
+        stale = stale_files(graph, components, cache, words);
+        if (!stale) {
+            munmap((void*) previous.header, previous.size);
+            previous.header = NULL;
+        }
+    }
+
+    OrKernel or_rows = get_or_kernel();
+    closure -> reused = 0;
+
+    for (uint32_t c = 0; c < component_count; c++) {
+        uint64_t* row = rows + (size_t) c * words;
+        const FileId* members = components -> members + components -> offsets[c];
+        uint32_t member_count = components -> offsets[c + 1] - components -> offsets[c];
+
+        if (previous.header && !bitset_test(stale, members[0])) {
+            uint32_t old = previous.component[members[0]];
+            size_t old_words = previous.header -> words;
+
+            if (old < previous.header -> component_count) {
+                memcpy(row, previous.rows + (size_t) old * old_words, old_words * sizeof(uint64_t));
+                memset(row + old_words, 0, (words - old_words) * sizeof(uint64_t));
+                closure -> reused++;
+                continue;
+            }
+        }
+
+        memset(row, 0, words * sizeof(uint64_t));
+
+        for (uint32_t m = 0; m < member_count; m++) {
+            row[members[m] >> 6] |= 1ULL << (members[m] & 63);
+        }
+
+        const uint32_t* deps = graph_edges(&components -> forward, c);
+        uint32_t degree = graph_degree(&components -> forward, c);
+
+        for (uint32_t k = 0; k < degree; k++) {
+            or_rows(row, rows + (size_t) deps[k] * words, words);
+        }
+    }
+
+    if (previous.header) {
+        munmap((void*) previous.header, previous.size);
+    }
+
+    free(stale);
+
+    closure -> node_count = count;
+    closure -> component_count = component_count;
+    closure -> words = words;
+    closure -> component = components -> component;
+    closure -> rows = rows;
+
+    return closure;
+}
+
+// Written in the record order of the cache from the same run, cache_crc is
+// that cache's header_crc. When the cache dropped files the bits are moved to
+// their record indices first.
+int closure_write(const Closure* closure, HashTable* ht, uint32_t cache_crc, const char* path) {
+    size_t count = closure -> node_count;
+    uint32_t* record_of = malloc(sizeof(uint32_t) * (count ? count : 1));
+    if (!record_of) {
+        return -1;
+    }
+
+    uint32_t live = cache_record_map(ht, record_of);
+    size_t words = ((size_t) live + 63) / 64;
+    size_t row_words = closure -> component_count * words;
+
+    uint32_t* component = malloc(sizeof(uint32_t) * (live ? live : 1));
+    uint64_t* rows = closure -> rows;
+
+    if (live != count) {
+        rows = calloc(row_words ? row_words : 1, sizeof(uint64_t));
+    }
+
+    if (!component || !rows) {
+        free(record_of);
+        free(component);
+        if (rows != closure -> rows) {
+            free(rows);
+        }
+        return -1;
+    }
+
+    for (FileId id = 0; id < count; id++) {
+        if (record_of[id] != UINT32_MAX) {
+            component[record_of[id]] = closure -> component[id];
+        }
+    }
+
+    if (rows != closure -> rows) {
+        for (size_t c = 0; c < closure -> component_count; c++) {
+            const uint64_t* src = closure -> rows + c * closure -> words;
+            uint64_t* dst = rows + c * words;
+
+            for (size_t word = 0; word < closure -> words; word++) {
+                for (uint64_t set = src[word]; set; set &= set - 1) {
+                    uint32_t record = record_of[word * 64 + __builtin_ctzll(set)];
+                    if (record != UINT32_MAX) {
+                        dst[record >> 6] |= 1ULL << (record & 63);
+                    }
+                }
+            }
+        }
+    }
+
+    free(record_of);
+
+    ClosureHeader header = {0};
+    header.magic = CLOSURE_MAGIC;
+    header.version = CLOSURE_VERSION;
+    header.node_count = live;
+    header.component_count = (uint32_t) closure -> component_count;
+    header.words = words;
+    header.cache_crc = cache_crc;
+    header.components_offset = sizeof(ClosureHeader);
+    header.rows_offset = (header.components_offset + (uint64_t) live * sizeof(uint32_t) + 7) & ~7ULL;
+    header.components_crc = crc32c(component, (size_t) live * sizeof(uint32_t));
+    header.rows_crc = crc32c(rows, row_words * sizeof(uint64_t));
+    header.header_crc = header_crc(&header);
+
+    static const char padding[8] = {0};
+    struct iovec parts[] = {
+        { &header, sizeof(header) },
+        { component, (size_t) live * sizeof(uint32_t) },
+        { (void*) padding, header.rows_offset - header.components_offset - (size_t) live * sizeof(uint32_t) },
+        { rows, row_words * sizeof(uint64_t) },
+    };
+
+    int result = write_file_atomic(path, parts, 4, NULL);
+
+    free(component);
+    if (rows != closure -> rows) {
+        free(rows);
+    }
+
+    return result;
+}
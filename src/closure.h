@@ -0,0 +1,63 @@
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include "arena.h"
+#include "cache.h"
+#include "graph.h"
+#include "hashtable.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Optional transitive closure of the include graph: one bitset over FileIds per
+// component, holding every file its members reach including themselves. Rows
+// are built bottom-up in component order by OR-ing the rows of the components
+// they include in the condensed DAG. It takes component_count * node_count / 8 bytes, so it is only
+// built on request.
+//
+// catalyze.closure sits next to catalyze.cache and is indexed by its records:
+//
+//   ClosureHeader
+//   uint32_t[node_count]                 component of each record
+//   uint64_t[component_count][words]     rows
+//
+// It is written after catalyze.cache and records that cache's header_crc, so it
+// is reused only with the very cache written in the same run. A run without
+// the closure rewrites the cache and leaves the old closure unmatched. Then
+// just the components reaching a file whose includes changed are recomputed,
+// every other row is copied over.
+
+#define CLOSURE_MAGIC 0x4C544143 // "CATL"
+#define CLOSURE_VERSION 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t component_count;
+    uint64_t words;
+    uint64_t components_offset;
+    uint64_t rows_offset;
+    uint32_t cache_crc;
+    uint32_t components_crc;
+    uint32_t rows_crc;
+    uint32_t header_crc;
+} ClosureHeader;
+
+typedef struct {
+    size_t node_count;
+    size_t component_count;
+    size_t words;
+    size_t reused;
+    const uint32_t* component;
+    uint64_t* rows;
+} Closure;
+
+Closure* closure_build(Arena* arena, const Graph* graph, const Components* components, const CachedFiles* cache, const char* path);
+int closure_write(const Closure* closure, HashTable* ht, uint32_t cache_crc, const char* path);
+
+static inline const uint64_t* closure_row(const Closure* closure, FileId id) {
+    return closure -> rows + (size_t) closure -> component[id] * closure -> words;
+}
+
+#endif // !CLOSURE_H
@@ -0,0 +1,731 @@
+#include "cond.h"
+
+#include "arena.h"
+#include "config.h"
+#include "hash.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char** items;
+    size_t* lens;
+    size_t count;
+    size_t capacity;
+} NameList;
+
+static size_t find_name(const char* const* names, const size_t* lens, size_t count, const char* name, size_t len) {
+    for (size_t i = 0; i < count; i++) {
+        if (lens[i] == len && memcmp(names[i], name, len) == 0) {
+            return i;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+static void push_name(Arena* arena, NameList* list, const char* name, size_t len) {
+    if (find_name(list -> items, list -> lens, list -> count, name, len) != SIZE_MAX) {
+        return;
+    }
+
+    if (list -> count >= list -> capacity) {
+        size_t capacity = list -> capacity ? list -> capacity * 2 : 8;
+        list -> items = arena_realloc(arena, list -> items, sizeof(char*) * list -> capacity, sizeof(char*) * capacity);
+        list -> lens = arena_realloc(arena, list -> lens, sizeof(size_t) * list -> capacity, sizeof(size_t) * capacity);
+        list -> capacity = capacity;
+    }
+
+    char* copy = arena_alloc(arena, len + 1);
+    memcpy(copy, name, len);
+    copy[len] = 0;
+
+    list -> items[list -> count] = copy;
+    list -> lens[list -> count++] = len;
+}
+
+// -DNAME, -DNAME=value, -UNAME and the same with the name as its own token.
+// Calls apply with the name, the value text and whether it is a -D.
+typedef void (*MacroFlag)(void* ctx, const char* name, size_t name_len, const char* value, size_t value_len, int define);
+
+static void parse_flags(const char* flags, MacroFlag apply, void* ctx) {
+    const char* cursor = flags;
+    int expecting = 0;
+
+    while (*cursor) {
+        while (isspace((unsigned char) *cursor)) cursor++;
+
+        const char* token = cursor;
+        while (*cursor && !isspace((unsigned char) *cursor)) cursor++;
+
+        size_t len = cursor - token;
+        if (len == 0) {
+            break;
+        }
+
+        int define = expecting;
+        if (!expecting) {
+            if (len < 2 || token[0] != '-' || (token[1] != 'D' && token[1] != 'U')) {
+                continue;
+            }
+
+            define = token[1] == 'D' ? 1 : -1;
+            if (len == 2) {
+                expecting = define;
+                continue;
+            }
+
+            token += 2;
+            len -= 2;
+        }
+
+        expecting = 0;
+
+        const char* equals = memchr(token, '=', len);
+        size_t name_len = equals ? (size_t) (equals - token) : len;
+        const char* value = equals ? equals + 1 : "1";
+        size_t value_len = equals ? len - name_len - 1 : 1;
+
+        if (name_len > 0) {
+            apply(ctx, token, name_len, value, define > 0 ? value_len : 0, define > 0);
+        }
+    }
+}
+
+typedef struct {
+    Arena* arena;
+    NameList* list;
+} NameCollect;
+
+static void collect_name(void* ctx, const char* name, size_t name_len, const char* value, size_t value_len, int define) {
+    (void) value;
+    (void) value_len;
+    (void) define;
+
+    NameCollect* collect = ctx;
+    push_name(collect -> arena, collect -> list, name, name_len);
+}
+
+typedef struct {
+    const Conditions* conditions;
+    CondValue* values;
+} Assign;
+
+// Integers as the preprocessor reads them, suffixes included
+static int parse_integer(const char* text, size_t len, int64_t* value) {
+    char buffer[64];
+    if (len == 0 || len >= sizeof(buffer)) {
+        return 0;
+    }
+
+    memcpy(buffer, text, len);
+    buffer[len] = 0;
+
+    char* end = NULL;
+    unsigned long long parsed = strtoull(buffer[0] == '-' ? buffer + 1 : buffer, &end, 0);
+
+    while (*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L') {
+        end++;
+    }
+
+    if (*end != 0 || end == buffer) {
+        return 0;
+    }
+
+    *value = buffer[0] == '-' ? -(int64_t) parsed : (int64_t) parsed;
+    return 1;
+}
+
+static void assign_value(void* ctx, const char* name, size_t name_len, const char* value, size_t value_len, int define) {
+    Assign* assign = ctx;
+    const Conditions* conditions = assign -> conditions;
+
+    size_t index = find_name(conditions -> names, conditions -> name_lens, conditions -> name_count, name, name_len);
+    if (index == SIZE_MAX) {
+        return;
+    }
+
+    CondValue* slot = &assign -> values[index];
+    memset(slot, 0, sizeof(*slot));
+
+    if (define) {
+        slot -> defined = 1;
+        slot -> known = parse_integer(value, value_len, &slot -> value);
+    }
+}
+
+static int same_values(const CondValue* a, const CondValue* b, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (a[i].defined != b[i].defined || a[i].known != b[i].known || a[i].value != b[i].value) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// NULL when the targets need more than COND_MAX_VARIANTS variants
+Conditions* conditions_create(Arena* arena, const Config* config) {
+    NameList names = {0};
+
+    // Names first, so every variant has a slot for each of them
+    NameCollect collect = { arena, &names };
+    parse_flags(config -> default_flags, collect_name, &collect);
+    for (size_t t = 0; t < config -> target_count; t++) {
+        parse_flags(config -> targets[t].flags, collect_name, &collect);
+    }
+
+    Conditions* conditions = arena_alloc(arena, sizeof(Conditions));
+    memset(conditions, 0, sizeof(*conditions));
+
+    conditions -> names = names.items;
+    conditions -> name_lens = names.lens;
+    conditions -> name_count = names.count;
+    conditions -> target_variants = arena_array(arena, uint64_t, config -> target_count ? config -> target_count : 1);
+
+    size_t width = names.count ? names.count : 1;
+    size_t capacity = config -> target_count ? config -> target_count : 1;
+    conditions -> values = arena_array_zero(arena, CondValue, width * capacity);
+
+    for (size_t t = 0; t < config -> target_count; t++) {
+        CondValue* values = conditions -> values + conditions -> variant_count * width;
+        memset(values, 0, sizeof(CondValue) * width);
+
+        Assign assign = { conditions, values };
+        parse_flags(config -> default_flags, assign_value, &assign);
+        parse_flags(config -> targets[t].flags, assign_value, &assign);
+
+        size_t variant = 0;
+        while (variant < conditions -> variant_count && !same_values(conditions -> values + variant * width, values, names.count)) {
+            variant++;
+        }
+
+        if (variant == conditions -> variant_count) {
+            if (variant >= COND_MAX_VARIANTS) {
+                return NULL;
+            }
+
+            conditions -> variant_count++;
+        }
+
+        conditions -> target_variants[t] = 1ULL << variant;
+    }
+
+    // Without targets the default flags still make one variant
+    if (conditions -> variant_count == 0) {
+        Assign assign = { conditions, conditions -> values };
+        parse_flags(config -> default_flags, assign_value, &assign);
+        conditions -> variant_count = 1;
+    }
+
+    conditions -> all = conditions -> variant_count >= 64 ? UINT64_MAX : (1ULL << conditions -> variant_count) - 1;
+
+    HashState state;
+    hash_init(&state);
+    hash_update(&state, "cond", 4);
+
+    for (size_t i = 0; i < names.count; i++) {
+        hash_update(&state, names.items[i], names.lens[i] + 1);
+    }
+
+    for (size_t v = 0; v < conditions -> variant_count * names.count; v++) {
+        const CondValue* value = &conditions -> values[v];
+        hash_update(&state, &value -> value, sizeof(value -> value));
+        hash_update(&state, &value -> defined, 1);
+        hash_update(&state, &value -> known, 1);
+    }
+
+    hash_update(&state, conditions -> target_variants, sizeof(uint64_t) * config -> target_count);
+    conditions -> hash = hash_digest(&state);
+
+    return conditions;
+}
+
+// Integer constant expressions of #if, one variant at a time. A value that
+// depends on anything the flags do not decide is unknown, && and || still
+// decide when their known side does.
+typedef struct {
+    int64_t value;
+    uint8_t known;
+} Value;
+
+typedef enum {
+    TOKEN_END,
+    TOKEN_NUMBER,
+    TOKEN_IDENT,
+    TOKEN_PUNCT,
+    TOKEN_ERROR,
+} TokenKind;
+
+typedef struct {
+    const char* cursor;
+    const char* end;
+    const Conditions* conditions;
+    const CondValue* values;
+    TokenKind kind;
+    const char* token;
+    size_t len;
+    int64_t number;
+} Parser;
+
+static inline int is_ident_char(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+// Spaces, comments and continuations are left in the recorded text
+static void skip_space(Parser* parser) {
+    const char* p = parser -> cursor;
+    const char* end = parser -> end;
+
+    while (p < end) {
+        if (isspace((unsigned char) *p) || (*p == '\\' && p + 1 < end && (p[1] == '\n' || p[1] == '\r'))) {
+            p++;
+        } else if (*p == '/' && p + 1 < end && p[1] == '*') {
+            const char* close = p + 2;
+            while (close + 1 < end && !(close[0] == '*' && close[1] == '/')) close++;
+            p = close + 1 < end ? close + 2 : end;
+        } else if (*p == '/' && p + 1 < end && p[1] == '/') {
+            p = end;
+        } else {
+            break;
+        }
+    }
+
+    parser -> cursor = p;
+}
+
+static void next_token(Parser* parser) {
+    skip_space(parser);
+
+    const char* p = parser -> cursor;
+    parser -> token = p;
+
+    if (p >= parser -> end) {
+        parser -> kind = TOKEN_END;
+        parser -> len = 0;
+        return;
+    }
+
+    if (isdigit((unsigned char) *p)) {
+        const char* q = p;
+        while (q < parser -> end && (is_ident_char(*q) || *q == '\'')) q++;
+
+        char digits[64];
+        size_t n = 0;
+        for (const char* c = p; c < q && n + 1 < sizeof(digits); c++) {
+            if (*c != '\'') {
+                digits[n++] = *c;
+            }
+        }
+
+        parser -> kind = parse_integer(digits, n, &parser -> number) ? TOKEN_NUMBER : TOKEN_ERROR;
+        parser -> len = q - p;
+        parser -> cursor = q;
+        return;
+    }
+
+    if (is_ident_char(*p)) {
+        const char* q = p;
+        while (q < parser -> end && is_ident_char(*q)) q++;
+
+        parser -> kind = TOKEN_IDENT;
+        parser -> len = q - p;
+        parser -> cursor = q;
+        return;
+    }
+
+    static const char* pairs[] = { "||", "&&", "==", "!=", "<=", ">=", "<<", ">>" };
+    parser -> kind = TOKEN_PUNCT;
+    parser -> len = 1;
+
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+        if (p + 1 < parser -> end && p[0] == pairs[i][0] && p[1] == pairs[i][1]) {
+            parser -> len = 2;
+            break;
+        }
+    }
+
+    if (!strchr("|&^=!<>+-*/%~()?:", *p)) {
+        parser -> kind = TOKEN_ERROR;
+    }
+
+    parser -> cursor = p + parser -> len;
+}
+
+static int is_punct(const Parser* parser, const char* punct) {
+    size_t len = strlen(punct);
+    return parser -> kind == TOKEN_PUNCT && parser -> len == len && memcmp(parser -> token, punct, len) == 0;
+}
+
+static int is_word(const Parser* parser, const char* word) {
+    size_t len = strlen(word);
+    return parser -> kind == TOKEN_IDENT && parser -> len == len && memcmp(parser -> token, word, len) == 0;
+}
+
+static const Value unknown = { 0, 0 };
+
+static Value known(int64_t value) {
+    return (Value) { value, 1 };
+}
+
+static const CondValue* lookup(const Parser* parser, const char* name, size_t len) {
+    const Conditions* conditions = parser -> conditions;
+    size_t index = find_name(conditions -> names, conditions -> name_lens, conditions -> name_count, name, len);
+
+    return index == SIZE_MAX ? NULL : &parser -> values[index];
+}
+
+static Value parse_conditional(Parser* parser, int* error);
+
+// defined NAME and defined(NAME)
+static Value parse_defined(Parser* parser, int* error) {
+    next_token(parser);
+
+    int paren = is_punct(parser, "(");
+    if (paren) {
+        next_token(parser);
+    }
+
+    if (parser -> kind != TOKEN_IDENT) {
+        *error = 1;
+        return unknown;
+    }
+
+    const CondValue* macro = lookup(parser, parser -> token, parser -> len);
+    next_token(parser);
+
+    if (paren) {
+        if (!is_punct(parser, ")")) {
+            *error = 1;
+            return unknown;
+        }
+        next_token(parser);
+    }
+
+    return macro ? known(macro -> defined) : unknown;
+}
+
+static Value parse_primary(Parser* parser, int* error) {
+    if (parser -> kind == TOKEN_NUMBER) {
+        Value value = known(parser -> number);
+        next_token(parser);
+        return value;
+    }
+
+    if (is_punct(parser, "(")) {
+        next_token(parser);
+        Value value = parse_conditional(parser, error);
+
+        if (!is_punct(parser, ")")) {
+            *error = 1;
+            return unknown;
+        }
+
+        next_token(parser);
+        return value;
+    }
+
+    if (parser -> kind != TOKEN_IDENT) {
+        *error = 1;
+        return unknown;
+    }
+
+    if (is_word(parser, "defined")) {
+        return parse_defined(parser, error);
+    }
+
+    Value value = unknown;
+    if (is_word(parser, "true") || is_word(parser, "false")) {
+        value = known(is_word(parser, "true"));
+    } else {
+        const CondValue* macro = lookup(parser, parser -> token, parser -> len);
+        if (macro && !macro -> defined) {
+            value = known(0);
+        } else if (macro && macro -> known) {
+            value = known(macro -> value);
+        }
+    }
+
+    next_token(parser);
+
+    // A function-like macro or __has_include, the arguments are skipped
+    if (is_punct(parser, "(")) {
+        int depth = 0;
+
+        do {
+            depth += is_punct(parser, "(") - is_punct(parser, ")");
+            next_token(parser);
+        } while (depth > 0 && parser -> kind != TOKEN_END);
+
+        return unknown;
+    }
+
+    return value;
+}
+
+static Value parse_unary(Parser* parser, int* error) {
+    if (parser -> kind == TOKEN_PUNCT && parser -> len == 1 && strchr("!~-+", parser -> token[0])) {
+        char op = parser -> token[0];
+        next_token(parser);
+
+        Value value = parse_unary(parser, error);
+        if (!value.known) {
+            return unknown;
+        }
+
+        switch (op) {
+            case '!': return known(!value.value);
+            case '~': return known((int64_t) ~(uint64_t) value.value);
+            case '-': return known((int64_t) (0 - (uint64_t) value.value));
+            default: return value;
+        }
+    }
+
+    return parse_primary(parser, error);
+}
+
+static const struct { const char* op; int precedence; } binary_ops[] = {
+    { "||", 1 }, { "&&", 2 }, { "|", 3 }, { "^", 4 }, { "&", 5 },
+    { "==", 6 }, { "!=", 6 }, { "<", 7 }, { ">", 7 }, { "<=", 7 }, { ">=", 7 },
+    { "<<", 8 }, { ">>", 8 }, { "+", 9 }, { "-", 9 }, { "*", 10 }, { "/", 10 }, { "%", 10 },
+};
+
+static int binary_precedence(const Parser* parser, const char** op) {
+    for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+        if (is_punct(parser, binary_ops[i].op)) {
+            *op = binary_ops[i].op;
+            return binary_ops[i].precedence;
+        }
+    }
+
+    return 0;
+}
+
+static Value apply_binary(const char* op, Value a, Value b) {
+    if (op[0] == '&' && op[1] == '&') {
+        if ((a.known && !a.value) || (b.known && !b.value)) {
+            return known(0);
+        }
+        return a.known && b.known ? known(1) : unknown;
+    }
+
+    if (op[0] == '|' && op[1] == '|') {
+        if ((a.known && a.value) || (b.known && b.value)) {
+            return known(1);
+        }
+        return a.known && b.known ? known(0) : unknown;
+    }
+
+    if (!a.known || !b.known) {
+        return unknown;
+    }
+
+    uint64_t x = (uint64_t) a.value;
+    uint64_t y = (uint64_t) b.value;
+
+    switch (op[0]) {
+        case '|': return known((int64_t) (x | y));
+        case '^': return known((int64_t) (x ^ y));
+        case '&': return known((int64_t) (x & y));
+        case '=': return known(a.value == b.value);
+        case '!': return known(a.value != b.value);
+        case '+': return known((int64_t) (x + y));
+        case '-': return known((int64_t) (x - y));
+        case '*': return known((int64_t) (x * y));
+        case '<':
+            if (op[1] == '<') return b.value < 0 || b.value > 63 ? unknown : known((int64_t) (x << b.value));
+            return known(op[1] == '=' ? a.value <= b.value : a.value < b.value);
+        case '>':
+            if (op[1] == '>') return b.value < 0 || b.value > 63 ? unknown : known(a.value >> b.value);
+            return known(op[1] == '=' ? a.value >= b.value : a.value > b.value);
+        case '/':
+        case '%':
+            if (b.value == 0 || (a.value == INT64_MIN && b.value == -1)) {
+                return unknown;
+            }
+            return known(op[0] == '/' ? a.value / b.value : a.value % b.value);
+    }
+
+    return unknown;
+}
+
+// Precedence climbing over binary_ops, every operator is left associative
+static Value parse_binary(Parser* parser, int min_precedence, int* error) {
+    Value left = parse_unary(parser, error);
+
+    for (;;) {
+        const char* op = NULL;
+        int precedence = binary_precedence(parser, &op);
+        if (precedence == 0 || precedence < min_precedence || *error) {
+            return left;
+        }
+
+        next_token(parser);
+        Value right = parse_binary(parser, precedence + 1, error);
+        left = apply_binary(op, left, right);
+    }
+}
+
+static Value parse_conditional(Parser* parser, int* error) {
+    Value condition = parse_binary(parser, 1, error);
+    if (!is_punct(parser, "?")) {
+        return condition;
+    }
+
+    next_token(parser);
+    Value then = parse_conditional(parser, error);
+
+    if (!is_punct(parser, ":")) {
+        *error = 1;
+        return unknown;
+    }
+
+    next_token(parser);
+    Value otherwise = parse_conditional(parser, error);
+
+    if (!condition.known) {
+        return then.known && otherwise.known && then.value == otherwise.value ? then : unknown;
+    }
+
+    return condition.value ? then : otherwise;
+}
+
+// Variants where text is true and where it cannot be decided
+static void evaluate(const Conditions* conditions, const char* text, size_t len, uint64_t* taken, uint64_t* undecided) {
+    *taken = 0;
+    *undecided = 0;
+
+    for (size_t v = 0; v < conditions -> variant_count; v++) {
+        Parser parser = {
+            .cursor = text,
+            .end = text + len,
+            .conditions = conditions,
+            .values = conditions -> values + v * (conditions -> name_count ? conditions -> name_count : 1),
+        };
+
+        int error = 0;
+        next_token(&parser);
+        Value value = parse_conditional(&parser, &error);
+
+        if (error || parser.kind != TOKEN_END || !value.known) {
+            *undecided |= 1ULL << v;
+        } else if (value.value) {
+            *taken |= 1ULL << v;
+        }
+    }
+}
+
+// #ifdef NAME as #if defined(NAME), negated for #ifndef
+static void evaluate_defined(const Conditions* conditions, const char* text, size_t len, int negate, uint64_t* taken, uint64_t* undecided) {
+    Parser parser = {
+        .cursor = text,
+        .end = text + len,
+        .conditions = conditions,
+    };
+
+    *taken = 0;
+    *undecided = 0;
+
+    next_token(&parser);
+    if (parser.kind != TOKEN_IDENT) {
+        *undecided = conditions -> all;
+        return;
+    }
+
+    size_t index = find_name(conditions -> names, conditions -> name_lens, conditions -> name_count, parser.token, parser.len);
+    if (index == SIZE_MAX) {
+        *undecided = conditions -> all;
+        return;
+    }
+
+    for (size_t v = 0; v < conditions -> variant_count; v++) {
+        if (conditions -> values[v * conditions -> name_count + index].defined != negate) {
+            *taken |= 1ULL << v;
+        }
+    }
+}
+
+static const struct { const char* name; CondKind kind; } directives[] = {
+    { "if", COND_OPEN }, { "ifdef", COND_OPEN }, { "ifndef", COND_OPEN },
+    { "elif", COND_BRANCH }, { "elifdef", COND_BRANCH }, { "elifndef", COND_BRANCH }, { "else", COND_BRANCH },
+    { "endif", COND_CLOSE },
+};
+
+CondKind cond_kind(const char* name, size_t len) {
+    for (size_t i = 0; i < sizeof(directives) / sizeof(directives[0]); i++) {
+        if (strlen(directives[i].name) == len && memcmp(directives[i].name, name, len) == 0) {
+            return directives[i].kind;
+        }
+    }
+
+    return COND_NONE;
+}
+
+void cond_begin(CondStack* stack, const Conditions* conditions) {
+    stack -> conditions = conditions;
+    stack -> depth = 0;
+    stack -> overflow = 0;
+}
+
+uint64_t cond_active(const CondStack* stack) {
+    return stack -> depth ? stack -> frames[stack -> depth - 1].possible : stack -> conditions -> all;
+}
+
+// record is "#name text" as the scanner stored it. A branch may be compiled
+// where its enclosing one may, no earlier branch was surely taken and its own
+// condition is true or unknown. Nesting deeper than COND_MAX_DEPTH keeps
+// every branch of the extra levels.
+void cond_apply(CondStack* stack, const char* record) {
+    const char* name = record + 1;
+    size_t name_len = 0;
+    while (is_ident_char(name[name_len])) name_len++;
+
+    const char* text = name + name_len;
+    size_t text_len = strlen(text);
+
+    CondKind kind = cond_kind(name, name_len);
+    if (kind == COND_NONE) {
+        return;
+    }
+
+    if (kind == COND_OPEN && stack -> depth >= COND_MAX_DEPTH) {
+        stack -> overflow++;
+        return;
+    }
+
+    if (stack -> overflow > 0) {
+        stack -> overflow -= kind == COND_CLOSE;
+        return;
+    }
+
+    if (kind == COND_OPEN) {
+        uint64_t outer = cond_active(stack);
+        stack -> frames[stack -> depth++] = (CondFrame) { .outer = outer };
+    } else if (stack -> depth == 0) {
+        return;
+    }
+
+    CondFrame* frame = &stack -> frames[stack -> depth - 1];
+    uint64_t taken = 0;
+    uint64_t undecided = 0;
+    const Conditions* conditions = stack -> conditions;
+
+    if (kind == COND_CLOSE) {
+        stack -> depth--;
+        return;
+    }
+
+    if (name_len == 4 && memcmp(name, "else", 4) == 0) {
+        taken = conditions -> all;
+    } else if (name_len >= 5 && memcmp(name + name_len - 5, "ifdef", 5) == 0) {
+        evaluate_defined(conditions, text, text_len, 0, &taken, &undecided);
+    } else if (name_len >= 6 && memcmp(name + name_len - 6, "ifndef", 6) == 0) {
+        evaluate_defined(conditions, text, text_len, 1, &taken, &undecided);
+    } else {
+        evaluate(conditions, text, text_len, &taken, &undecided);
+    }
+
+    frame -> possible = frame -> outer & ~frame -> done & (taken | undecided);
+    frame -> done |= taken;
+}
@@ -0,0 +1,73 @@
+#ifndef COND_H
+#define COND_H
+
+#include "arena.h"
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Optional evaluation of #if, #ifdef, #ifndef, #elif and #else around
+// includes. Every macro named by a -D or -U in config.cat is configured, each
+// distinct set of values over those names is a variant and every target maps
+// to one. Conditions are evaluated once per variant, giving the mask of
+// variants a branch may be compiled in, and an include gets an edge only for
+// those variants.
+//
+// Only configured macros are decided: one a variant does not define is 0, as
+// the preprocessor would have it. Any other identifier, a function-like macro
+// or a value that is not an integer leaves the condition unknown and unknown
+// branches are kept, so an edge is only dropped when the flags alone rule it
+// out. A header that #defines a configured macro itself is not followed.
+
+#define COND_MAX_VARIANTS 64
+#define COND_MAX_DEPTH 64
+
+typedef struct {
+    int64_t value;
+    uint8_t defined;
+    uint8_t known;
+} CondValue;
+
+// values holds name_count entries per variant
+typedef struct {
+    const char** names;
+    size_t* name_lens;
+    size_t name_count;
+    CondValue* values;
+    size_t variant_count;
+    uint64_t* target_variants;
+    uint64_t all;
+    uint64_t hash;
+} Conditions;
+
+typedef enum {
+    COND_NONE,
+    COND_OPEN,
+    COND_BRANCH,
+    COND_CLOSE,
+} CondKind;
+
+typedef struct {
+    uint64_t possible;
+    uint64_t done;
+    uint64_t outer;
+} CondFrame;
+
+// Branch state of one file while its directives are replayed in order
+typedef struct {
+    const Conditions* conditions;
+    CondFrame frames[COND_MAX_DEPTH];
+    size_t depth;
+    size_t overflow;
+} CondStack;
+
+Conditions* conditions_create(Arena* arena, const Config* config);
+
+CondKind cond_kind(const char* name, size_t len);
+
+void cond_begin(CondStack* stack, const Conditions* conditions);
+void cond_apply(CondStack* stack, const char* record);
+uint64_t cond_active(const CondStack* stack);
+
+#endif // !COND_H
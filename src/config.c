@@ -0,0 +1,206 @@
+#include "config.h"
+
+#include "arena.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef enum {
+    BLOCK_NONE,
+    BLOCK_CONFIG,
+    BLOCK_TARGET,
+} Block;
+
+static char* trim(char* str) {
+    while (isspace((unsigned char) *str)) str++;
+
+    char* end = str + strlen(str);
+    while (end > str && isspace((unsigned char) end[-1])) end--;
+    *end = 0;
+
+    return str;
+}
+
+static char* next_token(char** cursor) {
+    char* str = *cursor;
+    while (isspace((unsigned char) *str)) str++;
+
+    if (*str == 0) {
+        *cursor = str;
+        return NULL;
+    }
+
+    char* start = str;
+    while (*str && !isspace((unsigned char) *str)) str++;
+
+    if (*str) {
+        *str++ = 0;
+    }
+
+    *cursor = str;
+    return start;
+}
+
+static int split_sources(Arena* arena, Target* target, char* value) {
+    size_t capacity = 2;
+    target -> sources = arena_array(arena, char*, capacity);
+    target -> source_count = 0;
+
+    char* token;
+    while ((token = next_token(&value)) != NULL) {
+        if (target -> source_count >= capacity) {
+            target -> sources = arena_realloc(arena, target -> sources, sizeof(char*) * capacity, sizeof(char*) * capacity * 2);
+            capacity *= 2;
+        }
+
+        target -> sources[target -> source_count++] = token;
+    }
+
+    return 0;
+}
+
+static Target* push_target(Arena* arena, Config* config, size_t* capacity) {
+    if (config -> target_count >= *capacity) {
+        config -> targets = arena_realloc(arena, config -> targets, sizeof(Target) * *capacity, sizeof(Target) * *capacity * 2);
+        *capacity *= 2;
+    }
+
+    Target* target = &config -> targets[config -> target_count++];
+    arena_memset(target, 0, sizeof(*target));
+    target -> flags = "";
+    return target;
+}
+
+static int parse_config(Arena* arena, Config* config, char* buffer) {
+    size_t target_capacity = 4;
+    config -> targets = arena_array(arena, Target, target_capacity);
+    config -> target_count = 0;
+    config -> compiler = "";
+    config -> build_dir = "";
+    config -> default_flags = "";
+
+    Block block = BLOCK_NONE;
+    Target* target = NULL;
+    int line_number = 0;
+
+    char* line = buffer;
+    while (line) {
+        char* newline = strchr(line, '\n');
+        if (newline) {
+            *newline = 0;
+        }
+
+        line_number++;
+        char* current = trim(line);
+        line = newline ? newline + 1 : NULL;
+
+        if (*current == 0) {
+            continue;
+        }
+
+        size_t len = strlen(current);
+
+        if (current[len - 1] == '{' && block == BLOCK_NONE) {
+            current[len - 1] = 0;
+
+            char* cursor = current;
+            char* keyword = next_token(&cursor);
+
+            if (keyword && strcmp(keyword, "config") == 0) {
+                block = BLOCK_CONFIG;
+                continue;
+            }
+
+            char* kind = next_token(&cursor);
+            char* name = next_token(&cursor);
+            if (!keyword || strcmp(keyword, "target") != 0 || !kind || !name) {
+                fprintf(stderr, "config: invalid block header on line %d\n", line_number);
+                return -1;
+            }
+
+            target = push_target(arena, config, &target_capacity);
+            target -> kind = kind;
+            target -> name = name;
+            block = BLOCK_TARGET;
+            continue;
+        }
+
+        if (strcmp(current, "}") == 0 && block != BLOCK_NONE) {
+            block = BLOCK_NONE;
+            target = NULL;
+            continue;
+        }
+
+        char* colon = strchr(current, ':');
+        if (!colon || block == BLOCK_NONE) {
+            fprintf(stderr, "config: unexpected '%s' on line %d\n", current, line_number);
+            return -1;
+        }
+
+        *colon = 0;
+        char* key = trim(current);
+        char* value = trim(colon + 1);
+
+        if (block == BLOCK_CONFIG) {
+            if (strcmp(key, "compiler") == 0) {
+                config -> compiler = value;
+            } else if (strcmp(key, "build_dir") == 0) {
+                config -> build_dir = value;
+            } else if (strcmp(key, "default_flags") == 0) {
+                config -> default_flags = value;
+            }
+            continue;
+        }
+
+        if (strcmp(key, "auto_discovery") == 0) {
+            target -> auto_discovery = strcmp(value, "true") == 0;
+        } else if (strcmp(key, "sources") == 0) {
+            split_sources(arena, target, value);
+        } else if (strcmp(key, "flags") == 0) {
+            target -> flags = value;
+        } else if (strcmp(key, "output") == 0) {
+            target -> output = value;
+        }
+    }
+
+    if (block != BLOCK_NONE) {
+        fprintf(stderr, "config: unterminated block\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+Config* load_config(Arena* arena, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    char* buffer = arena_alloc(arena, st.st_size + 1);
+    ssize_t bytes_read = read(fd, buffer, st.st_size);
+    close(fd);
+
+    if (bytes_read != (ssize_t) st.st_size) {
+        return NULL;
+    }
+
+    buffer[st.st_size] = 0;
+
+    Config* config = arena_alloc(arena, sizeof(*config));
+    if (parse_config(arena, config, buffer) != 0) {
+        return NULL;
+    }
+
+    return config;
+}
@@ -0,0 +1,28 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "arena.h"
+
+#include <stddef.h>
+
+typedef struct {
+    char* kind;
+    char* name;
+    int auto_discovery;
+    char** sources;
+    size_t source_count;
+    char* flags;
+    char* output;
+} Target;
+
+typedef struct {
+    char* compiler;
+    char* build_dir;
+    char* default_flags;
+    Target* targets;
+    size_t target_count;
+} Config;
+
+Config* load_config(Arena* arena, const char* path);
+
+#endif // !CONFIG_H
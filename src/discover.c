@@ -0,0 +1,315 @@
+#include "discover.h"
+
+#include "arena.h"
+#include "hash.h"
+#include "hashtable.h"
+#include "memo.h"
+#include "path.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define DIRENT_BUFFER_SIZE (32 * 1024)
+#define WALK_MAX_DEPTH 64
+#define WALK_PATH_CAPACITY 4096
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// One getdents buffer per depth so a parent can keep iterating its entries
+// while a child directory is walked. The path buffer is shared and holds the
+// canonical path of the directory being walked, so each level only appends its
+// entry name after the parent's prefix. visited holds the device and inode of
+// every directory entered, a symlink back up the tree is walked once.
+typedef struct {
+    HashTable* ht;
+    PathCache* paths;
+    SourceList* list;
+    uint64_t variants;
+    MemoTable visited;
+    char path[WALK_PATH_CAPACITY];
+    char* buffers[WALK_MAX_DEPTH];
+} Walker;
+
+// Translation units first, is_translation_unit only checks the leading ones
+static const char* extensions[] = {
+    ".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp", ".hxx",
+};
+
+#define UNIT_EXTENSIONS 4
+
+static int has_extension(const char* name, size_t count) {
+    const char* dot = strrchr(name, '.');
+    if (!dot) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(dot, extensions[i]) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int is_source_file(const char* name) {
+    return has_extension(name, sizeof(extensions) / sizeof(extensions[0]));
+}
+
+int is_translation_unit(const char* name) {
+    return has_extension(name, UNIT_EXTENSIONS);
+}
+
+// A file listed by several targets collects all their variants
+static int add_canonical(HashTable* ht, SourceList* list, const char* canonical, uint64_t variants) {
+    FileId id = intern_path(ht, canonical);
+    if (id == FILE_ID_NONE) {
+        return -1;
+    }
+
+    Node* node = ht_node(ht, id);
+    node -> variants |= variants;
+
+    if (node -> discovered) {
+        return 0;
+    }
+
+    if (list -> count >= list -> capacity) {
+        size_t capacity = list -> capacity ? list -> capacity * 2 : 64;
+        list -> ids = arena_realloc(ht -> arena, list -> ids, sizeof(FileId) * list -> capacity, sizeof(FileId) * capacity);
+        list -> capacity = capacity;
+
+        if (!list -> ids) {
+            return -1;
+        }
+    }
+
+    node -> discovered = 1;
+    list -> ids[list -> count++] = id;
+    return 0;
+}
+
+// Interned under the canonical path, a file reached through a symlinked
+// directory is the same source as the one found through the real one
+int add_source(HashTable* ht, PathCache* paths, SourceList* list, const char* path, uint64_t variants) {
+    char canonical[PATH_MAX];
+    if (path_canonical(paths, canonical, sizeof(canonical), "", 0, path) == 0) {
+        return -1;
+    }
+
+    return add_canonical(ht, list, canonical, variants);
+}
+
+// Records the directory behind fd, 0 when it was entered before
+static int first_visit(Walker* walker, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return 0;
+    }
+
+    uint64_t key[2] = { (uint64_t) st.st_dev, (uint64_t) st.st_ino };
+    uint64_t hash = hash_buffer(key, sizeof(key));
+
+    if (memo_find(&walker -> visited, hash, (const char*) key, sizeof(key))) {
+        return 0;
+    }
+
+    uint8_t seen = 1;
+    memo_insert(&walker -> visited, hash, (const char*) key, sizeof(key), &seen, sizeof(seen));
+    return 1;
+}
+
+// Sets the path buffer to the canonical form of its first len bytes, with a
+// trailing slash unless it is the working directory. Returns the new length,
+// SIZE_MAX when it does not fit.
+static size_t canonical_prefix(Walker* walker, size_t len) {
+    size_t canonical = path_canonical_dir(walker -> paths, walker -> path, WALK_PATH_CAPACITY - 1, walker -> path, len);
+
+    if (canonical != SIZE_MAX && canonical > 0) {
+        walker -> path[canonical++] = '/';
+        walker -> path[canonical] = 0;
+    }
+
+    return canonical;
+}
+
+static int walk(Walker* walker, int dirfd, size_t len, int depth);
+
+// A symlinked directory is walked under the path it resolves to, the parent's
+// prefix is put back afterwards
+static int walk_link(Walker* walker, int fd, size_t parent_len, size_t len, int depth) {
+    char saved[WALK_PATH_CAPACITY];
+    memcpy(saved, walker -> path, len + 1);
+
+    size_t canonical = canonical_prefix(walker, len);
+    int result = 0;
+
+    if (canonical == SIZE_MAX) {
+        fprintf(stderr, "Skipping %s: path too long\n", saved);
+    } else {
+        result = walk(walker, fd, canonical, depth);
+    }
+
+    memcpy(walker -> path, saved, parent_len);
+    return result;
+}
+
+static int walk(Walker* walker, int dirfd, size_t len, int depth) {
+    if (depth >= WALK_MAX_DEPTH) {
+        fprintf(stderr, "Skipping %s: directory tree too deep\n", walker -> path);
+        return 0;
+    }
+
+    if (!walker -> buffers[depth]) {
+        walker -> buffers[depth] = malloc(DIRENT_BUFFER_SIZE);
+        if (!walker -> buffers[depth]) {
+            return -1;
+        }
+    }
+
+    char* buffer = walker -> buffers[depth];
+
+    for (;;) {
+        long bytes = syscall(SYS_getdents64, dirfd, buffer, DIRENT_BUFFER_SIZE);
+        if (bytes < 0) {
+            return -1;
+        }
+
+        if (bytes == 0) {
+            return 0;
+        }
+
+        for (long offset = 0; offset < bytes;) {
+            struct linux_dirent64* entry = (struct linux_dirent64*) (buffer + offset);
+            offset += entry -> d_reclen;
+
+            const char* name = entry -> d_name;
+            if (name[0] == '.') {
+                continue;
+            }
+
+            unsigned char type = entry -> d_type;
+            int link = type == DT_LNK;
+
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                struct stat st;
+                if (type == DT_UNKNOWN && fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                    link = S_ISLNK(st.st_mode);
+                }
+
+                if (fstatat(dirfd, name, &st, 0) != 0) {
+                    continue;
+                }
+
+                type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+            }
+
+            if (type != DT_DIR && (type != DT_REG || !is_source_file(name))) {
+                continue;
+            }
+
+            size_t name_len = strlen(name);
+            if (len + name_len + 2 > WALK_PATH_CAPACITY) {
+                fprintf(stderr, "Skipping %s: path too long\n", name);
+                continue;
+            }
+
+            memcpy(walker -> path + len, name, name_len + 1);
+
+            // The prefix is canonical and path_canonical leaves the file name
+            // alone, a symlinked file included
+            if (type == DT_REG) {
+                if (add_canonical(walker -> ht, walker -> list, walker -> path, walker -> variants) != 0) {
+                    return -1;
+                }
+                continue;
+            }
+
+            int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd == -1) {
+                continue;
+            }
+
+            // A directory entered before is not walked again, whether it is
+            // an ancestor or was reached through another link
+            int result = 0;
+            if (first_visit(walker, fd)) {
+                if (link) {
+                    result = walk_link(walker, fd, len, len + name_len, depth + 1);
+                } else {
+                    walker -> path[len + name_len] = '/';
+                    walker -> path[len + name_len + 1] = 0;
+                    result = walk(walker, fd, len + name_len + 1, depth + 1);
+                }
+            }
+            close(fd);
+
+            if (result != 0) {
+                return result;
+            }
+        }
+    }
+}
+
+int discover_sources(HashTable* ht, PathCache* paths, SourceList* list, const char* root, uint64_t variants) {
+    struct stat st;
+    if (stat(root, &st) != 0) {
+        fprintf(stderr, "Source not found: %s\n", root);
+        return 0;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        return add_source(ht, paths, list, root, variants);
+    }
+
+    Walker* walker = calloc(1, sizeof(*walker));
+    if (!walker) {
+        return -1;
+    }
+
+    walker -> ht = ht;
+    walker -> paths = paths;
+    walker -> variants = variants;
+    walker -> list = list;
+    memo_init(&walker -> visited);
+
+    size_t len = strlen(root);
+    while (len > 1 && root[len - 1] == '/') len--;
+
+    // Children of the working directory are keyed without a "./" prefix, as
+    // the include resolver produces them
+    int result = -1;
+    if (len < WALK_PATH_CAPACITY) {
+        memcpy(walker -> path, root, len);
+        len = canonical_prefix(walker, len);
+    }
+
+    int fd = len < WALK_PATH_CAPACITY ? open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    if (fd != -1) {
+        first_visit(walker, fd);
+        result = walk(walker, fd, len, 0);
+        close(fd);
+    }
+
+    for (int i = 0; i < WALK_MAX_DEPTH; i++) {
+        free(walker -> buffers[i]);
+    }
+    memo_destroy(&walker -> visited);
+    free(walker);
+
+    return result;
+}
@@ -0,0 +1,23 @@
+#ifndef DISCOVER_H
+#define DISCOVER_H
+
+#include "hashtable.h"
+#include "path.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Files to load, each path is interned once when it is first seen
+typedef struct {
+    FileId* ids;
+    size_t count;
+    size_t capacity;
+} SourceList;
+
+int is_source_file(const char* name);
+int is_translation_unit(const char* name);
+
+int add_source(HashTable* ht, PathCache* paths, SourceList* list, const char* path, uint64_t variants);
+int discover_sources(HashTable* ht, PathCache* paths, SourceList* list, const char* root, uint64_t variants);
+
+#endif // !DISCOVER_H
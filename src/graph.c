@@ -0,0 +1,481 @@
+#include "graph.h"
+
+#include "arena.h"
+#include "hashtable.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Counts and then fills both directions in two passes over the per-node lists,
+// keeping the edges that hold for one of variants. seen[dep] remembers the last
+// file that listed dep, which drops duplicates without sorting. Freezing with
+// VARIANTS_ALL also moves every node's dependencies into the frozen forward
+// edges, the masks of repeated includes merged, so the growable lists are no
+// longer referenced and later freezes of single variants read the short ones.
+Graph* graph_freeze(Arena* arena, HashTable* ht, uint64_t variants) {
+    size_t count = ht -> node_count;
+    int moves = variants == VARIANTS_ALL;
+
+    Graph* graph = arena_alloc(arena, sizeof(*graph));
+    uint32_t* forward = arena_array_zero(arena, uint32_t, count + 1);
+    uint32_t* reverse = arena_array_zero(arena, uint32_t, count + 1);
+    FileId* seen = malloc(sizeof(FileId) * (count ? count : 1));
+    uint32_t* position = malloc(sizeof(uint32_t) * (count ? count : 1));
+
+    if (!graph || !forward || !reverse || !seen || !position) {
+        free(seen);
+        free(position);
+        return NULL;
+    }
+
+    memset(seen, 0xFF, sizeof(FileId) * count);
+
+    for (FileId id = 0; id < count; id++) {
+        Node* node = ht_node(ht, id);
+
+        for (size_t k = 0; k < node -> dep_count; k++) {
+            FileId dep = node -> dependencies[k];
+            if ((node -> dep_variants[k] & variants) && seen[dep] != id) {
+                seen[dep] = id;
+                forward[id + 1]++;
+                reverse[dep + 1]++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        forward[i + 1] += forward[i];
+        reverse[i + 1] += reverse[i];
+    }
+
+    size_t edge_count = forward[count];
+    FileId* forward_targets = arena_array(arena, FileId, edge_count ? edge_count : 1);
+    FileId* reverse_targets = arena_array(arena, FileId, edge_count ? edge_count : 1);
+    uint64_t* forward_variants = moves ? arena_array(arena, uint64_t, edge_count ? edge_count : 1) : NULL;
+    uint32_t* cursor = malloc(sizeof(uint32_t) * (count ? count : 1));
+
+    if (!forward_targets || !reverse_targets || (moves && !forward_variants) || !cursor) {
+        free(seen);
+        free(position);
+        free(cursor);
+        return NULL;
+    }
+
+    memcpy(cursor, reverse, sizeof(uint32_t) * count);
+    memset(seen, 0xFF, sizeof(FileId) * count);
+
+    for (FileId id = 0; id < count; id++) {
+        Node* node = ht_node(ht, id);
+        FileId* row = forward_targets + forward[id];
+        uint64_t* row_variants = moves ? forward_variants + forward[id] : NULL;
+        size_t len = 0;
+
+        for (size_t k = 0; k < node -> dep_count; k++) {
+            FileId dep = node -> dependencies[k];
+            uint64_t mask = node -> dep_variants[k];
+
+            if (!(mask & variants)) {
+                continue;
+            }
+
+            if (seen[dep] != id) {
+                seen[dep] = id;
+                position[dep] = (uint32_t) len;
+                if (moves) {
+                    row_variants[len] = mask;
+                }
+
+                row[len++] = dep;
+                reverse_targets[cursor[dep]++] = id;
+            } else if (moves) {
+                row_variants[position[dep]] |= mask;
+            }
+        }
+
+        if (moves) {
+            node -> dependencies = row;
+            node -> dep_variants = row_variants;
+            node -> dep_count = len;
+            node -> dep_capacity = len;
+        }
+    }
+
+    free(seen);
+    free(position);
+    free(cursor);
+
+    graph -> node_count = count;
+    graph -> edge_count = edge_count;
+    graph -> forward = (GraphEdges) { .offsets = forward, .targets = forward_targets };
+    graph -> reverse = (GraphEdges) { .offsets = reverse, .targets = reverse_targets };
+
+    return graph;
+}
+
+// Adds every file that transitively includes one already in bits. The walk is
+// breadth first over the condensed DAG, a component is queued once and all its
+// members are marked when it is reached, so include cycles cost nothing extra.
+int components_expand_reverse(const Graph* graph, const Components* components, uint64_t* bits, size_t* count) {
+    size_t component_words = (components -> count + 63) / 64;
+    uint64_t* reached = calloc(component_words ? component_words : 1, sizeof(uint64_t));
+    uint32_t* queue = malloc(sizeof(uint32_t) * (components -> count ? components -> count : 1));
+
+    if (!reached || !queue) {
+        free(reached);
+        free(queue);
+        return -1;
+    }
+
+    size_t head = 0;
+    size_t tail = 0;
+
+    for (size_t word = 0; word < (graph -> node_count + 63) / 64; word++) {
+        for (uint64_t set = bits[word]; set; set &= set - 1) {
+            uint32_t c = components -> component[word * 64 + __builtin_ctzll(set)];
+
+            if (!bitset_test(reached, c)) {
+                reached[c >> 6] |= 1ULL << (c & 63);
+                queue[tail++] = c;
+            }
+        }
+    }
+
+    while (head < tail) {
+        uint32_t c = queue[head++];
+        const uint32_t* includers = graph_edges(&components -> reverse, c);
+        uint32_t degree = graph_degree(&components -> reverse, c);
+
+        for (uint32_t k = 0; k < degree; k++) {
+            uint32_t includer = includers[k];
+
+            if (!bitset_test(reached, includer)) {
+                reached[includer >> 6] |= 1ULL << (includer & 63);
+                queue[tail++] = includer;
+            }
+        }
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < tail; i++) {
+        uint32_t c = queue[i];
+
+        for (uint32_t m = components -> offsets[c]; m < components -> offsets[c + 1]; m++) {
+            FileId member = components -> members[m];
+            bits[member >> 6] |= 1ULL << (member & 63);
+        }
+
+        total += components -> offsets[c + 1] - components -> offsets[c];
+    }
+
+    free(reached);
+    free(queue);
+
+    if (count) {
+        *count = total;
+    }
+
+    return 0;
+}
+
+// Seeds the set with every node whose content changed since the cache
+uint64_t* graph_propagate_dirty(Arena* arena, const Graph* graph, const Components* components, HashTable* ht, size_t* dirty_count) {
+    size_t words = (graph -> node_count + 63) / 64;
+    uint64_t* bits = arena_array_zero(arena, uint64_t, words ? words : 1);
+    if (!bits) {
+        return NULL;
+    }
+
+    for (FileId id = 0; id < graph -> node_count; id++) {
+        if (ht_node(ht, id) -> dirty) {
+            bits[id >> 6] |= 1ULL << (id & 63);
+        }
+    }
+
+    if (components_expand_reverse(graph, components, bits, dirty_count) != 0) {
+        return NULL;
+    }
+
+    return bits;
+}
+
+// Edges between components, built like graph_freeze with seen[] dropping the
+// repeats and edges inside a component.
+static int condense(Arena* arena, const Graph* graph, Components* components) {
+    size_t count = components -> count;
+
+    uint32_t* forward = arena_array_zero(arena, uint32_t, count + 1);
+    uint32_t* reverse = arena_array_zero(arena, uint32_t, count + 1);
+    uint32_t* seen = malloc(sizeof(uint32_t) * (count ? count : 1));
+
+    if (!forward || !reverse || !seen) {
+        free(seen);
+        return -1;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t* targets = NULL;
+        uint32_t* sources = NULL;
+        uint32_t* cursor = NULL;
+
+        if (pass == 1) {
+            for (size_t i = 0; i < count; i++) {
+                forward[i + 1] += forward[i];
+                reverse[i + 1] += reverse[i];
+            }
+
+            size_t edge_count = forward[count];
+            targets = arena_array(arena, uint32_t, edge_count ? edge_count : 1);
+            sources = arena_array(arena, uint32_t, edge_count ? edge_count : 1);
+            cursor = malloc(sizeof(uint32_t) * (count ? count : 1));
+
+            if (!targets || !sources || !cursor) {
+                free(seen);
+                free(cursor);
+                return -1;
+            }
+
+            memcpy(cursor, reverse, sizeof(uint32_t) * count);
+            components -> forward = (GraphEdges) { .offsets = forward, .targets = targets };
+            components -> reverse = (GraphEdges) { .offsets = reverse, .targets = sources };
+        }
+
+        memset(seen, 0xFF, sizeof(uint32_t) * count);
+
+        for (uint32_t c = 0; c < count; c++) {
+            uint32_t len = 0;
+
+            for (uint32_t m = components -> offsets[c]; m < components -> offsets[c + 1]; m++) {
+                FileId member = components -> members[m];
+                const FileId* deps = graph_edges(&graph -> forward, member);
+
+                for (uint32_t k = 0; k < graph_degree(&graph -> forward, member); k++) {
+                    uint32_t dep = components -> component[deps[k]];
+                    if (dep == c || seen[dep] == c) {
+                        continue;
+                    }
+
+                    seen[dep] = c;
+
+                    if (pass == 0) {
+                        forward[c + 1]++;
+                        reverse[dep + 1]++;
+                    } else {
+                        targets[forward[c] + len++] = dep;
+                        sources[cursor[dep]++] = c;
+                    }
+                }
+            }
+        }
+
+        free(cursor);
+    }
+
+    components -> cyclic = 0;
+    for (uint32_t c = 0; c < count; c++) {
+        components -> cyclic += component_is_cycle(graph, components, c);
+    }
+
+    free(seen);
+    return 0;
+}
+
+typedef struct {
+    FileId node;
+    uint32_t edge;
+} TarjanFrame;
+
+// Tarjan with an explicit frame stack, so include chains of any depth are fine.
+// A visited node without a component is still on the node stack.
+Components* graph_components(Arena* arena, const Graph* graph) {
+    size_t count = graph -> node_count;
+
+    Components* components = arena_alloc(arena, sizeof(*components));
+    uint32_t* component = arena_array(arena, uint32_t, count ? count : 1);
+    uint32_t* offsets = arena_array(arena, uint32_t, count + 1);
+    FileId* members = arena_array(arena, FileId, count ? count : 1);
+    uint32_t* position = arena_array(arena, uint32_t, count ? count : 1);
+
+    uint32_t* index = malloc(sizeof(uint32_t) * (count ? count : 1));
+    uint32_t* low = malloc(sizeof(uint32_t) * (count ? count : 1));
+    FileId* stack = malloc(sizeof(FileId) * (count ? count : 1));
+    TarjanFrame* frames = malloc(sizeof(TarjanFrame) * (count ? count : 1));
+
+    if (!components || !component || !offsets || !members || !position || !index || !low || !stack || !frames) {
+        free(index);
+        free(low);
+        free(stack);
+        free(frames);
+        return NULL;
+    }
+
+    memset(index, 0xFF, sizeof(uint32_t) * count);
+    memset(component, 0xFF, sizeof(uint32_t) * count);
+
+    uint32_t next_index = 0;
+    uint32_t component_count = 0;
+    size_t member_count = 0;
+    size_t stack_size = 0;
+    offsets[0] = 0;
+
+    for (FileId root = 0; root < count; root++) {
+        if (index[root] != UINT32_MAX) {
+            continue;
+        }
+
+        size_t depth = 0;
+        frames[depth++] = (TarjanFrame) { root, 0 };
+        index[root] = low[root] = next_index++;
+        stack[stack_size++] = root;
+
+        while (depth > 0) {
+            TarjanFrame* frame = &frames[depth - 1];
+            FileId node = frame -> node;
+
+            if (frame -> edge < graph_degree(&graph -> forward, node)) {
+                FileId dep = graph_edges(&graph -> forward, node)[frame -> edge++];
+
+                if (index[dep] == UINT32_MAX) {
+                    index[dep] = low[dep] = next_index++;
+                    stack[stack_size++] = dep;
+                    frames[depth++] = (TarjanFrame) { dep, 0 };
+                } else if (component[dep] == UINT32_MAX && index[dep] < low[node]) {
+                    low[node] = index[dep];
+                }
+                continue;
+            }
+
+            depth--;
+
+            if (low[node] == index[node]) {
+                FileId member;
+                do {
+                    member = stack[--stack_size];
+                    component[member] = component_count;
+                    position[member] = (uint32_t) member_count;
+                    members[member_count++] = member;
+                } while (member != node);
+
+                offsets[++component_count] = (uint32_t) member_count;
+            }
+
+            if (depth > 0) {
+                FileId parent = frames[depth - 1].node;
+                if (low[node] < low[parent]) {
+                    low[parent] = low[node];
+                }
+            }
+        }
+    }
+
+    free(index);
+    free(low);
+    free(stack);
+    free(frames);
+
+    components -> count = component_count;
+    components -> component = component;
+    components -> offsets = offsets;
+    components -> members = members;
+    components -> position = position;
+
+    if (condense(arena, graph, components) != 0) {
+        return NULL;
+    }
+
+    return components;
+}
+
+// A single file is only a cycle when it includes itself
+int component_is_cycle(const Graph* graph, const Components* components, uint32_t c) {
+    if (components -> offsets[c + 1] - components -> offsets[c] > 1) {
+        return 1;
+    }
+
+    FileId member = components -> members[components -> offsets[c]];
+    const FileId* deps = graph_edges(&graph -> forward, member);
+
+    for (uint32_t k = 0; k < graph_degree(&graph -> forward, member); k++) {
+        if (deps[k] == member) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Writes one include cycle through the component's first member into path,
+// which needs room for the component's members. Breadth first inside the
+// component, so the cycle is a shortest one. Returns its length, 0 when the
+// component is not a cycle.
+size_t component_cycle(const Graph* graph, const Components* components, uint32_t c, FileId* path) {
+    uint32_t member_count = components -> offsets[c + 1] - components -> offsets[c];
+    const FileId* members = components -> members + components -> offsets[c];
+    FileId start = members[0];
+
+    if (!component_is_cycle(graph, components, c)) {
+        return 0;
+    }
+
+    if (member_count == 1) {
+        path[0] = start;
+        return 1;
+    }
+
+    // parent and queue are indexed by position in members
+    uint32_t* parent = malloc(sizeof(uint32_t) * member_count);
+    uint32_t* queue = malloc(sizeof(uint32_t) * member_count);
+
+    if (!parent || !queue) {
+        free(parent);
+        free(queue);
+        return 0;
+    }
+
+    memset(parent, 0xFF, sizeof(uint32_t) * member_count);
+
+    size_t head = 0;
+    size_t tail = 0;
+    uint32_t last = UINT32_MAX;
+
+    parent[0] = 0;
+    queue[tail++] = 0;
+
+    while (head < tail && last == UINT32_MAX) {
+        uint32_t at = queue[head++];
+        const FileId* deps = graph_edges(&graph -> forward, members[at]);
+        uint32_t degree = graph_degree(&graph -> forward, members[at]);
+
+        for (uint32_t k = 0; k < degree; k++) {
+            if (components -> component[deps[k]] != c) {
+                continue;
+            }
+
+            if (deps[k] == start) {
+                last = at;
+                break;
+            }
+
+            uint32_t next = components -> position[deps[k]] - components -> offsets[c];
+            if (parent[next] == UINT32_MAX) {
+                parent[next] = at;
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    size_t length = 0;
+    for (uint32_t at = last; at != 0; at = parent[at]) {
+        queue[length++] = at;
+    }
+    queue[length++] = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        path[i] = members[queue[length - 1 - i]];
+    }
+
+    free(parent);
+    free(queue);
+
+    return length;
+}
@@ -0,0 +1,64 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "arena.h"
+#include "hashtable.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compressed sparse row copy of the include graph, built once scanning is done.
+// The edges of id are targets[offsets[id] .. offsets[id + 1]), forward holds
+// what a file includes in include order and reverse who includes it sorted by
+// FileId. Repeated includes of the same file are dropped.
+typedef struct {
+    uint32_t* offsets;
+    FileId* targets;
+} GraphEdges;
+
+typedef struct {
+    size_t node_count;
+    size_t edge_count;
+    GraphEdges forward;
+    GraphEdges reverse;
+} Graph;
+
+// Strongly connected components in the order Tarjan completes them, so every
+// component comes after all the components its members include. The members of
+// c are members[offsets[c] .. offsets[c + 1]) and position maps a FileId to its
+// index in members. forward and reverse hold the condensed DAG between
+// components in the same CSR layout as Graph, cyclic counts the components that
+// are include cycles.
+typedef struct {
+    size_t count;
+    size_t cyclic;
+    uint32_t* component;
+    uint32_t* offsets;
+    FileId* members;
+    uint32_t* position;
+    GraphEdges forward;
+    GraphEdges reverse;
+} Components;
+
+Graph* graph_freeze(Arena* arena, HashTable* ht, uint64_t variants);
+Components* graph_components(Arena* arena, const Graph* graph);
+
+int component_is_cycle(const Graph* graph, const Components* components, uint32_t c);
+size_t component_cycle(const Graph* graph, const Components* components, uint32_t c, FileId* path);
+
+uint64_t* graph_propagate_dirty(Arena* arena, const Graph* graph, const Components* components, HashTable* ht, size_t* dirty_count);
+int components_expand_reverse(const Graph* graph, const Components* components, uint64_t* bits, size_t* count);
+
+static inline uint32_t graph_degree(const GraphEdges* edges, FileId id) {
+    return edges -> offsets[id + 1] - edges -> offsets[id];
+}
+
+static inline const FileId* graph_edges(const GraphEdges* edges, FileId id) {
+    return edges -> targets + edges -> offsets[id];
+}
+
+static inline int bitset_test(const uint64_t* bits, FileId id) {
+    return (bits[id >> 6] >> (id & 63)) & 1;
+}
+
+#endif // !GRAPH_H
@@ -0,0 +1,320 @@
+#include "hash.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+// Stripe n of a block is keyed with secret[n .. n + 7], the block scramble uses
+// the last eight words.
+static const uint64_t secret[HASH_BLOCK_STRIPES + 8] = {
+    0xc0e16b163a85a4dcULL, 0x890acd8dd443c47cULL, 0xb3889d8a6dc47761ULL,
+    0x6a0398e528f0ae6aULL, 0x048344ece48a855eULL, 0xf175cfea21871330ULL,
+    0x391ceef02702c2fdULL, 0x4baf8cac4784cb12ULL, 0x3547744583a3f88eULL,
+    0xd9cf2b15c6b6c90eULL, 0x961facc76d5fe21cULL, 0x0094ab49d50f11f9ULL,
+    0xe3211e37bdbeb6dcULL, 0x62fe6c274ff3511aULL, 0x5ac30b329fdf0574ULL,
+    0x1450582c6b65b406ULL, 0x7a30fcc7888eb791ULL, 0x5540f5ba6a15576eULL,
+    0x16cef0559096d3e9ULL, 0x2cf8f14b06874899ULL, 0xc9c9263b6e2ce103ULL,
+    0xd6ff920b0a9faa6dULL, 0x53192697db998dc1ULL, 0x73ea9b9bc7cd18d7ULL,
+};
+
+typedef struct {
+    const char* name;
+    void (*accumulate)(uint64_t* acc, const uint8_t* data, size_t stripes, const uint64_t* key);
+    void (*scramble)(uint64_t* acc, const uint64_t* key);
+} HashKernel;
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t fold64(uint64_t lhs, uint64_t rhs) {
+    __uint128_t product = (__uint128_t) lhs * rhs;
+    return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+static inline uint64_t avalanche(uint64_t hash) {
+    hash ^= hash >> 37;
+    hash *= 0x165667919E3779F9ULL;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static void accumulate_scalar(uint64_t* acc, const uint8_t* data, size_t stripes, const uint64_t* key) {
+    for (size_t n = 0; n < stripes; n++) {
+        const uint8_t* stripe = data + n * HASH_STRIPE_LEN;
+
+        for (int i = 0; i < 8; i++) {
+            uint64_t value = read64(stripe + i * 8);
+            uint64_t keyed = value ^ key[n + i];
+
+            acc[i ^ 1] += value;
+            acc[i] += (uint64_t) (uint32_t) keyed * (keyed >> 32);
+        }
+    }
+}
+
+static void scramble_scalar(uint64_t* acc, const uint64_t* key) {
+    for (int i = 0; i < 8; i++) {
+        uint64_t value = acc[i];
+        value ^= value >> 47;
+        value ^= key[i];
+        acc[i] = value * PRIME32_1;
+    }
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(uint64_t* acc, const uint8_t* data, size_t stripes, const uint64_t* key) {
+    __m256i acc_lo = _mm256_loadu_si256((const __m256i*) acc);
+    __m256i acc_hi = _mm256_loadu_si256((const __m256i*) (acc + 4));
+
+    for (size_t n = 0; n < stripes; n++) {
+        const uint8_t* stripe = data + n * HASH_STRIPE_LEN;
+
+        __m256i data_lo = _mm256_loadu_si256((const __m256i*) stripe);
+        __m256i data_hi = _mm256_loadu_si256((const __m256i*) (stripe + 32));
+        __m256i key_lo = _mm256_loadu_si256((const __m256i*) (key + n));
+        __m256i key_hi = _mm256_loadu_si256((const __m256i*) (key + n + 4));
+
+        __m256i keyed_lo = _mm256_xor_si256(data_lo, key_lo);
+        __m256i keyed_hi = _mm256_xor_si256(data_hi, key_hi);
+
+        __m256i product_lo = _mm256_mul_epu32(keyed_lo, _mm256_srli_epi64(keyed_lo, 32));
+        __m256i product_hi = _mm256_mul_epu32(keyed_hi, _mm256_srli_epi64(keyed_hi, 32));
+
+        __m256i swapped_lo = _mm256_shuffle_epi32(data_lo, _MM_SHUFFLE(1, 0, 3, 2));
+        __m256i swapped_hi = _mm256_shuffle_epi32(data_hi, _MM_SHUFFLE(1, 0, 3, 2));
+
+        acc_lo = _mm256_add_epi64(acc_lo, _mm256_add_epi64(product_lo, swapped_lo));
+        acc_hi = _mm256_add_epi64(acc_hi, _mm256_add_epi64(product_hi, swapped_hi));
+    }
+
+    _mm256_storeu_si256((__m256i*) acc, acc_lo);
+    _mm256_storeu_si256((__m256i*) (acc + 4), acc_hi);
+}
+
+__attribute__((target("avx2")))
+static void scramble_avx2(uint64_t* acc, const uint64_t* key) {
+    const __m256i prime = _mm256_set1_epi32(PRIME32_1);
+
+    for (int i = 0; i < 8; i += 4) {
+        __m256i value = _mm256_loadu_si256((const __m256i*) (acc + i));
+        value = _mm256_xor_si256(value, _mm256_srli_epi64(value, 47));
+        value = _mm256_xor_si256(value, _mm256_loadu_si256((const __m256i*) (key + i)));
+
+        __m256i product_lo = _mm256_mul_epu32(value, prime);
+        __m256i product_hi = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), prime);
+        value = _mm256_add_epi64(product_lo, _mm256_slli_epi64(product_hi, 32));
+
+        _mm256_storeu_si256((__m256i*) (acc + i), value);
+    }
+}
+
+static const HashKernel scalar_kernel = { "scalar", accumulate_scalar, scramble_scalar };
+static const HashKernel avx2_kernel = { "avx2", accumulate_avx2, scramble_avx2 };
+
+static const HashKernel* active_kernel = NULL;
+
+static const HashKernel* get_kernel(void) {
+    const HashKernel* kernel = __atomic_load_n(&active_kernel, __ATOMIC_ACQUIRE);
+    if (kernel) {
+        return kernel;
+    }
+
+    __builtin_cpu_init();
+    kernel = __builtin_cpu_supports("avx2") ? &avx2_kernel : &scalar_kernel;
+    __atomic_store_n(&active_kernel, kernel, __ATOMIC_RELEASE);
+
+    return kernel;
+}
+
+static void consume_stripes(HashState* state, const HashKernel* kernel, const uint8_t* data, size_t count) {
+    while (count > 0) {
+        size_t room = HASH_BLOCK_STRIPES - state -> stripes;
+        size_t n = count < room ? count : room;
+
+        kernel -> accumulate(state -> acc, data, n, secret + state -> stripes);
+        state -> stripes += n;
+        data += n * HASH_STRIPE_LEN;
+        count -= n;
+
+        if (state -> stripes == HASH_BLOCK_STRIPES) {
+            kernel -> scramble(state -> acc, secret + HASH_BLOCK_STRIPES);
+            state -> stripes = 0;
+        }
+    }
+}
+
+void hash_init(HashState* state) {
+    state -> acc[0] = PRIME32_3;
+    state -> acc[1] = PRIME64_1;
+    state -> acc[2] = PRIME64_2;
+    state -> acc[3] = PRIME64_3;
+    state -> acc[4] = PRIME64_4;
+    state -> acc[5] = PRIME32_2;
+    state -> acc[6] = PRIME64_5;
+    state -> acc[7] = PRIME32_1;
+
+    state -> buffered = 0;
+    state -> stripes = 0;
+    state -> total_len = 0;
+}
+
+void hash_update(HashState* state, const void* data, size_t len) {
+    const HashKernel* kernel = get_kernel();
+    const uint8_t* p = data;
+
+    state -> total_len += len;
+
+    if (state -> buffered > 0) {
+        size_t fill = HASH_STRIPE_LEN - state -> buffered;
+        if (len < fill) {
+            memcpy(state -> buffer + state -> buffered, p, len);
+            state -> buffered += len;
+            return;
+        }
+
+        memcpy(state -> buffer + state -> buffered, p, fill);
+        consume_stripes(state, kernel, state -> buffer, 1);
+        state -> buffered = 0;
+        p += fill;
+        len -= fill;
+    }
+
+    size_t stripes = len / HASH_STRIPE_LEN;
+    consume_stripes(state, kernel, p, stripes);
+    p += stripes * HASH_STRIPE_LEN;
+    len -= stripes * HASH_STRIPE_LEN;
+
+    memcpy(state -> buffer, p, len);
+    state -> buffered = len;
+}
+
+uint64_t hash_digest(const HashState* state) {
+    uint64_t acc[8];
+    memcpy(acc, state -> acc, sizeof(acc));
+
+    // The tail is zero padded, total_len below keeps padded inputs apart
+    if (state -> buffered > 0) {
+        uint8_t last[HASH_STRIPE_LEN] = {0};
+        memcpy(last, state -> buffer, state -> buffered);
+        get_kernel() -> accumulate(acc, last, 1, secret + state -> stripes);
+    }
+
+    uint64_t hash = state -> total_len * PRIME64_1;
+    for (int i = 0; i < 4; i++) {
+        hash += fold64(acc[2 * i] ^ secret[11 + 2 * i], acc[2 * i + 1] ^ secret[12 + 2 * i]);
+    }
+
+    return avalanche(hash);
+}
+
+uint64_t hash_buffer(const void* data, size_t len) {
+    HashState state;
+    hash_init(&state);
+    hash_update(&state, data, len);
+    return hash_digest(&state);
+}
+
+const char* hash_backend(void) {
+    return get_kernel() -> name;
+}
+
+int hash_set_backend(const char* name) {
+    const HashKernel* kernel = NULL;
+
+    __builtin_cpu_init();
+    if (strcmp(name, scalar_kernel.name) == 0) {
+        kernel = &scalar_kernel;
+    } else if (strcmp(name, avx2_kernel.name) == 0 && __builtin_cpu_supports("avx2")) {
+        kernel = &avx2_kernel;
+    }
+
+    if (!kernel) {
+        return -1;
+    }
+
+    __atomic_store_n(&active_kernel, kernel, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#define CRC32C_POLY 0x82F63B78U
+
+static uint32_t crc32c_table[256];
+
+// Table entries are written and read atomically: threads racing through
+// get_crc32c on a CPU without SSE4.2 may all fill it, with the same values
+static void build_crc32c_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t value = i;
+        for (int k = 0; k < 8; k++) {
+            value = (value >> 1) ^ (CRC32C_POLY & -(value & 1));
+        }
+        __atomic_store_n(&crc32c_table[i], value, __ATOMIC_RELAXED);
+    }
+}
+
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t* p, size_t len) {
+    while (len--) {
+        crc = __atomic_load_n(&crc32c_table[(crc ^ *p++) & 0xff], __ATOMIC_RELAXED) ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t crc64 = crc;
+
+    while (len >= 8) {
+        crc64 = _mm_crc32_u64(crc64, read64(p));
+        p += 8;
+        len -= 8;
+    }
+
+    crc = (uint32_t) crc64;
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+
+    return crc;
+}
+
+typedef uint32_t (*Crc32cKernel)(uint32_t crc, const uint8_t* p, size_t len);
+
+static Crc32cKernel active_crc32c = NULL;
+
+// Picked once like get_kernel, the table is complete before the scalar kernel
+// is published
+static Crc32cKernel get_crc32c(void) {
+    Crc32cKernel kernel = __atomic_load_n(&active_crc32c, __ATOMIC_ACQUIRE);
+    if (kernel) {
+        return kernel;
+    }
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        kernel = crc32c_sse42;
+    } else {
+        build_crc32c_table();
+        kernel = crc32c_scalar;
+    }
+
+    __atomic_store_n(&active_crc32c, kernel, __ATOMIC_RELEASE);
+    return kernel;
+}
+
+uint32_t crc32c(const void* data, size_t len) {
+    return ~get_crc32c()(0xFFFFFFFFU, data, len);
+}
@@ -0,0 +1,36 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 64-bit streaming content hash in the style of xxHash3: eight 64-bit lanes are
+// fed 64-byte stripes and scrambled every 1 KiB block. The AVX2 kernel and the
+// portable kernel produce identical digests, the faster one is picked at runtime.
+
+#define HASH_STRIPE_LEN 64
+#define HASH_BLOCK_STRIPES 16
+
+typedef struct {
+    uint64_t acc[8];
+    uint8_t buffer[HASH_STRIPE_LEN];
+    size_t buffered;
+    size_t stripes;
+    uint64_t total_len;
+} HashState;
+
+void hash_init(HashState* state);
+void hash_update(HashState* state, const void* data, size_t len);
+uint64_t hash_digest(const HashState* state);
+
+uint64_t hash_buffer(const void* data, size_t len);
+const char* hash_backend(void);
+
+// Pins the kernel by name, "scalar" or "avx2", so both can be checked against
+// each other. Fails for a kernel the CPU cannot run. Not for use mid-hash.
+int hash_set_backend(const char* name);
+
+// CRC32C (Castagnoli), using the SSE4.2 crc32 instruction when available
+uint32_t crc32c(const void* data, size_t len);
+
+#endif // !HASH_H
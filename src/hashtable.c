@@ -1,48 +1,229 @@
 #include "hashtable.h"
 
 #include "arena.h"
+#include "hash.h"
 
+#include <emmintrin.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
-uint32_t hash_path(const char* path) {
-    const char* slash = strrchr(path, '/');
-    path = slash ? slash + 1 : path;
+uint64_t hash_path(const char* path) {
+    return hash_buffer(path, strlen(path));
+}
 
-    uint32_t hash = 5381;
-    for (const char* p = path; *p; p++) {
-        hash = ((hash << 5) + hash) ^ (unsigned char)*p;
+static inline size_t align_capacity(size_t capacity) {
+    if (capacity < HT_GROUP_SIZE) {
+        capacity = HT_GROUP_SIZE;
     }
 
-    return hash;
+    return (size_t) 1 << (64 - __builtin_clzll(capacity - 1));
 }
 
-static inline size_t align_capacity(size_t capacity) {
-    return 1 << (32 - __builtin_clz(capacity - 1));
+static inline uint8_t hash_tag(uint64_t hash) {
+    return hash & 0x7F;
 }
 
-static Node* create_node(Arena* arena, const char* path, uint32_t content_hash) {
-    Node* node = arena_alloc(arena, sizeof(*node));
-    if (!node) {
-        return NULL;
+// Control bytes change under concurrent inserts, so the group is read with two
+// atomic 8-byte loads rather than one plain vector load.
+static inline __m128i load_group(const uint8_t* ctrl) {
+    uint64_t lo = __atomic_load_n((const uint64_t*) ctrl, __ATOMIC_ACQUIRE);
+    uint64_t hi = __atomic_load_n((const uint64_t*) (ctrl + 8), __ATOMIC_ACQUIRE);
+    return _mm_set_epi64x((long long) hi, (long long) lo);
+}
+
+static inline uint32_t group_match(__m128i group, uint8_t value) {
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) value)));
+}
+
+static inline void spin_lock(uint8_t* lock) {
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) {
+        __builtin_ia32_pause();
     }
+}
 
-    node -> path = arena_strdup(arena, path);
+static inline void spin_unlock(uint8_t* lock) {
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+static void* ht_realloc(HashTable* ht, void* ptr, size_t old_size, size_t new_size) {
+    spin_lock(&ht -> arena_lock);
+    void* result = arena_realloc(ht -> arena, ptr, old_size, new_size);
+    spin_unlock(&ht -> arena_lock);
+
+    return result;
+}
+
+// One allocation holds the path, name is its last component. The FileId is
+// handed out under the same lock that allocates the node.
+static Node* create_node(HashTable* ht, const char* path, uint64_t content_hash) {
+    size_t path_len = strlen(path);
     const char* slash = strrchr(path, '/');
-    node -> name = arena_strdup(arena, (slash ? slash + 1 : path));
+    size_t name_offset = slash ? (size_t) (slash + 1 - path) : 0;
+
+    spin_lock(&ht -> arena_lock);
+    Node* node = arena_alloc(ht -> arena, sizeof(*node));
+    char* strings = arena_alloc(ht -> arena, path_len + 1);
+    FileId* dependencies = arena_array_zero(ht -> arena, FileId, 2);
+    uint64_t* dep_variants = arena_array_zero(ht -> arena, uint64_t, 2);
+
+    size_t id = ht -> node_count;
+    Node** page = NULL;
+
+    if (id < (size_t) FILE_ID_MAX_PAGES * FILE_ID_PAGE_SIZE) {
+        page = ht -> pages[id >> FILE_ID_PAGE_BITS];
+        if (!page) {
+            page = arena_array_zero(ht -> arena, Node*, FILE_ID_PAGE_SIZE);
+            ht -> pages[id >> FILE_ID_PAGE_BITS] = page;
+        }
+    }
+
+    if (node && strings && dependencies && dep_variants && page) {
+        page[id & (FILE_ID_PAGE_SIZE - 1)] = node;
+        ht -> node_count++;
+    }
+    spin_unlock(&ht -> arena_lock);
+
+    if (!node || !strings || !dependencies || !dep_variants || !page) {
+        return NULL;
+    }
+
+    node -> path = arena_memcpy(strings, path, path_len + 1);
+    node -> name = node -> path + name_offset;
+    node -> id = (FileId) id;
 
     node -> content_hash = content_hash;
+    node -> stat = (FileStat) {0};
+    node -> dirty = 0;
+    node -> discovered = 0;
+    node -> scanned = 0;
+    node -> lock = 0;
+    node -> variants = 0;
     node -> dep_count = 0;
     node -> dep_capacity = 2;
 
-    node -> dependencies = arena_array_zero(arena, Node*, node -> dep_capacity);
-    node -> next = NULL;
+    node -> dependencies = dependencies;
+    node -> dep_variants = dep_variants;
+    node -> spellings = NULL;
+    node -> spelling_count = 0;
+    node -> next_name = NULL;
 
-    if (!node -> dependencies) {
-        return NULL;
+    return node;
+}
+
+static int alloc_slots(HashTable* ht, size_t capacity) {
+    uint8_t* ctrl = arena_alloc(ht -> arena, capacity);
+    Slot* slots = arena_array(ht -> arena, Slot, capacity);
+
+    if (!ctrl || !slots) {
+        return -1;
     }
-    
+
+    arena_memset(ctrl, CTRL_EMPTY, capacity);
+    ht -> ctrl = ctrl;
+    ht -> slots = slots;
+    __atomic_store_n(&ht -> capacity, capacity, __ATOMIC_RELAXED);
+
+    return 0;
+}
+
+static NameEntry* name_slot(NameEntry* entries, size_t capacity, uint64_t hash, const char* name) {
+    size_t idx = hash & (capacity - 1);
+
+    while (entries[idx].head) {
+        if (entries[idx].hash == hash && strcmp(entries[idx].head -> name, name) == 0) {
+            break;
+        }
+        idx = (idx + 1) & (capacity - 1);
+    }
+
+    return &entries[idx];
+}
+
+static int names_init(HashTable* ht, size_t capacity) {
+    NameIndex* names = &ht -> names;
+
+    names -> entries = arena_array_zero(ht -> arena, NameEntry, capacity);
+    names -> count = 0;
+    names -> reserved = 0;
+    names -> capacity = capacity;
+
+    if (!names -> entries) {
+        return -1;
+    }
+
+    pthread_mutex_init(&names -> lock, NULL);
+    return 0;
+}
+
+// Makes room for one more name before its node exists, so that adding it
+// cannot fail once the node has a FileId
+static int names_reserve(HashTable* ht) {
+    NameIndex* names = &ht -> names;
+    int result = 0;
+
+    pthread_mutex_lock(&names -> lock);
+
+    if ((names -> count + names -> reserved + 1) * 2 > names -> capacity) {
+        size_t capacity = names -> capacity * 2;
+
+        spin_lock(&ht -> arena_lock);
+        NameEntry* entries = arena_array_zero(ht -> arena, NameEntry, capacity);
+        spin_unlock(&ht -> arena_lock);
+
+        if (entries) {
+            for (size_t i = 0; i < names -> capacity; i++) {
+                NameEntry* entry = &names -> entries[i];
+                if (entry -> head) {
+                    *name_slot(entries, capacity, entry -> hash, entry -> head -> name) = *entry;
+                }
+            }
+
+            names -> entries = entries;
+            names -> capacity = capacity;
+        } else {
+            result = -1;
+        }
+    }
+
+    if (result == 0) {
+        names -> reserved++;
+    }
+
+    pthread_mutex_unlock(&names -> lock);
+    return result;
+}
+
+// Uses up a reservation, node NULL only gives it back
+static void names_add(HashTable* ht, Node* node) {
+    NameIndex* names = &ht -> names;
+    uint64_t hash = node ? hash_path(node -> name) : 0;
+
+    pthread_mutex_lock(&names -> lock);
+    names -> reserved--;
+
+    if (node) {
+        NameEntry* entry = name_slot(names -> entries, names -> capacity, hash, node -> name);
+        if (!entry -> head) {
+            entry -> hash = hash;
+            names -> count++;
+        }
+
+        node -> next_name = entry -> head;
+        entry -> head = node;
+    }
+
+    pthread_mutex_unlock(&names -> lock);
+}
+
+Node* search_name(HashTable* ht, const char* name) {
+    uint64_t hash = hash_path(name);
+
+    pthread_mutex_lock(&ht -> names.lock);
+    Node* node = name_slot(ht -> names.entries, ht -> names.capacity, hash, name) -> head;
+    pthread_mutex_unlock(&ht -> names.lock);
+
     return node;
 }
 
@@ -54,97 +235,286 @@ HashTable* create_hashtable(Arena* arena, size_t capacity) {
 
     ht -> arena = arena;
     ht -> count = 0;
-    ht -> capacity = align_capacity(capacity);
-    ht -> nodes = arena_array_zero(arena, Node*, ht -> capacity);
+    ht -> arena_lock = 0;
+    ht -> node_count = 0;
+    arena_memset(ht -> pages, 0, sizeof(ht -> pages));
 
-    if (!ht -> nodes) {
+    if (alloc_slots(ht, align_capacity(capacity)) != 0 || names_init(ht, align_capacity(capacity)) != 0) {
         return NULL;
     }
 
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&ht -> resize_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
     return ht;
 }
 
-Node* get_ht(HashTable* ht, const char* path) {
-    uint32_t hash = hash_path(path);
-    size_t idx = hash & (ht -> capacity - 1);
-    Node* node = ht -> nodes[idx];
+// The group load that found the tag is a plain one, the acquire load pairs
+// with the release store that published the slot before it is read
+static inline int slot_matches(HashTable* ht, size_t idx, uint8_t tag, uint64_t hash, const char* path) {
+    return __atomic_load_n(&ht -> ctrl[idx], __ATOMIC_ACQUIRE) == tag
+        && ht -> slots[idx].hash == hash && strcmp(ht -> slots[idx].node -> path, path) == 0;
+}
 
-    while (node) {
-        if (strcmp(node -> path, path) == 0) {
-            return node;
+// Must be called with resize_lock held
+static Node* find_slot(HashTable* ht, uint64_t hash, const char* path) {
+    size_t group_mask = (ht -> capacity / HT_GROUP_SIZE) - 1;
+    size_t group = (hash >> 7) & group_mask;
+    uint8_t tag = hash_tag(hash);
+
+    for (size_t probe = 0; probe <= group_mask; probe++) {
+        size_t base = group * HT_GROUP_SIZE;
+        __m128i ctrl = load_group(ht -> ctrl + base);
+
+        uint32_t matches = group_match(ctrl, tag);
+        while (matches) {
+            size_t idx = base + __builtin_ctz(matches);
+            if (slot_matches(ht, idx, tag, hash, path)) {
+                return ht -> slots[idx].node;
+            }
+            matches &= matches - 1;
+        }
+
+        if (group_match(ctrl, CTRL_EMPTY)) {
+            return NULL;
         }
-        node = node -> next;
+
+        group = (group + probe + 1) & group_mask;
     }
 
     return NULL;
 }
 
-Node* insert_ht(HashTable* ht, const char* path, uint32_t content_hash) {
-    if (ht -> count >= ht -> capacity) {
-        ht -> nodes = arena_realloc(ht -> arena, ht -> nodes, sizeof(Node*) * ht -> capacity, sizeof(Node*) * ht -> capacity * 2);
-        ht -> capacity *= 2;
+Node* get_ht(HashTable* ht, const char* path) {
+    uint64_t hash = hash_path(path);
+
+    pthread_rwlock_rdlock(&ht -> resize_lock);
+    Node* node = find_slot(ht, hash, path);
+    pthread_rwlock_unlock(&ht -> resize_lock);
+
+    return node;
+}
+
+// Rehashes every slot into a table of twice the size. Runs with resize_lock
+// held exclusively, so there are no half-written slots to wait for.
+static int grow_ht(HashTable* ht, int force) {
+    size_t capacity = __atomic_load_n(&ht -> capacity, __ATOMIC_RELAXED);
+    if (!force && __atomic_load_n(&ht -> count, __ATOMIC_RELAXED) < capacity - capacity / 8) {
+        return 0;
+    }
+
+    int result = 0;
+    pthread_rwlock_wrlock(&ht -> resize_lock);
+
+    if (ht -> capacity == capacity && (force || ht -> count >= capacity - capacity / 8)) {
+        uint8_t* old_ctrl = ht -> ctrl;
+        Slot* old_slots = ht -> slots;
+
+        spin_lock(&ht -> arena_lock);
+        result = alloc_slots(ht, capacity * 2);
+        spin_unlock(&ht -> arena_lock);
+
+        size_t group_mask = (ht -> capacity / HT_GROUP_SIZE) - 1;
+
+        for (size_t i = 0; result == 0 && i < capacity; i++) {
+            if (old_ctrl[i] & CTRL_EMPTY) {
+                continue;
+            }
+
+            uint64_t hash = old_slots[i].hash;
+            size_t group = (hash >> 7) & group_mask;
+
+            for (size_t probe = 0;; probe++) {
+                size_t base = group * HT_GROUP_SIZE;
+                uint32_t empty = group_match(load_group(ht -> ctrl + base), CTRL_EMPTY);
+
+                if (empty) {
+                    size_t idx = base + __builtin_ctz(empty);
+                    ht -> slots[idx] = old_slots[i];
+                    ht -> ctrl[idx] = hash_tag(hash);
+                    break;
+                }
+
+                group = (group + probe + 1) & group_mask;
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&ht -> resize_lock);
+    return result;
+}
+
+// An inserter first waits out any slot being written in the group, since it
+// could hold the same path, then claims the group's first empty slot with a CAS.
+// Slots are never emptied, so every thread inserting a path probes the same
+// sequence and meets the winner's slot. Returns NULL with *full set when the
+// probe ran out of groups and the table has to grow first.
+static Node* find_or_claim(HashTable* ht, uint64_t hash, const char* path, uint64_t content_hash, int overwrite, int* full) {
+    size_t group_mask = (ht -> capacity / HT_GROUP_SIZE) - 1;
+    size_t group = (hash >> 7) & group_mask;
+    uint8_t tag = hash_tag(hash);
+
+    for (size_t probe = 0; probe <= group_mask;) {
+        size_t base = group * HT_GROUP_SIZE;
+        __m128i ctrl = load_group(ht -> ctrl + base);
+
+        if (group_match(ctrl, CTRL_BUSY)) {
+            __builtin_ia32_pause();
+            continue;
+        }
+
+        uint32_t matches = group_match(ctrl, tag);
+        while (matches) {
+            size_t idx = base + __builtin_ctz(matches);
+            if (slot_matches(ht, idx, tag, hash, path)) {
+                Node* node = ht -> slots[idx].node;
+                if (overwrite) {
+                    __atomic_store_n(&node -> content_hash, content_hash, __ATOMIC_RELAXED);
+                }
+                return node;
+            }
+            matches &= matches - 1;
+        }
+
+        uint32_t empty = group_match(ctrl, CTRL_EMPTY);
+        if (!empty) {
+            group = (group + probe + 1) & group_mask;
+            probe++;
+            continue;
+        }
+
+        size_t idx = base + __builtin_ctz(empty);
+        uint8_t expected = CTRL_EMPTY;
+        if (!__atomic_compare_exchange_n(&ht -> ctrl[idx], &expected, CTRL_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        // Everything that can fail happens while the slot is still busy, a
+        // published node always has its FileId and its name entry
+        if (names_reserve(ht) != 0) {
+            __atomic_store_n(&ht -> ctrl[idx], CTRL_EMPTY, __ATOMIC_RELEASE);
+            return NULL;
+        }
 
-        if (!ht -> nodes) {
+        Node* node = create_node(ht, path, content_hash);
+        if (!node) {
+            names_add(ht, NULL);
+            __atomic_store_n(&ht -> ctrl[idx], CTRL_EMPTY, __ATOMIC_RELEASE);
             return NULL;
         }
+
+        names_add(ht, node);
+
+        ht -> slots[idx].hash = hash;
+        ht -> slots[idx].node = node;
+        __atomic_store_n(&ht -> ctrl[idx], tag, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&ht -> count, 1, __ATOMIC_RELAXED);
+
+        return node;
     }
 
-    uint32_t hash = hash_path(path);
-    size_t idx = hash & (ht -> capacity - 1);
-    Node* node = ht -> nodes[idx];
+    *full = 1;
+    return NULL;
+}
+
+static Node* find_or_insert(HashTable* ht, const char* path, uint64_t content_hash, int overwrite) {
+    uint64_t hash = hash_path(path);
+
+    for (;;) {
+        if (grow_ht(ht, 0) != 0) {
+            return NULL;
+        }
 
-    while (node) {
-        if (strcmp(node -> path, path) == 0) {
-            node -> content_hash = content_hash;
+        int full = 0;
+        pthread_rwlock_rdlock(&ht -> resize_lock);
+        size_t capacity = ht -> capacity;
+        Node* node = find_or_claim(ht, hash, path, content_hash, overwrite, &full);
+        pthread_rwlock_unlock(&ht -> resize_lock);
+
+        if (!full) {
             return node;
         }
-        node = node -> next;
-    }
 
-    node = create_node(ht -> arena, path, content_hash);
-    if (!node) {
-        return NULL;
+        if (__atomic_load_n(&ht -> capacity, __ATOMIC_RELAXED) == capacity && grow_ht(ht, 1) != 0) {
+            return NULL;
+        }
     }
+}
 
-    node -> next = ht -> nodes[idx];
-    ht -> nodes[idx] = node;
-    ht -> count++;
+Node* insert_ht(HashTable* ht, const char* path, uint64_t content_hash) {
+    return find_or_insert(ht, path, content_hash, 1);
+}
 
-    return node;
+// Returns the path's FileId, the path is only copied when it is new
+FileId intern_path(HashTable* ht, const char* path) {
+    Node* node = find_or_insert(ht, path, 0, 0);
+    return node ? node -> id : FILE_ID_NONE;
 }
 
-static int node_add_dependency(Arena* arena, Node* src, Node* dep) {
-    if (src -> dep_count >= src -> dep_capacity) {
-        src -> dependencies = arena_realloc(arena, src -> dependencies, sizeof(Node) * src -> dep_capacity, sizeof(Node) * src -> dep_capacity * 2);
+static int node_add_dependency(HashTable* ht, Node* src, FileId dep, uint64_t variants) {
+    int result = 0;
+    spin_lock(&src -> lock);
 
-        if (!src -> dependencies) {
-            return -1;
+    if (src -> dep_count >= src -> dep_capacity) {
+        FileId* dependencies = ht_realloc(ht, src -> dependencies, sizeof(FileId) * src -> dep_capacity, sizeof(FileId) * src -> dep_capacity * 2);
+        uint64_t* dep_variants = ht_realloc(ht, src -> dep_variants, sizeof(uint64_t) * src -> dep_capacity, sizeof(uint64_t) * src -> dep_capacity * 2);
+
+        if (dependencies && dep_variants) {
+            src -> dependencies = dependencies;
+            src -> dep_variants = dep_variants;
+            src -> dep_capacity *= 2;
+        } else {
+            result = -1;
         }
+    }
 
-        src -> dep_capacity *= 2;
+    if (result == 0) {
+        src -> dep_variants[src -> dep_count] = variants;
+        src -> dependencies[src -> dep_count++] = dep;
     }
 
-    src -> dependencies[src -> dep_count++] = dep;
-    return 0;
+    spin_unlock(&src -> lock);
+    return result;
 }
 
-int add_dependency(HashTable* ht, const char* file, const char* include) {
-    Node* file_node = get_ht(ht, file);
-    Node* include_node = get_ht(ht, include);
-
-    if (!file_node) {
-        file_node = insert_ht(ht, file, 0);
+int add_dependency(HashTable* ht, FileId file, FileId include, uint64_t variants) {
+    if (file == FILE_ID_NONE || include == FILE_ID_NONE) {
+        return -1;
     }
 
-    if (!include_node) {
-        include_node = insert_ht(ht, include, 0);
+    return node_add_dependency(ht, ht_node(ht, file), include, variants);
+}
+
+// Copies the include spellings a scan found into the table's arena, one
+// allocation for the pointers and the text
+int set_spellings(HashTable* ht, Node* node, const char* const* spellings, size_t count) {
+    size_t text_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        text_size += strlen(spellings[i]) + 1;
     }
 
-    if (!file_node || !include_node) {
+    spin_lock(&ht -> arena_lock);
+    const char** copies = arena_alloc(ht -> arena, sizeof(char*) * count + text_size);
+    spin_unlock(&ht -> arena_lock);
+
+    if (!copies) {
         return -1;
     }
 
-    return node_add_dependency(ht -> arena, file_node, include_node);
+    char* text = (char*) (copies + count);
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(spellings[i]) + 1;
+        copies[i] = arena_memcpy(text, spellings[i], len);
+        text += len;
+    }
+
+    node -> spellings = copies;
+    node -> spelling_count = count;
+
+    return 0;
 }
 
 void print_hashtable(HashTable* ht) {
@@ -153,24 +523,23 @@ void print_hashtable(HashTable* ht) {
     printf("  Count: %zu\n", ht -> count);
     printf("  Capacity: %zu\n", ht -> capacity);
 
-    for (int i = 0; i < ht -> capacity; i++) {
-        Node* node = ht -> nodes[i];
-        while (node) {
-            printf("\nNode %d:\n", i);
+    for (FileId id = 0; id < ht -> node_count; id++) {
+        Node* node = ht_node(ht, id);
+        if (node) {
+            printf("\nNode %" PRIu32 ":\n", id);
             printf("  Name: %s\n", node -> name);
             printf("  Path: %s\n", node -> path);
-            printf("  Content-Hash: %x\n\n", node -> content_hash);
+            printf("  Content-Hash: %016" PRIx64 "\n\n", node -> content_hash);
 
             if (node -> dep_count > 0) {
                 printf("  Dependencies:\n");
 
-                for (int k = 0; k < node -> dep_count; k++) {
-                    printf("    %d. %s\n", k, node -> dependencies[k] -> name);
-                    printf("      Path: %s\n", node -> dependencies[k] -> path);
+                for (size_t k = 0; k < node -> dep_count; k++) {
+                    Node* dep = ht_node(ht, node -> dependencies[k]);
+                    printf("    %zu. %s\n", k, dep -> name);
+                    printf("      Path: %s\n", dep -> path);
                 }
             }
-
-            node = node -> next;
         }
     }
     
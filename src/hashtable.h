@@ -3,32 +3,120 @@
 
 #include "arena.h"
 
+#include <pthread.h>
 #include <stdint.h>
 
-// Note: The index will be bounded to the filename, for example test/foo.h = foo.h, and that gets hashed
+typedef struct {
+    uint64_t mtime_ns;
+    uint64_t size;
+    uint64_t ino;
+    uint64_t dev;
+} FileStat;
+
+// Every path is interned once and gets a dense FileId, edges and the cache
+// refer to files by id and ht_node() turns an id back into its node.
+typedef uint32_t FileId;
+
+#define FILE_ID_NONE UINT32_MAX
+
+// Bit v of a variant mask is variant v of cond.h, an edge outside conditional
+// mode holds for all of them
+#define VARIANTS_ALL UINT64_MAX
+
+// Note: Nodes are keyed by their full path, test/lib/lib.h and test/lib2/lib.h hash apart.
+// Lookups by file name go through the separate NameIndex, name points into path.
+// variants is set on sources, the variants of the targets that build them, and
+// dep_variants holds the mask of each dependency.
 typedef struct Node {
     char* path;
     char* name;
-    uint32_t content_hash;
+    FileId id;
+    uint64_t content_hash;
+    FileStat stat;
+    uint8_t dirty;
+    uint8_t discovered;
+    uint8_t scanned;
+    uint8_t lock;
+    uint64_t variants;
     size_t dep_count;
     size_t dep_capacity;
-    struct Node** dependencies;
-    struct Node* next;
+    FileId* dependencies;
+    uint64_t* dep_variants;
+    const char** spellings;
+    size_t spelling_count;
+    struct Node* next_name;
 } Node;
 
+// Nodes by FileId live in fixed-size pages that are never moved, so an id
+// handed out by one thread can be resolved by any other without a lock.
+#define FILE_ID_PAGE_BITS 12
+#define FILE_ID_PAGE_SIZE (1u << FILE_ID_PAGE_BITS)
+#define FILE_ID_MAX_PAGES 4096
+
+#define HT_GROUP_SIZE 16
+#define CTRL_EMPTY 0x80
+#define CTRL_BUSY 0xFF
+
+typedef struct {
+    uint64_t hash;
+    Node* node;
+} Slot;
+
+// Basename -> every node with that name, chained through Node::next_name.
+// Updated once per new node under its own mutex, so path lookups never touch it.
+// reserved counts entries set aside for nodes being created, which can then be
+// added without growing.
+typedef struct {
+    uint64_t hash;
+    Node* head;
+} NameEntry;
+
+typedef struct {
+    NameEntry* entries;
+    size_t count;
+    size_t reserved;
+    size_t capacity;
+    pthread_mutex_t lock;
+} NameIndex;
+
+// Open addressing with SwissTable-style control bytes: ctrl[i] holds the low 7
+// bits of the slot's hash, CTRL_EMPTY, or CTRL_BUSY while an inserter fills
+// the slot in. Probing compares a 16-byte group of control bytes at once and
+// only touches slots whose tag matches, the full hash is kept in the slot and
+// compared before the path.
+//
+// Safe for concurrent insert_ht/get_ht/add_dependency: an inserter claims an
+// empty slot by CAS on its control byte and publishes the tag once the slot is
+// written, slots are never freed. Growing rehashes everything under
+// resize_lock held exclusively, every other operation holds it shared. Arena
+// allocations go through arena_lock and a node's dependency list through its
+// own lock. New FileIds are handed out under arena_lock.
 typedef struct {
     Arena* arena;
-    Node** nodes;
+    uint8_t* ctrl;
+    Slot* slots;
     size_t count;
     size_t capacity;
+    pthread_rwlock_t resize_lock;
+    uint8_t arena_lock;
+    NameIndex names;
+    size_t node_count;
+    Node** pages[FILE_ID_MAX_PAGES];
 } HashTable;
 
-uint32_t hash_path(const char* path);
+uint64_t hash_path(const char* path);
 HashTable* create_hashtable(Arena* arena, size_t capacity);
 
-Node* insert_ht(HashTable* ht, const char* path, uint32_t content_hash);
+Node* insert_ht(HashTable* ht, const char* path, uint64_t content_hash);
 Node* get_ht(HashTable* ht, const char* path);
-int add_dependency(HashTable* ht, const char* file, const char* include); 
+Node* search_name(HashTable* ht, const char* name);
+FileId intern_path(HashTable* ht, const char* path);
+int add_dependency(HashTable* ht, FileId file, FileId include, uint64_t variants);
+int set_spellings(HashTable* ht, Node* node, const char* const* spellings, size_t count);
+
+static inline Node* ht_node(HashTable* ht, FileId id) {
+    return ht -> pages[id >> FILE_ID_PAGE_BITS][id & (FILE_ID_PAGE_SIZE - 1)];
+}
 
 void print_hashtable(HashTable* ht);
 
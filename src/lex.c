@@ -0,0 +1,398 @@
+#include "lex.h"
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LEX_BLOCK 64
+
+typedef uint64_t (*ClassifyKernel)(const char* block);
+
+static const uint8_t special_table[256] = {
+    ['#'] = 1, ['/'] = 1, ['"'] = 1, ['\''] = 1, ['\\'] = 1,
+};
+
+static uint64_t classify_scalar(const char* p, size_t len) {
+    uint64_t mask = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        mask |= (uint64_t) special_table[(uint8_t) p[i]] << i;
+    }
+
+    return mask;
+}
+
+static inline __m128i special_sse2(__m128i v) {
+    __m128i hit = _mm_cmpeq_epi8(v, _mm_set1_epi8('#'));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    return _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+}
+
+static uint64_t classify_sse2(const char* p) {
+    uint64_t mask = 0;
+
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i * 16));
+        mask |= (uint64_t) (uint32_t) _mm_movemask_epi8(special_sse2(v)) << (i * 16);
+    }
+
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i special_avx2(__m256i v) {
+    __m256i hit = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('#'));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+    return _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+}
+
+// movemask is signed, the masks go through uint32_t before they are combined
+__attribute__((target("avx2")))
+static uint64_t classify_avx2(const char* p) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*) p);
+    __m256i hi = _mm256_loadu_si256((const __m256i*) (p + 32));
+
+    uint32_t lo_mask = (uint32_t) _mm256_movemask_epi8(special_avx2(lo));
+    uint32_t hi_mask = (uint32_t) _mm256_movemask_epi8(special_avx2(hi));
+
+    return (uint64_t) hi_mask << 32 | lo_mask;
+}
+
+static ClassifyKernel active_kernel = NULL;
+
+static ClassifyKernel get_kernel(void) {
+    ClassifyKernel kernel = __atomic_load_n(&active_kernel, __ATOMIC_ACQUIRE);
+    if (kernel) {
+        return kernel;
+    }
+
+    __builtin_cpu_init();
+    kernel = __builtin_cpu_supports("avx2") ? classify_avx2 : classify_sse2;
+    __atomic_store_n(&active_kernel, kernel, __ATOMIC_RELEASE);
+
+    return kernel;
+}
+
+typedef struct {
+    const char* buffer;
+    size_t size;
+    size_t block;
+    uint64_t mask;
+    ClassifyKernel classify;
+} Lexer;
+
+// Position of the first special byte at or after from, size when there is none.
+// The mask of the current block is kept, so walking forward classifies every
+// block once and only jumps past the block reclassify.
+static size_t next_special(Lexer* lexer, size_t from) {
+    while (from < lexer -> size) {
+        size_t block = from & ~(size_t) (LEX_BLOCK - 1);
+
+        if (block != lexer -> block) {
+            size_t len = lexer -> size - block;
+
+            lexer -> block = block;
+            lexer -> mask = len >= LEX_BLOCK ? lexer -> classify(lexer -> buffer + block) : classify_scalar(lexer -> buffer + block, len);
+        }
+
+        uint64_t mask = lexer -> mask & (~0ULL << (from - block));
+        if (mask) {
+            return block + __builtin_ctzll(mask);
+        }
+
+        from = block + LEX_BLOCK;
+    }
+
+    return lexer -> size;
+}
+
+static inline int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline int is_ident(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Past a backslash-newline at i, i itself when there is none
+static size_t skip_continuation(const Lexer* lexer, size_t i) {
+    const char* buffer = lexer -> buffer;
+    size_t size = lexer -> size;
+
+    if (i >= size || buffer[i] != '\\') {
+        return i;
+    }
+
+    if (i + 1 < size && buffer[i + 1] == '\n') {
+        return i + 2;
+    }
+
+    if (i + 2 < size && buffer[i + 1] == '\r' && buffer[i + 2] == '\n') {
+        return i + 3;
+    }
+
+    return i;
+}
+
+// From just past the opening "/*" to just past the closing one. Comment text
+// is full of '*' but '/' is classified anyway, so the lexer looks for slashes.
+static size_t skip_block_comment(Lexer* lexer, size_t i) {
+    size_t from = i;
+
+    while (i < lexer -> size) {
+        i = next_special(lexer, i) + 1;
+        if (i <= lexer -> size && lexer -> buffer[i - 1] == '/' && i - 1 > from && lexer -> buffer[i - 2] == '*') {
+            return i;
+        }
+    }
+
+    return lexer -> size;
+}
+
+// From inside a line comment to the newline ending it, continuations extend it
+static size_t skip_line_comment(const Lexer* lexer, size_t i) {
+    const char* buffer = lexer -> buffer;
+
+    while (i < lexer -> size) {
+        const char* newline = memchr(buffer + i, '\n', lexer -> size - i);
+        if (!newline) {
+            break;
+        }
+
+        size_t end = newline - buffer;
+        size_t last = end > i && buffer[end - 1] == '\r' ? end - 1 : end;
+        if (last == i || buffer[last - 1] != '\\') {
+            return end;
+        }
+
+        i = end + 1;
+    }
+
+    return lexer -> size;
+}
+
+// From just past the opening quote to just past the closing one. An
+// unterminated literal stops at its newline so the line still ends there.
+static size_t skip_quoted(const Lexer* lexer, size_t i, char quote) {
+    while (i < lexer -> size) {
+        char c = lexer -> buffer[i];
+        if (c == quote) {
+            return i + 1;
+        }
+
+        if (c == '\n') {
+            return i;
+        }
+
+        i += c == '\\' ? 2 : 1;
+    }
+
+    return lexer -> size;
+}
+
+// Identifier ending right before i, e.g. the R of R"( or the 0x1 of 0x1'000
+static size_t token_start(const Lexer* lexer, size_t i) {
+    while (i > 0 && is_ident(lexer -> buffer[i - 1])) {
+        i--;
+    }
+
+    return i;
+}
+
+// R"delim( ... )delim" and its u8R, uR, UR and LR forms, 0 when the quote at i
+// does not open one
+static size_t skip_raw_string(const Lexer* lexer, size_t i) {
+    const char* buffer = lexer -> buffer;
+    size_t start = token_start(lexer, i);
+    size_t prefix = i - start;
+
+    if (prefix == 0 || buffer[i - 1] != 'R') {
+        return 0;
+    }
+
+    if (prefix > 1 && !(prefix == 3 && buffer[start] == 'u' && buffer[start + 1] == '8')
+        && !(prefix == 2 && (buffer[start] == 'u' || buffer[start] == 'U' || buffer[start] == 'L'))) {
+        return 0;
+    }
+
+    size_t delim = i + 1;
+    size_t open = delim;
+
+    while (open < lexer -> size && open - delim <= 16 && buffer[open] != '(') {
+        char c = buffer[open];
+        if (is_space(c) || c == '\n' || c == ')' || c == '\\' || c == '"') {
+            return 0;
+        }
+        open++;
+    }
+
+    if (open >= lexer -> size || buffer[open] != '(') {
+        return 0;
+    }
+
+    size_t delim_len = open - delim;
+    size_t j = open + 1;
+
+    while (j < lexer -> size) {
+        const char* close = memchr(buffer + j, ')', lexer -> size - j);
+        if (!close) {
+            break;
+        }
+
+        j = close - buffer + 1;
+        if (lexer -> size - j > delim_len && memcmp(buffer + j, buffer + delim, delim_len) == 0 && buffer[j + delim_len] == '"') {
+            return j + delim_len + 1;
+        }
+    }
+
+    return lexer -> size;
+}
+
+// Spaces, continuations and block comments inside a directive line
+static size_t skip_directive_space(Lexer* lexer, size_t i) {
+    const char* buffer = lexer -> buffer;
+
+    while (i < lexer -> size) {
+        if (is_space(buffer[i])) {
+            i++;
+        } else if (buffer[i] == '\\') {
+            size_t next = skip_continuation(lexer, i);
+            if (next == i) {
+                break;
+            }
+            i = next;
+        } else if (buffer[i] == '/' && i + 1 < lexer -> size && buffer[i + 1] == '*') {
+            i = skip_block_comment(lexer, i + 2);
+        } else {
+            break;
+        }
+    }
+
+    return i;
+}
+
+// Whether j is still at the start of a logical line, given the state at i: only
+// spaces may sit between j and the last newline, or i when there is none.
+static int at_line_start(const char* buffer, size_t i, size_t j, int line_start) {
+    while (j > i && is_space(buffer[j - 1])) {
+        j--;
+    }
+
+    return j == i ? line_start : buffer[j - 1] == '\n';
+}
+
+static void emit(Directive* directive, size_t end, const char* buffer, DirectiveHandler handler, void* ctx) {
+    if (!directive -> name) {
+        return;
+    }
+
+    size_t start = directive -> text - buffer;
+    while (end > start && is_space(buffer[end - 1])) {
+        end--;
+    }
+
+    directive -> text_len = end > start ? end - start : 0;
+
+    handler(ctx, directive);
+    directive -> name = NULL;
+}
+
+void lex_directives(const char* buffer, size_t size, DirectiveHandler handler, void* ctx) {
+    Lexer lexer = {
+        .buffer = buffer,
+        .size = size,
+        .block = SIZE_MAX,
+        .classify = get_kernel(),
+    };
+
+    Directive pending = {0};
+    int line_start = 1;
+    size_t i = 0;
+
+    while (i < size) {
+        size_t j = next_special(&lexer, i);
+
+        // Newlines are not in the mask: a directive ends at the first one
+        // memchr finds in the bytes skipped over, and the line start is
+        // worked out with a scalar look-back from j
+        if (pending.name) {
+            const char* newline = memchr(buffer + i, '\n', j - i);
+            if (newline) {
+                emit(&pending, newline - buffer, buffer, handler, ctx);
+            }
+        }
+
+        if (j >= size) {
+            break;
+        }
+
+        line_start = at_line_start(buffer, i, j, line_start);
+        char next = j + 1 < size ? buffer[j + 1] : 0;
+
+        switch (buffer[j]) {
+            case '\\':
+                i = skip_continuation(&lexer, j);
+                if (i == j) {
+                    line_start = 0;
+                    i = j + 1;
+                }
+                break;
+
+            case '/':
+                if (next == '/') {
+                    i = skip_line_comment(&lexer, j + 2);
+                } else if (next == '*') {
+                    i = skip_block_comment(&lexer, j + 2);
+                } else {
+                    line_start = 0;
+                    i = j + 1;
+                }
+                break;
+
+            case '"': {
+                size_t raw = skip_raw_string(&lexer, j);
+                i = raw ? raw : skip_quoted(&lexer, j + 1, '"');
+                line_start = 0;
+                break;
+            }
+
+            case '\'': {
+                // A quote inside a number is a digit separator
+                size_t start = token_start(&lexer, j);
+                i = start < j && buffer[start] >= '0' && buffer[start] <= '9' ? j + 1 : skip_quoted(&lexer, j + 1, '\'');
+                line_start = 0;
+                break;
+            }
+
+            case '#':
+                i = j + 1;
+
+                if (line_start) {
+                    i = skip_directive_space(&lexer, i);
+
+                    size_t name = i;
+                    while (i < size && is_ident(buffer[i])) {
+                        i++;
+                    }
+
+                    if (i > name) {
+                        pending.name = buffer + name;
+                        pending.name_len = i - name;
+
+                        i = skip_directive_space(&lexer, i);
+                        pending.text = buffer + i;
+                    }
+                }
+
+                line_start = 0;
+                break;
+        }
+    }
+
+    emit(&pending, size, buffer, handler, ctx);
+}
@@ -0,0 +1,33 @@
+#ifndef LEX_H
+#define LEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Line-oriented preprocessor directive lexer. Bytes are classified 64 at a
+// time, with AVX2 or SSE2, into a bitmask of '#', '/', '"', '\'' and '\\' and
+// the lexer jumps between those, everything else is indentation or plain code.
+// Comments, string and character literals (raw strings included), digit
+// separators and backslash continuations are skipped, so a '#' only starts a
+// directive when it is the first token of a logical line.
+//
+// Newlines are not part of the SIMD pass. Line ends are found with memchr and
+// byte loops: the end of a directive or line comment by searching forward,
+// whether a special byte starts a line by looking back over its indentation.
+//
+// Every directive is reported once its logical line ends. text starts at the
+// first token after the name and runs to the end of the line, comments and
+// continuations inside it are left as written. Nothing reads past size.
+
+typedef struct {
+    const char* name;
+    size_t name_len;
+    const char* text;
+    size_t text_len;
+} Directive;
+
+typedef void (*DirectiveHandler)(void* ctx, const Directive* directive);
+
+void lex_directives(const char* buffer, size_t size, DirectiveHandler handler, void* ctx);
+
+#endif // !LEX_H
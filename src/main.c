@@ -1,5 +1,5 @@
 #include <fcntl.h>
-#include <immintrin.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,324 +10,601 @@
 #include <unistd.h>
 
 #include "arena.h"
+#include "cache.h"
+#include "closure.h"
+#include "cond.h"
+#include "config.h"
+#include "discover.h"
+#include "graph.h"
+#include "hash.h"
 #include "hashtable.h"
+#include "path.h"
+#include "pool.h"
+#include "scan.h"
+#include "search.h"
+#include "store.h"
+#include "uring.h"
 
 static Arena arena = {0};
 
-#define FILE_COUNT 6 
-
-const char* files[FILE_COUNT] = {
-    "test/main.c",
-    "test/arena.h",
-    "test/foo.c",
-    "test/foo.h",
-    "test/lib/lib.h",
-    "test/lib2/lib.h",
-};
-
-typedef struct {
-    uint32_t* name_hashes;
-    uint32_t* content_hashes;
-    uint8_t count;
-    uint8_t capacity;
-} CachedFiles;
-
 void cleanup_and_exit(int code) {
+#ifdef ARENA_STATS
+    arena_stats_usage("global", total_usage(&arena), total_capacity(&arena));
+#endif
+
     arena_free(&arena);
     exit(code);
 }
 
-void parse_include(HashTable* ht, const char* file, char* buffer) {
-    while (*buffer != '"') {
-        if (*buffer == '<') return;
-        buffer++;
-    }
-    buffer++;
+CachedFiles* load_hashes() {
+    return cache_load(&arena, "catalyze.cache");
+}
 
-    char* start = buffer;
-    while (*buffer != '"') {
-        buffer++;
+void print_cache(CachedFiles* cache) {
+    for (uint32_t i = 0; i < cache -> header -> record_count; i++) {
+        const CacheRecord* record = &cache -> records[i];
+        printf("Cache: %s, %016" PRIx64 "\n", cache_record_path(cache, record), record -> content_hash);
     }
+}
 
-    char saved_char = *buffer;
-    *buffer = 0;
+static int same_root_seen(Config* config, size_t target_idx, size_t source_idx) {
+    const char* root = config -> targets[target_idx].sources[source_idx];
 
-    char* slash = strrchr(file, '/');
-    size_t dir_len = slash ? (slash - file + 1) : 0;
-    if (!slash) {
-        if (add_dependency(ht, file, start) != 0) {
-            fprintf(stderr, "Failed to add_dependency");
-            cleanup_and_exit(1);
+    for (size_t t = 0; t <= target_idx; t++) {
+        Target* target = &config -> targets[t];
+        size_t end = (t == target_idx) ? source_idx : target -> source_count;
+
+        for (size_t s = 0; s < end; s++) {
+            if (target -> auto_discovery && strcmp(target -> sources[s], root) == 0) {
+                return 1;
+            }
         }
+    }
 
-        *buffer = saved_char;
-        return;
+    return 0;
+}
+
+// Variants of every target discovering the same root, the root is walked once
+static uint64_t root_variants(Config* config, const Conditions* conditions, size_t target_idx, size_t source_idx) {
+    const char* root = config -> targets[target_idx].sources[source_idx];
+    uint64_t variants = 0;
+
+    if (!conditions) {
+        return VARIANTS_ALL;
     }
 
-    char* dotdot = strstr(start, "../");
-    if (!dotdot) {
-        size_t total_len = dir_len + strlen(start) + 1;
-        char* full_path = arena_alloc(&arena, total_len);
-        memcpy(full_path, file, dir_len);
-        strcpy(full_path + dir_len, start);
+    for (size_t t = target_idx; t < config -> target_count; t++) {
+        Target* target = &config -> targets[t];
 
-        if (add_dependency(ht, file, full_path) != 0) {
-            fprintf(stderr, "Failed to add_dependency");
-            cleanup_and_exit(1);
+        for (size_t s = 0; s < target -> source_count; s++) {
+            if (target -> auto_discovery && strcmp(target -> sources[s], root) == 0) {
+                variants |= conditions -> target_variants[t];
+            }
         }
+    }
 
-        *buffer = saved_char;
-        return;
-    } 
+    return variants;
+}
 
-    size_t base_len = slash - file;
-    char* path = arena_alloc(&arena, strlen(start) + base_len + 1);
-    memcpy(path, file, base_len);
-    path[base_len] = 0;
+void collect_sources(HashTable* ht, PathCache* paths, Config* config, const Conditions* conditions, SourceList* list) {
+    for (size_t t = 0; t < config -> target_count; t++) {
+        Target* target = &config -> targets[t];
 
-    while (dotdot && slash) {
-        char* prev_slash = strrchr(path, '/');
-        if (prev_slash) {
-            *prev_slash = 0;
-        } else {
-            break;
-        }
+        for (size_t s = 0; s < target -> source_count; s++) {
+            const char* source = target -> sources[s];
+            int result = 0;
 
-        start = dotdot + 3;
-        dotdot = strstr(start, "../");
-    }
+            if (target -> auto_discovery) {
+                if (same_root_seen(config, t, s)) {
+                    continue;
+                }
 
-    strcat(path, "/");
-    strcat(path, start);
+                result = discover_sources(ht, paths, list, source, root_variants(config, conditions, t, s));
+            } else if (access(source, R_OK) == 0) {
+                result = add_source(ht, paths, list, source, conditions ? conditions -> target_variants[t] : VARIANTS_ALL);
+            } else {
+                fprintf(stderr, "Source not found: %s\n", source);
+            }
 
-    *buffer = saved_char;
-    if (add_dependency(ht, file, path) != 0) {
-        fprintf(stderr, "Failed to add_dependency");
-        cleanup_and_exit(1);
+            if (result != 0) {
+                fprintf(stderr, "Unable to collect sources from %s!\n", source);
+                cleanup_and_exit(1);
+            }
+        }
     }
 }
 
-void search_for_preprocessor(HashTable* ht, char* buffer, size_t size, const char* file) {
-    __m256i char_match = _mm256_set1_epi8('#');
-    const char* current = buffer;
-    size_t processed = 0;
+typedef struct {
+    const ScanContext* scan;
+    HashTable* ht;
+    FileId* ids;
+    ScanResult* results;
+    size_t count;
+    Arena* arenas;
+    Uring* rings;
+} ScanJob;
+
+static const char* add_result(HashTable* ht, Node* node, const ScanResult* result) {
+    node -> content_hash = result -> content_hash;
+    node -> stat = result -> stat;
+    node -> dirty = result -> dirty;
+    node -> scanned = 1;
+
+    if (set_spellings(ht, node, result -> spellings, result -> spelling_count) != 0) {
+        return "Failed to set_spellings";
+    }
+
+    for (size_t k = 0; k < result -> include_count; k++) {
+        if (add_dependency(ht, node -> id, result -> includes[k], result -> include_variants[k]) != 0) {
+            return "Failed to add_dependency";
+        }
+    }
+
+    return NULL;
+}
 
-    while (processed + 64 <= size) {
-        __m256i str1 = _mm256_lddqu_si256((__m256i*) current);
-        __m256i str2 = _mm256_lddqu_si256((__m256i*) (current + 32));
+// Each worker arena is scratch for one file, or one batch, at a time. What
+// outlives the scan, the spellings and the edges, is copied into the table
+// before it is rewound, so the result keeps no pointers into it.
+static void finish_result(ScanJob* job, size_t item) {
+    Node* node = ht_node(job -> ht, job -> ids[item]);
+    ScanResult* result = &job -> results[item];
+
+    if (!result -> error) {
+        result -> error = add_result(job -> ht, node, result);
+    } else if (result -> missing) {
+        node -> dirty = result -> dirty;
+    }
 
-        __m256i result1 = _mm256_cmpeq_epi8(str1, char_match);
-        __m256i result2 = _mm256_cmpeq_epi8(str2, char_match);
+    result -> includes = NULL;
+    result -> include_variants = NULL;
+    result -> spellings = NULL;
+}
 
-        int mask1 = _mm256_movemask_epi8(result1);
-        int mask2 = _mm256_movemask_epi8(result2);
+static void scan_task(void* ctx, size_t worker, size_t item) {
+    ScanJob* job = ctx;
+    Arena* scratch = &job -> arenas[worker];
+    ArenaMark mark = arena_mark(scratch);
 
-        while (mask1) {
-            int pos = __builtin_ctz(mask1);
-            size_t abs_pos = processed + pos;
+    scan_file(scratch, job -> scan, job -> ids[item], &job -> results[item]);
+    finish_result(job, item);
+    arena_rewind(scratch, mark);
+}
 
-            if (strncmp(buffer + abs_pos + 1, "include", 7) == 0) {
-                parse_include(ht, file, buffer + abs_pos + 8);
-            }               
+// Items are runs of SCAN_BATCH files, read through the worker's ring
+static void batch_task(void* ctx, size_t worker, size_t batch) {
+    ScanJob* job = ctx;
+    Arena* scratch = &job -> arenas[worker];
+    ArenaMark mark = arena_mark(scratch);
 
-            mask1 &= mask1 - 1;
-        }
+    size_t first = batch * SCAN_BATCH;
+    size_t count = job -> count - first < SCAN_BATCH ? job -> count - first : SCAN_BATCH;
 
-        while (mask2) {
-            int pos = __builtin_ctz(mask2);
-            size_t abs_pos = processed + 32 + pos;
+    scan_batch(scratch, job -> scan, &job -> rings[worker], job -> ids + first, job -> results + first, count);
 
-            if (strncmp(buffer + abs_pos + 1, "include", 7) == 0) {
-                parse_include(ht, file, buffer + abs_pos + 8);
-            }               
+    for (size_t i = first; i < first + count; i++) {
+        finish_result(job, i);
+    }
 
-            mask2 &= mask2 - 1;
-        }
+    arena_rewind(scratch, mark);
+}
 
-        current += 64;
-        processed += 64;
+static void destroy_rings(Uring* rings, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uring_destroy(&rings[i]);
     }
 
-    while (processed + 32 <= size) {
-        __m256i str = _mm256_lddqu_si256((__m256i*) current);
-        __m256i result = _mm256_cmpeq_epi8(str, char_match);
-        int mask = _mm256_movemask_epi8(result);
+    free(rings);
+}
 
-        while (mask) {
-            int pos = __builtin_ctz(mask);
-            size_t abs_pos = processed + pos;
+// One ring per worker, or none at all when any of them cannot be set up
+static Uring* create_rings(size_t count) {
+    Uring* rings = calloc(count, sizeof(Uring));
+    if (!rings) {
+        return NULL;
+    }
 
-            if (strncmp(buffer + abs_pos + 1, "include", 7) == 0) {
-                parse_include(ht, file, buffer + abs_pos + 8);
-            }               
+    for (size_t i = 0; i < count; i++) {
+        if (uring_init(&rings[i], 2 * SCAN_BATCH, SCAN_BATCH + 1, SCAN_BUFFER_SIZE) != 0) {
+            destroy_rings(rings, i);
+            return NULL;
+        }
+    }
 
-            mask &= mask - 1;
+    return rings;
+}
+
+// Files the last round included that no round has taken yet, e.g. headers
+// found through -I outside the source roots. A scanned file's edges are all
+// its own scan added, so they are read from its node. The ids go to the
+// round arena, which still held the round before last.
+static size_t next_round(HashTable* ht, ScanJob* job, size_t count, Arena* round_arena, uint8_t** queued, size_t* queued_size) {
+    size_t node_count = ht -> node_count;
+
+    if (node_count > *queued_size) {
+        uint8_t* grown = realloc(*queued, node_count);
+        if (!grown) {
+            fprintf(stderr, "Unable to allocate the scan queue!\n");
+            cleanup_and_exit(1);
         }
 
-        current += 32;
-        processed += 32;
+        memset(grown + *queued_size, 0, node_count - *queued_size);
+        *queued = grown;
+        *queued_size = node_count;
     }
 
-    for (size_t i = processed; i + 8 < size; i++) {
-        if (buffer[i] == '#' && strncmp(buffer + i + 1, "include", 7) == 0) {
-            parse_include(ht, file, buffer + i + 8);
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        (*queued)[job -> ids[i]] = 1;
+        total += ht_node(ht, job -> ids[i]) -> dep_count;
+    }
+
+    arena_reset(round_arena);
+    FileId* ids = arena_array(round_arena, FileId, total ? total : 1);
+    size_t next = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const Node* node = ht_node(ht, job -> ids[i]);
+
+        for (size_t k = 0; !job -> results[i].error && k < node -> dep_count; k++) {
+            FileId id = node -> dependencies[k];
+            if (!(*queued)[id]) {
+                (*queued)[id] = 1;
+                ids[next++] = id;
+            }
         }
     }
 
+    job -> ids = ids;
+    return next;
 }
 
-CachedFiles* parse_cache(char* buffer) {
-    CachedFiles* cache = arena_alloc(&arena, sizeof(*cache));
+// Sources first, then one round per include depth until nothing new turns up.
+// A missing source is an error, an include may name a file that is not there.
+void load_hashtable(const ScanContext* scan, SourceList* sources, size_t jobs, int uring_enabled) {
+    HashTable* ht = scan -> ht;
 
-    cache -> name_hashes = arena_array_zero(&arena, uint32_t, FILE_COUNT);
-    cache -> content_hashes = arena_array_zero(&arena, uint32_t, FILE_COUNT);
-    cache -> count = 0;
-    cache -> capacity = FILE_COUNT;
+    Pool* pool = pool_create(jobs);
+    if (!pool) {
+        fprintf(stderr, "Unable to start worker threads!\n");
+        cleanup_and_exit(1);
+    }
 
-    char* current = buffer; 
+    ScanJob job = {
+        .scan = scan,
+        .ht = ht,
+        .ids = sources -> ids,
+        .arenas = calloc(pool -> worker_count, sizeof(Arena)),
+    };
 
-    while (*current != '\0' && cache -> count < cache -> capacity) {
-        char* token = strchr(current, ',');
-        if (!token) {
-            break;
-        }
+    if (!job.arenas) {
+        fprintf(stderr, "Unable to allocate worker arenas!\n");
+        cleanup_and_exit(1);
+    }
+
+    if (uring_enabled && !(job.rings = create_rings(pool -> worker_count))) {
+        fprintf(stderr, "Unable to set up io_uring, reading files with blocking calls!\n");
+    }
 
-        size_t len = token - current;
-        char temp = current[len];
-        current[len] = '\0';
-        cache -> name_hashes[cache -> count] = (uint32_t) strtoul(current, NULL, 16);
-        current[len] = temp;
+    uint8_t* queued = NULL;
+    size_t queued_size = 0;
 
-        current = token + 1;
+    // Results and the ids they were scanned for only live for a round and the
+    // one after it, two arenas take turns holding them
+    Arena rounds[2] = {0};
 
-        token = strchr(current, ',');
-        if (!token) {
-            len = strlen(current);
+    for (size_t count = sources -> count, round = 0; count > 0; round++) {
+        job.results = arena_array_zero(&rounds[round & 1], ScanResult, count);
+        job.count = count;
+
+        if (job.rings) {
+            pool_run(pool, (count + SCAN_BATCH - 1) / SCAN_BATCH, batch_task, &job);
         } else {
-            len = token - current;
+            pool_run(pool, count, scan_task, &job);
         }
 
-        temp = current[len];
-        current[len] = '\0';
-        cache -> content_hashes[cache -> count] = (uint32_t) strtoul(current, NULL, 16);
-        current[len] = temp;
+        for (size_t i = 0; i < count; i++) {
+            if (job.results[i].error && !(round > 0 && job.results[i].missing)) {
+                fprintf(stderr, "%s: %s\n", ht_node(ht, job.ids[i]) -> path, job.results[i].error);
+                cleanup_and_exit(1);
+            }
+        }
 
-        cache -> count++;
+        count = next_round(ht, &job, count, &rounds[(round + 1) & 1], &queued, &queued_size);
+    }
 
-        if (!token) {
-            break;
-        }
+    free(queued);
+    arena_free(&rounds[0]);
+    arena_free(&rounds[1]);
 
-        current = token + 1;
+    for (size_t i = 0; i < pool -> worker_count; i++) {
+        arena_free(&job.arenas[i]);
     }
 
-    return cache;
+    free(job.arenas);
+
+    if (job.rings) {
+        destroy_rings(job.rings, pool -> worker_count);
+    }
+
+    pool_destroy(pool);
 }
 
-CachedFiles* load_hashes() {
-    return NULL;
+// One shortest cycle per component, e.g. "a.h -> b.h -> a.h"
+void report_cycles(HashTable* ht, Graph* graph, Components* components) {
+    if (components -> cyclic == 0) {
+        return;
+    }
+
+    FileId* path = arena_array(&arena, FileId, graph -> node_count);
+
+    for (uint32_t c = 0; c < components -> count; c++) {
+        size_t length = component_cycle(graph, components, c, path);
+        if (length == 0) {
+            continue;
+        }
 
-    // int fd = open("catalyze.cache", O_RDONLY);
-    // if (fd == -1) {
-    //     return NULL;
-    // }
-    //
-    // size_t size = lseek(fd, 0, SEEK_END);
-    // char* buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0); 
-    // if (buffer == MAP_FAILED) {
-    //     fprintf(stderr, "Unable to allocate file!\n");
-    //     cleanup_and_exit(1);
-    // }
-    //
-    // CachedFiles* result = parse_cache(buffer);
-    //
-    // close(fd);
-    // munmap(buffer, size);
-    // return result;
+        fprintf(stderr, "Include cycle: ");
+        for (size_t i = 0; i < length; i++) {
+            fprintf(stderr, "%s -> ", ht_node(ht, path[i]) -> path);
+        }
+        fprintf(stderr, "%s\n", ht_node(ht, path[0]) -> path);
+    }
 }
 
-void print_cache(CachedFiles* cache) {
-    for (int i = 0; i < cache -> count; i++) {
-        printf("Cache: %x, %x\n", cache -> name_hashes[i], cache -> content_hashes[i]);
+static int needs_compile(Node* node) {
+    return node -> discovered && is_translation_unit(node -> name);
+}
+
+void build_without_cache(HashTable* ht, Graph* graph) {
+    for (FileId id = 0; id < graph -> node_count; id++) {
+        Node* node = ht_node(ht, id);
+        if (needs_compile(node)) {
+            printf("Rebuild: %s\n", node -> path);
+        }
     }
 }
 
-void load_hashtable(HashTable* ht, uint8_t count) {
-    for (int i = 0; i < count; i++) {
-        int fd = open(files[i], O_RDONLY);
-        if (fd == -1) {
-            fprintf(stderr, "File not found!\n");
-            cleanup_and_exit(1);
+// Only the translation units reaching a changed file through their includes
+void build_with_cache(HashTable* ht, Graph* graph, Components* components) {
+    uint64_t* dirty = graph_propagate_dirty(&arena, graph, components, ht, NULL);
+    if (!dirty) {
+        fprintf(stderr, "Unable to propagate dirty files!\n");
+        cleanup_and_exit(1);
+    }
+
+    for (size_t word = 0; word < (graph -> node_count + 63) / 64; word++) {
+        for (uint64_t bits = dirty[word]; bits; bits &= bits - 1) {
+            Node* node = ht_node(ht, (FileId) (word * 64 + __builtin_ctzll(bits)));
+            if (needs_compile(node)) {
+                printf("Rebuild: %s\n", node -> path);
+            }
         }
+    }
+}
 
-        struct stat st;
-        if (fstat(fd, &st) == -1) {
-            fprintf(stderr, "fstat failed!\n");
+// One graph per variant, a unit is rebuilt when a changed file is reachable
+// through the includes of a variant it is built in. Units are printed once, in
+// FileId order like build_with_cache.
+void build_variants(HashTable* ht, const Conditions* conditions) {
+    size_t count = ht -> node_count;
+    uint64_t* rebuild = arena_array_zero(&arena, uint64_t, (count + 63) / 64 + 1);
+
+    // Only rebuild outlives a variant, its graph goes before the next one
+    for (size_t v = 0; v < conditions -> variant_count; v++) {
+        ArenaMark mark = arena_mark(&arena);
+        Graph* graph = graph_freeze(&arena, ht, 1ULL << v);
+        Components* components = graph ? graph_components(&arena, graph) : NULL;
+        uint64_t* dirty = components ? graph_propagate_dirty(&arena, graph, components, ht, NULL) : NULL;
+
+        if (!dirty) {
+            fprintf(stderr, "Unable to propagate dirty files!\n");
             cleanup_and_exit(1);
         }
 
-        if (st.st_size == 0) {
-            close(fd);
-            continue;
+        for (size_t word = 0; word < (count + 63) / 64; word++) {
+            for (uint64_t bits = dirty[word]; bits; bits &= bits - 1) {
+                FileId id = (FileId) (word * 64 + __builtin_ctzll(bits));
+                if ((ht_node(ht, id) -> variants >> v) & 1) {
+                    rebuild[word] |= 1ULL << (id & 63);
+                }
+            }
         }
 
-        char* buffer = NULL;
-        int alloc_method = 0;
-
-        if (st.st_size < 8192) {
-            buffer = malloc(st.st_size);
-            ssize_t bytes_read = read(fd, buffer, st.st_size);
+        arena_rewind(&arena, mark);
+    }
 
-            if (bytes_read != (ssize_t) st.st_size) {
-                fprintf(stderr, "Unable to read file!\n");
-                free(buffer);
-                close(fd);
-                cleanup_and_exit(1);
+    for (size_t word = 0; word < (count + 63) / 64; word++) {
+        for (uint64_t bits = rebuild[word]; bits; bits &= bits - 1) {
+            Node* node = ht_node(ht, (FileId) (word * 64 + __builtin_ctzll(bits)));
+            if (needs_compile(node)) {
+                printf("Rebuild: %s\n", node -> path);
             }
-        } else {
-            buffer = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0); 
-            if (buffer == MAP_FAILED) {
-                fprintf(stderr, "Unable to allocate file!\n");
-                close(fd);
-                cleanup_and_exit(1);
-            }
-
-            alloc_method = 1;
         }
+    }
+}
 
-        uint32_t hash = (uint32_t)(st.st_mtime ^ st.st_size ^ st.st_ino);
-        insert_ht(ht, files[i], hash);
-        search_for_preprocessor(ht, buffer, st.st_size, files[i]);
+Closure* update_closure(Graph* graph, Components* components, CachedFiles* cache) {
+    Closure* closure = closure_build(&arena, graph, components, cache, "catalyze.closure");
 
-        if (alloc_method == 0) {
-            free(buffer);
-        } else {
-            munmap(buffer, st.st_size);
+    if (!closure) {
+        fprintf(stderr, "Unable to build the include closure!\n");
+        cleanup_and_exit(1);
+    }
+
+    return closure;
+}
+
+// Full header set of the file, then every translation unit that reaches it
+void query_closure(HashTable* ht, Closure* closure, const char* path) {
+    Node* target = get_ht(ht, path);
+    if (!target) {
+        fprintf(stderr, "Unknown file: %s\n", path);
+        return;
+    }
+
+    const uint64_t* row = closure_row(closure, target -> id);
+    for (size_t word = 0; word < closure -> words; word++) {
+        for (uint64_t bits = row[word]; bits; bits &= bits - 1) {
+            FileId id = (FileId) (word * 64 + __builtin_ctzll(bits));
+            if (id != target -> id) {
+                printf("Includes: %s\n", ht_node(ht, id) -> path);
+            }
         }
+    }
 
-        close(fd);
+    for (FileId id = 0; id < closure -> node_count; id++) {
+        Node* node = ht_node(ht, id);
+        if (id != target -> id && needs_compile(node) && bitset_test(closure_row(closure, id), target -> id)) {
+            printf("Included by: %s\n", node -> path);
+        }
     }
 }
 
-void build_without_cache(HashTable* ht, uint8_t count) {}
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-j jobs] [-c] [-q file] [-s] [-p] [-u] [config]\n", program);
+    cleanup_and_exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t jobs = pool_default_workers();
+    int closure_enabled = 0;
+    const char* query = NULL;
+    int store_enabled = 0;
+    int conditions_enabled = 0;
+    int uring_enabled = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:cq:spu")) != -1) {
+        switch (opt) {
+            case 'j': {
+                long value = strtol(optarg, NULL, 10);
+                if (value <= 0) {
+                    usage(argv[0]);
+                }
+                jobs = (size_t) value;
+                break;
+            }
+            case 'c':
+                closure_enabled = 1;
+                break;
+            case 'q':
+                closure_enabled = 1;
+                query = optarg;
+                break;
+            case 's':
+                store_enabled = 1;
+                break;
+            case 'p':
+                conditions_enabled = 1;
+                break;
+            case 'u':
+                uring_enabled = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
 
-void build_with_cache(HashTable* ht, CachedFiles* cache) {}
+    const char* config_path = optind < argc ? argv[optind] : "config.cat";
 
-int main() {
+    Config* config = load_config(&arena, config_path);
+    if (!config) {
+        fprintf(stderr, "Unable to load %s!\n", config_path);
+        cleanup_and_exit(1);
+    }
+
+    ArenaMark table_mark = arena_mark(&arena);
     HashTable* ht = create_hashtable(&arena, 128);
     if (!ht) {
         cleanup_and_exit(1);
     }
 
-    load_hashtable(ht, FILE_COUNT);
+    // A cache that fails part way has interned some of its paths already, they
+    // would have no record behind them and cache_write would persist them
     CachedFiles* cache = load_hashes();
+    if (cache && cache_intern(ht, cache) != 0) {
+        cache_unload(cache);
+        cache = NULL;
+
+        arena_rewind(&arena, table_mark);
+        if (!(ht = create_hashtable(&arena, 128))) {
+            cleanup_and_exit(1);
+        }
+    }
+
+    Store* store = NULL;
+    if (store_enabled && !(store = store_open(&arena))) {
+        fprintf(stderr, "Unable to open the shared store, continuing without it!\n");
+    }
+
+    PathCache* paths = path_cache_create(&arena);
+    if (!paths) {
+        fprintf(stderr, "Unable to read the working directory!\n");
+        cleanup_and_exit(1);
+    }
+
+    Conditions* conditions = NULL;
+    if (conditions_enabled && !(conditions = conditions_create(&arena, config))) {
+        fprintf(stderr, "More than %d distinct -D sets, conditionals are not evaluated!\n", COND_MAX_VARIANTS);
+    }
+
+    SourceList sources = {0};
+    collect_sources(ht, paths, config, conditions, &sources);
+
+    ScanContext scan = {
+        .ht = ht,
+        .cache = cache,
+        .store = store,
+        .search = search_path_create(&arena, config),
+        .paths = paths,
+        .conditions = conditions,
+    };
+
+    load_hashtable(&scan, &sources, jobs, uring_enabled);
+
+    Graph* graph = graph_freeze(&arena, ht, VARIANTS_ALL);
+    if (!graph) {
+        fprintf(stderr, "Unable to build the dependency graph!\n");
+        cleanup_and_exit(1);
+    }
+
+    Components* components = graph_components(&arena, graph);
+    if (!components) {
+        fprintf(stderr, "Unable to condense the dependency graph!\n");
+        cleanup_and_exit(1);
+    }
+
+    report_cycles(ht, graph, components);
 
     if (cache == NULL) {
-        build_without_cache(ht, FILE_COUNT);
+        build_without_cache(ht, graph);
+    } else if (conditions) {
+        build_variants(ht, conditions);
     } else {
-        build_with_cache(ht, cache);
+        build_with_cache(ht, graph, components);
+    }
+
+    Closure* closure = NULL;
+    if (closure_enabled) {
+        closure = update_closure(graph, components, cache);
+        if (query) {
+            query_closure(ht, closure, query);
+        }
+    }
+
+    // The closure is tied to the header_crc of the cache written here, so one
+    // left over from an earlier run never matches a cache rewritten without it
+    uint32_t cache_crc = 0;
+    if (cache_write(ht, scan_conditions_hash(&scan), "catalyze.cache", &cache_crc) != 0) {
+        fprintf(stderr, "Unable to write catalyze.cache!\n");
+    } else if (closure && closure_write(closure, ht, cache_crc, "catalyze.closure") != 0) {
+        fprintf(stderr, "Unable to write catalyze.closure!\n");
     }
 
     // print_hashtable(ht);
+    search_path_destroy(scan.search);
+    path_cache_destroy(paths);
+    cache_unload(cache);
     cleanup_and_exit(0);
 }
@@ -0,0 +1,99 @@
+#include "memo.h"
+
+#include "arena.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+void memo_init(MemoTable* table) {
+    memset(table, 0, sizeof(*table));
+
+    for (size_t i = 0; i < MEMO_SHARDS; i++) {
+        pthread_mutex_init(&table -> shards[i].lock, NULL);
+    }
+}
+
+void memo_destroy(MemoTable* table) {
+    for (size_t i = 0; i < MEMO_SHARDS; i++) {
+        MemoShard* shard = &table -> shards[i];
+
+        free(shard -> buckets);
+        arena_free(&shard -> arena);
+        pthread_mutex_destroy(&shard -> lock);
+    }
+}
+
+static MemoEntry* find_entry(MemoShard* shard, uint64_t hash, const char* key, size_t len) {
+    if (!shard -> buckets) {
+        return NULL;
+    }
+
+    for (MemoEntry* entry = shard -> buckets[hash & (shard -> capacity - 1)]; entry; entry = entry -> next) {
+        if (entry -> hash == hash && entry -> len == len && memcmp(entry -> key, key, len) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+// Chains are rebuilt into a table twice the size once it is full
+static int grow_shard(MemoShard* shard) {
+    size_t capacity = shard -> capacity ? shard -> capacity * 2 : 64;
+    MemoEntry** buckets = calloc(capacity, sizeof(MemoEntry*));
+    if (!buckets) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < shard -> capacity; i++) {
+        MemoEntry* entry = shard -> buckets[i];
+
+        while (entry) {
+            MemoEntry* next = entry -> next;
+            entry -> next = buckets[entry -> hash & (capacity - 1)];
+            buckets[entry -> hash & (capacity - 1)] = entry;
+            entry = next;
+        }
+    }
+
+    free(shard -> buckets);
+    shard -> buckets = buckets;
+    shard -> capacity = capacity;
+    return 0;
+}
+
+const MemoEntry* memo_find(MemoTable* table, uint64_t hash, const char* key, size_t len) {
+    MemoShard* shard = &table -> shards[hash >> 58];
+
+    pthread_mutex_lock(&shard -> lock);
+    MemoEntry* entry = find_entry(shard, hash, key, len);
+    pthread_mutex_unlock(&shard -> lock);
+
+    return entry;
+}
+
+void memo_insert(MemoTable* table, uint64_t hash, const char* key, size_t len, const void* value, size_t value_size) {
+    MemoShard* shard = &table -> shards[hash >> 58];
+
+    pthread_mutex_lock(&shard -> lock);
+
+    if (!find_entry(shard, hash, key, len) && (shard -> count < shard -> capacity || grow_shard(shard) == 0)) {
+        MemoEntry* entry = arena_alloc(&shard -> arena, sizeof(MemoEntry) + len + 1 + value_size);
+
+        if (entry) {
+            entry -> hash = hash;
+            entry -> len = len;
+            entry -> value_size = value_size;
+            memcpy(entry -> key, key, len);
+            entry -> key[len] = 0;
+            memcpy(entry -> key + len + 1, value, value_size);
+
+            entry -> next = shard -> buckets[hash & (shard -> capacity - 1)];
+            shard -> buckets[hash & (shard -> capacity - 1)] = entry;
+            shard -> count++;
+        }
+    }
+
+    pthread_mutex_unlock(&shard -> lock);
+}
@@ -0,0 +1,53 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "arena.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A string-keyed table shared by worker threads, for answers that cost a
+// syscall and never change during a run: path.c remembers what a directory
+// resolves to, search.c whether a path exists. Keys are spread over shards by
+// the top bits of their hash, each shard has its own lock, chained buckets and
+// an arena holding the entries, so an entry stays where it is once inserted.
+//
+// Callers look up, compute the answer outside any lock and insert it. Two
+// threads racing on one key both compute it and the second insert is dropped.
+// A failed insert only means the answer is not remembered.
+
+#define MEMO_SHARDS 64
+
+typedef struct MemoEntry {
+    uint64_t hash;
+    struct MemoEntry* next;
+    size_t len;
+    size_t value_size;
+    char key[];
+} MemoEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    MemoEntry** buckets;
+    size_t count;
+    size_t capacity;
+    Arena arena;
+} MemoShard;
+
+typedef struct {
+    MemoShard shards[MEMO_SHARDS];
+} MemoTable;
+
+void memo_init(MemoTable* table);
+void memo_destroy(MemoTable* table);
+
+const MemoEntry* memo_find(MemoTable* table, uint64_t hash, const char* key, size_t len);
+void memo_insert(MemoTable* table, uint64_t hash, const char* key, size_t len, const void* value, size_t value_size);
+
+// The value follows the key and its terminator
+static inline const void* memo_value(const MemoEntry* entry) {
+    return entry -> key + entry -> len + 1;
+}
+
+#endif // !MEMO_H
@@ -0,0 +1,262 @@
+#include "path.h"
+
+#include "arena.h"
+#include "hash.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// One component onto out, the separator only goes between components.
+// fixed is the part ".." cannot take away: the root slash and the leading
+// ".." run of a relative path. Without collapse ".." is kept like any name.
+static int push_component(char* out, size_t capacity, size_t* len, size_t* fixed, int absolute, int collapse, const char* part, size_t part_len) {
+    if (part_len == 0 || (part_len == 1 && part[0] == '.')) {
+        return 0;
+    }
+
+    int dotdot = collapse && part_len == 2 && part[0] == '.' && part[1] == '.';
+    if (dotdot && *len > *fixed) {
+        while (*len > *fixed && out[*len - 1] != '/') {
+            (*len)--;
+        }
+
+        if (*len > *fixed) {
+            (*len)--;
+        }
+
+        return 0;
+    }
+
+    if (dotdot && absolute) {
+        return 0;
+    }
+
+    size_t separator = *len > 0 && out[*len - 1] != '/';
+    if (*len + separator + part_len >= capacity) {
+        return -1;
+    }
+
+    if (separator) {
+        out[(*len)++] = '/';
+    }
+
+    memcpy(out + *len, part, part_len);
+    *len += part_len;
+
+    if (dotdot) {
+        *fixed = *len;
+    }
+
+    return 0;
+}
+
+static int push_components(char* out, size_t capacity, size_t* len, size_t* fixed, int absolute, int collapse, const char* text, size_t text_len) {
+    const char* end = text + text_len;
+
+    while (text < end) {
+        const char* slash = memchr(text, '/', end - text);
+        const char* stop = slash ? slash : end;
+
+        if (push_component(out, capacity, len, fixed, absolute, collapse, text, stop - text) != 0) {
+            return -1;
+        }
+
+        text = slash ? slash + 1 : end;
+    }
+
+    return 0;
+}
+
+// Joins name onto the first dir_len bytes of dir, an absolute name replaces
+// dir. Returns the length written to out, 0 when the result does not fit.
+static size_t join(char* out, size_t capacity, const char* dir, size_t dir_len, const char* name, int collapse) {
+    if (name[0] == '/') {
+        dir_len = 0;
+    }
+
+    int absolute = dir_len > 0 ? dir[0] == '/' : name[0] == '/';
+    size_t len = 0;
+    size_t fixed = 0;
+
+    if (capacity < 2) {
+        return 0;
+    }
+
+    if (absolute) {
+        out[len++] = '/';
+        fixed = 1;
+    }
+
+    if (push_components(out, capacity, &len, &fixed, absolute, collapse, dir, dir_len) != 0
+        || push_components(out, capacity, &len, &fixed, absolute, collapse, name, strlen(name)) != 0) {
+        return 0;
+    }
+
+    if (len == 0) {
+        out[len++] = '.';
+    }
+
+    out[len] = 0;
+    return len;
+}
+
+size_t path_join(char* out, size_t capacity, const char* dir, size_t dir_len, const char* name) {
+    return join(out, capacity, dir, dir_len, name, 1);
+}
+
+size_t path_concat(char* out, size_t capacity, const char* dir, size_t dir_len, const char* name) {
+    return join(out, capacity, dir, dir_len, name, 0);
+}
+
+PathCache* path_cache_create(Arena* arena) {
+    PathCache* cache = arena_alloc(arena, sizeof(PathCache));
+    memset(cache, 0, sizeof(*cache));
+
+    if (!getcwd(cache -> cwd, sizeof(cache -> cwd))) {
+        return NULL;
+    }
+
+    cache -> cwd_len = strlen(cache -> cwd);
+    memo_init(&cache -> dirs);
+
+    return cache;
+}
+
+void path_cache_destroy(PathCache* cache) {
+    if (cache) {
+        memo_destroy(&cache -> dirs);
+    }
+}
+
+// realpath of dir, relative to the working directory when it is under it
+static size_t resolve(const PathCache* cache, const char* dir, char* resolved) {
+    char real[PATH_MAX];
+    if (!realpath(dir, real)) {
+        return SIZE_MAX;
+    }
+
+    size_t len = strlen(real);
+    size_t cwd_len = cache -> cwd_len;
+
+    if (cwd_len == 1) {
+        memcpy(resolved, real + 1, len);
+        return len - 1;
+    }
+
+    if (len >= cwd_len && memcmp(real, cache -> cwd, cwd_len) == 0 && (real[cwd_len] == '/' || real[cwd_len] == 0)) {
+        size_t skip = real[cwd_len] == '/' ? cwd_len + 1 : cwd_len;
+        memcpy(resolved, real + skip, len - skip + 1);
+        return len - skip;
+    }
+
+    memcpy(resolved, real, len + 1);
+    return len;
+}
+
+// realpath runs outside the memo's locks, see memo.h. When the answer cannot
+// be remembered it is still returned, copied into scratch.
+static const char* resolve_dir(PathCache* cache, const char* dir, size_t len, size_t* resolved_len, char* scratch) {
+    uint64_t hash = hash_buffer(dir, len);
+
+    const MemoEntry* entry = memo_find(&cache -> dirs, hash, dir, len);
+    if (entry) {
+        *resolved_len = entry -> value_size - 1;
+        return memo_value(entry);
+    }
+
+    char path[PATH_MAX];
+    memcpy(path, dir, len);
+    path[len] = 0;
+
+    // Not there, its ".." are taken lexically after all
+    size_t found = resolve(cache, path, scratch);
+    if (found == SIZE_MAX) {
+        found = path_join(scratch, PATH_MAX, dir, len, "");
+
+        if (found == 1 && scratch[0] == '.') {
+            scratch[0] = 0;
+            found = 0;
+        }
+    }
+
+    memo_insert(&cache -> dirs, hash, dir, len, scratch, found + 1);
+
+    *resolved_len = found;
+    return scratch;
+}
+
+// path_concat, then the directory part is swapped for its resolved form. The
+// file itself is not resolved, a symlinked header keeps its own name. A name
+// ending in ".." has no file to keep and is joined lexically.
+size_t path_canonical(PathCache* cache, char* out, size_t capacity, const char* dir, size_t dir_len, const char* name) {
+    if (!cache) {
+        return path_join(out, capacity, dir, dir_len, name);
+    }
+
+    size_t len = path_concat(out, capacity, dir, dir_len, name);
+    if (len == 0) {
+        return len;
+    }
+
+    size_t split = len;
+    while (split > 0 && out[split - 1] != '/') {
+        split--;
+    }
+
+    if (len - split == 2 && out[split] == '.' && out[split + 1] == '.') {
+        return path_join(out, capacity, dir, dir_len, name);
+    }
+
+    if (split <= 1) {
+        return len;
+    }
+
+    split--;
+    size_t resolved_len;
+    char scratch[PATH_MAX];
+    const char* resolved = resolve_dir(cache, out, split, &resolved_len, scratch);
+
+    if (resolved_len == split && memcmp(resolved, out, split) == 0) {
+        return len;
+    }
+
+    size_t base_len = len - split - 1;
+    size_t prefix = resolved_len ? resolved_len + 1 : 0;
+    if (prefix + base_len >= capacity) {
+        return 0;
+    }
+
+    memmove(out + prefix, out + split + 1, base_len);
+    memcpy(out, resolved, resolved_len);
+    if (resolved_len) {
+        out[resolved_len] = '/';
+    }
+
+    out[prefix + base_len] = 0;
+    return prefix + base_len;
+}
+
+// SIZE_MAX when the result does not fit
+size_t path_canonical_dir(PathCache* cache, char* out, size_t capacity, const char* dir, size_t dir_len) {
+    size_t len;
+    char scratch[PATH_MAX];
+    const char* resolved = scratch;
+
+    if (cache) {
+        resolved = resolve_dir(cache, dir, dir_len, &len, scratch);
+    } else if ((len = path_join(scratch, PATH_MAX, dir, dir_len, "")) == 0) {
+        return SIZE_MAX;
+    } else if (len == 1 && scratch[0] == '.') {
+        len = 0;
+    }
+
+    if (len >= capacity) {
+        return SIZE_MAX;
+    }
+
+    memcpy(out, resolved, len);
+    out[len] = 0;
+    return len;
+}
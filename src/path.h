@@ -0,0 +1,44 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include "arena.h"
+#include "memo.h"
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Path canonicalization, so one file is interned under one name however it is
+// reached. path_join works on the text alone: repeated slashes and "."
+// components are dropped and ".." removes the component in front of it, a
+// relative path that climbs above its start keeps its leading "..". Relative
+// results are spelled the way discovered paths are, with no "./" in front and
+// "." for the current directory itself.
+//
+// path_concat joins the same way but keeps every "..": after a symlinked
+// directory "sub/.." is not the directory holding sub, only realpath knows.
+//
+// path_canonical also resolves symlinks in the directory of the joined path,
+// so it concatenates and leaves ".." to realpath. realpath runs once per
+// distinct directory, the answer is remembered, so every include after the
+// first from a directory is a join and a lookup. Resolved directories under
+// the working directory stay relative to it, anything else becomes absolute.
+// A directory that does not exist is kept as path_join spells it.
+// path_canonical_dir gives that resolved form of a directory alone, "" for the
+// working directory, so names can be appended to it without resolving again.
+
+typedef struct {
+    char cwd[PATH_MAX];
+    size_t cwd_len;
+    MemoTable dirs;
+} PathCache;
+
+size_t path_join(char* out, size_t capacity, const char* dir, size_t dir_len, const char* name);
+size_t path_concat(char* out, size_t capacity, const char* dir, size_t dir_len, const char* name);
+
+PathCache* path_cache_create(Arena* arena);
+void path_cache_destroy(PathCache* cache);
+size_t path_canonical(PathCache* cache, char* out, size_t capacity, const char* dir, size_t dir_len, const char* name);
+size_t path_canonical_dir(PathCache* cache, char* out, size_t capacity, const char* dir, size_t dir_len);
+
+#endif // !PATH_H
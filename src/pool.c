@@ -0,0 +1,203 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static inline uint64_t pack_range(uint32_t top, uint32_t bottom) {
+    return ((uint64_t) top << 32) | bottom;
+}
+
+static int pop_own(PoolDeque* deque, size_t* item) {
+    uint64_t range = __atomic_load_n(&deque -> range, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        uint32_t top = range >> 32;
+        uint32_t bottom = (uint32_t) range;
+
+        if (top >= bottom) {
+            return 0;
+        }
+
+        if (__atomic_compare_exchange_n(&deque -> range, &range, pack_range(top, bottom - 1), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *item = bottom - 1;
+            return 1;
+        }
+    }
+}
+
+// Moves the upper half of a victim's range into the thief's empty deque. Nobody
+// else writes an empty deque, so a plain store publishes the stolen range.
+static int steal(Pool* pool, size_t thief) {
+    for (size_t i = 1; i < pool -> worker_count; i++) {
+        PoolDeque* victim = &pool -> deques[(thief + i) % pool -> worker_count];
+        uint64_t range = __atomic_load_n(&victim -> range, __ATOMIC_ACQUIRE);
+
+        for (;;) {
+            uint32_t top = range >> 32;
+            uint32_t bottom = (uint32_t) range;
+
+            if (top >= bottom) {
+                break;
+            }
+
+            uint32_t half = (bottom - top + 1) / 2;
+            if (__atomic_compare_exchange_n(&victim -> range, &range, pack_range(top + half, bottom), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&pool -> deques[thief].range, pack_range(top, top + half), __ATOMIC_RELEASE);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void run_worker(Pool* pool, size_t id) {
+    size_t item;
+
+    for (;;) {
+        if (pop_own(&pool -> deques[id], &item)) {
+            pool -> task(pool -> ctx, id, item);
+            continue;
+        }
+
+        if (!steal(pool, id)) {
+            return;
+        }
+    }
+}
+
+static void* worker_main(void* arg) {
+    PoolWorker* worker = arg;
+    Pool* pool = worker -> pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool -> lock);
+    for (;;) {
+        while (pool -> generation == seen && !pool -> stopping) {
+            pthread_cond_wait(&pool -> start, &pool -> lock);
+        }
+
+        if (pool -> stopping) {
+            break;
+        }
+
+        seen = pool -> generation;
+        pthread_mutex_unlock(&pool -> lock);
+
+        run_worker(pool, worker -> id);
+
+        pthread_mutex_lock(&pool -> lock);
+        if (--pool -> active == 0) {
+            pthread_cond_signal(&pool -> done);
+        }
+    }
+    pthread_mutex_unlock(&pool -> lock);
+
+    return NULL;
+}
+
+size_t pool_default_workers(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t) count : 1;
+}
+
+Pool* pool_create(size_t worker_count) {
+    if (worker_count == 0) {
+        worker_count = 1;
+    }
+
+    Pool* pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool -> lock, NULL);
+    pthread_cond_init(&pool -> start, NULL);
+    pthread_cond_init(&pool -> done, NULL);
+
+    pool -> worker_count = worker_count;
+    pool -> threads = calloc(worker_count, sizeof(pthread_t));
+    pool -> workers = calloc(worker_count, sizeof(PoolWorker));
+    pool -> deques = aligned_alloc(64, sizeof(PoolDeque) * worker_count);
+
+    if (!pool -> threads || !pool -> workers || !pool -> deques) {
+        pool_destroy(pool);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        pool -> deques[i].range = 0;
+        pool -> workers[i].pool = pool;
+        pool -> workers[i].id = i;
+    }
+
+    for (size_t i = 1; i < worker_count; i++) {
+        if (pthread_create(&pool -> threads[i], NULL, worker_main, &pool -> workers[i]) != 0) {
+            pool -> worker_count = i;
+            break;
+        }
+    }
+
+    return pool;
+}
+
+void pool_run(Pool* pool, size_t count, PoolTask task, void* ctx) {
+    if (count == 0) {
+        return;
+    }
+
+    size_t workers = pool -> worker_count;
+    size_t chunk = count / workers;
+    size_t extra = count % workers;
+    size_t start = 0;
+
+    for (size_t i = 0; i < workers; i++) {
+        size_t len = chunk + (i < extra ? 1 : 0);
+        pool -> deques[i].range = pack_range((uint32_t) start, (uint32_t) (start + len));
+        start += len;
+    }
+
+    pthread_mutex_lock(&pool -> lock);
+    pool -> task = task;
+    pool -> ctx = ctx;
+    pool -> active = workers - 1;
+    pool -> generation++;
+    pthread_cond_broadcast(&pool -> start);
+    pthread_mutex_unlock(&pool -> lock);
+
+    run_worker(pool, 0);
+
+    pthread_mutex_lock(&pool -> lock);
+    while (pool -> active > 0) {
+        pthread_cond_wait(&pool -> done, &pool -> lock);
+    }
+    pthread_mutex_unlock(&pool -> lock);
+}
+
+void pool_destroy(Pool* pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool -> lock);
+    pool -> stopping = 1;
+    pthread_cond_broadcast(&pool -> start);
+    pthread_mutex_unlock(&pool -> lock);
+
+    if (pool -> threads && pool -> workers && pool -> deques) {
+        for (size_t i = 1; i < pool -> worker_count; i++) {
+            pthread_join(pool -> threads[i], NULL);
+        }
+    }
+
+    pthread_mutex_destroy(&pool -> lock);
+    pthread_cond_destroy(&pool -> start);
+    pthread_cond_destroy(&pool -> done);
+
+    free(pool -> threads);
+    free(pool -> workers);
+    free(pool -> deques);
+    free(pool);
+}
@@ -0,0 +1,49 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size thread pool running a batch of indexed items. Every worker owns a
+// deque holding a range of item indices, packed as (top << 32 | bottom) so the
+// owner popping the bottom and thieves taking the upper half of the top both
+// go through a single CAS. The thread calling pool_run works as worker 0.
+
+typedef void (*PoolTask)(void* ctx, size_t worker, size_t item);
+
+typedef struct {
+    uint64_t range;
+} __attribute__((aligned(64))) PoolDeque;
+
+typedef struct Pool Pool;
+
+typedef struct {
+    Pool* pool;
+    size_t id;
+} PoolWorker;
+
+struct Pool {
+    pthread_t* threads;
+    PoolWorker* workers;
+    PoolDeque* deques;
+    size_t worker_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    size_t active;
+    int stopping;
+
+    PoolTask task;
+    void* ctx;
+};
+
+size_t pool_default_workers(void);
+
+Pool* pool_create(size_t worker_count);
+void pool_run(Pool* pool, size_t count, PoolTask task, void* ctx);
+void pool_destroy(Pool* pool);
+
+#endif // !POOL_H
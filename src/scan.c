@@ -0,0 +1,705 @@
+#include "scan.h"
+
+#include "arena.h"
+#include "cache.h"
+#include "cond.h"
+#include "hash.h"
+#include "hashtable.h"
+#include "lex.h"
+#include "path.h"
+#include "search.h"
+#include "store.h"
+#include "uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+FileStat file_stat(const struct stat* st) {
+    return (FileStat) {
+        .mtime_ns = (uint64_t) st -> st_mtim.tv_sec * 1000000000ULL + (uint64_t) st -> st_mtim.tv_nsec,
+        .size = (uint64_t) st -> st_size,
+        .ino = (uint64_t) st -> st_ino,
+        .dev = (uint64_t) st -> st_dev,
+    };
+}
+
+// The variants edges are resolved under, 0 without conditional mode
+uint64_t scan_conditions_hash(const ScanContext* ctx) {
+    return ctx -> conditions ? ctx -> conditions -> hash : 0;
+}
+
+static void push_include(Arena* arena, ScanResult* result, FileId id, uint64_t variants) {
+    if (id == FILE_ID_NONE) {
+        result -> error = "Failed to intern include!";
+        return;
+    }
+
+    if (result -> include_count >= result -> include_capacity) {
+        size_t capacity = result -> include_capacity ? result -> include_capacity * 2 : 4;
+        result -> includes = arena_realloc(arena, result -> includes, sizeof(FileId) * result -> include_capacity, sizeof(FileId) * capacity);
+        result -> include_variants = arena_realloc(arena, result -> include_variants, sizeof(uint64_t) * result -> include_capacity, sizeof(uint64_t) * capacity);
+        result -> include_capacity = capacity;
+    }
+
+    result -> include_variants[result -> include_count] = variants;
+    result -> includes[result -> include_count++] = id;
+}
+
+static void push_spelling(Arena* arena, ScanResult* result, const char* spelling) {
+    if (result -> spelling_count >= result -> spelling_capacity) {
+        size_t capacity = result -> spelling_capacity ? result -> spelling_capacity * 2 : 4;
+        result -> spellings = arena_realloc(arena, result -> spellings, sizeof(char*) * result -> spelling_capacity, sizeof(char*) * capacity);
+        result -> spelling_capacity = capacity;
+    }
+
+    result -> spellings[result -> spelling_count++] = spelling;
+}
+
+// Discovered files are known to exist, anything else goes through the lookup cache
+static int include_exists(const ScanContext* ctx, const char* path, size_t len) {
+    Node* node = get_ht(ctx -> ht, path);
+    if (node && node -> discovered) {
+        return 1;
+    }
+
+    return search_path_exists(ctx -> search, path, len);
+}
+
+static int find_in_dirs(const ScanContext* ctx, const char** dirs, size_t count, const char* name, char* path) {
+    for (size_t i = 0; i < count; i++) {
+        size_t len = path_canonical(ctx -> paths, path, PATH_MAX, dirs[i], strlen(dirs[i]), name);
+        if (len && include_exists(ctx, path, len)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Resolves a spelling into a stack buffer, intern_path only copies it when
+// the path was never seen before. A quote include found nowhere keeps the
+// path next to the includer, so a header that is missing still gets an edge.
+static void resolve_include(Arena* arena, const ScanContext* ctx, ScanResult* result, const char* file, const char* spelling, uint64_t variants) {
+    const SearchPath* search = ctx -> search;
+    const char* name = spelling + 1;
+    char path[PATH_MAX];
+
+    if (*spelling == '"') {
+        const char* slash = strrchr(file, '/');
+        size_t dir_len = slash ? (size_t) (slash - file) : 0;
+        size_t len = path_canonical(ctx -> paths, path, PATH_MAX, file, dir_len, name);
+
+        if (len && search -> quote_count + search -> dir_count > 0 && !include_exists(ctx, path, len)) {
+            if (!find_in_dirs(ctx, search -> quote_dirs, search -> quote_count, name, path)
+                && !find_in_dirs(ctx, search -> dirs, search -> dir_count, name, path)) {
+                len = path_canonical(ctx -> paths, path, PATH_MAX, file, dir_len, name);
+            }
+        }
+
+        if (len) {
+            push_include(arena, result, intern_path(ctx -> ht, path), variants);
+        }
+    } else if (*spelling == '<') {
+        if (find_in_dirs(ctx, search -> dirs, search -> dir_count, name, path)) {
+            push_include(arena, result, intern_path(ctx -> ht, path), variants);
+        }
+    }
+}
+
+// One recorded spelling. An include is resolved for the variants whose branch
+// may compile it, a "#" record moves the branch. Without conditional mode the
+// records are skipped and every include holds for all variants.
+static void resolve_spelling(Arena* arena, const ScanContext* ctx, ScanResult* result, CondStack* stack, const char* file, const char* spelling) {
+    if (*spelling == '#') {
+        if (ctx -> conditions) {
+            cond_apply(stack, spelling);
+        }
+        return;
+    }
+
+    uint64_t variants = ctx -> conditions ? cond_active(stack) : VARIANTS_ALL;
+    if (variants) {
+        resolve_include(arena, ctx, result, file, spelling, variants);
+    }
+}
+
+// groups holds the spelling count at each open conditional and kept whether
+// anything was recorded inside it that has to stay
+typedef struct {
+    Arena* arena;
+    const ScanContext* ctx;
+    ScanResult* result;
+    const char* file;
+    CondStack stack;
+    size_t groups[COND_MAX_DEPTH];
+    uint8_t kept[COND_MAX_DEPTH];
+    size_t depth;
+} IncludeScan;
+
+static void keep_group(IncludeScan* scan) {
+    if (scan -> depth > 0) {
+        scan -> kept[(scan -> depth < COND_MAX_DEPTH ? scan -> depth : COND_MAX_DEPTH) - 1] = 1;
+    }
+}
+
+// Conditionals are recorded next to the includes, as "#name text", so a replay
+// can evaluate them without the file. Whether conditional mode is on does not
+// change what is recorded. A group that closes without an include inside is
+// dropped again, an include guard around declarations costs nothing.
+static void record_condition(IncludeScan* scan, const Directive* directive, CondKind kind) {
+    ScanResult* result = scan -> result;
+
+    if (kind != COND_OPEN && scan -> depth == 0) {
+        return;
+    }
+
+    if (kind == COND_CLOSE) {
+        scan -> depth--;
+
+        if (scan -> depth < COND_MAX_DEPTH && !scan -> kept[scan -> depth]) {
+            result -> spelling_count = scan -> groups[scan -> depth];
+            resolve_spelling(scan -> arena, scan -> ctx, result, &scan -> stack, scan -> file, "#endif");
+            return;
+        }
+
+        keep_group(scan);
+    } else if (kind == COND_OPEN) {
+        if (scan -> depth < COND_MAX_DEPTH) {
+            scan -> groups[scan -> depth] = result -> spelling_count;
+            scan -> kept[scan -> depth] = 0;
+        } else {
+            keep_group(scan);
+        }
+
+        scan -> depth++;
+    }
+
+    size_t text_len = strnlen(directive -> text, directive -> text_len);
+    size_t len = 1 + directive -> name_len + (text_len ? 1 + text_len : 0);
+    char* record = arena_alloc(scan -> arena, len + 1);
+
+    record[0] = '#';
+    memcpy(record + 1, directive -> name, directive -> name_len);
+    if (text_len) {
+        record[1 + directive -> name_len] = ' ';
+        memcpy(record + 2 + directive -> name_len, directive -> text, text_len);
+    }
+    record[len] = 0;
+
+    push_spelling(scan -> arena, result, record);
+    resolve_spelling(scan -> arena, scan -> ctx, result, &scan -> stack, scan -> file, record);
+}
+
+// #include "x.h" and #include <x.h>, computed includes are skipped
+static void scan_directive(void* ctx, const Directive* directive) {
+    IncludeScan* scan = ctx;
+    const char* text = directive -> text;
+
+    CondKind kind = cond_kind(directive -> name, directive -> name_len);
+    if (kind != COND_NONE) {
+        record_condition(scan, directive, kind);
+        return;
+    }
+
+    if (directive -> name_len != 7 || memcmp(directive -> name, "include", 7) != 0 || directive -> text_len < 2) {
+        return;
+    }
+
+    char close = text[0] == '"' ? '"' : text[0] == '<' ? '>' : 0;
+    if (!close) {
+        return;
+    }
+
+    const char* end = memchr(text + 1, close, directive -> text_len - 1);
+    if (!end || end == text + 1 || memchr(text, 0, end - text)) {
+        return;
+    }
+
+    size_t len = end - text;
+    char* spelling = arena_alloc(scan -> arena, len + 1);
+    memcpy(spelling, text, len);
+    spelling[len] = 0;
+
+    push_spelling(scan -> arena, scan -> result, spelling);
+    resolve_spelling(scan -> arena, scan -> ctx, scan -> result, &scan -> stack, scan -> file, spelling);
+    keep_group(scan);
+}
+
+void search_for_preprocessor(Arena* arena, const ScanContext* ctx, ScanResult* out, const char* buffer, size_t size, const char* file) {
+    IncludeScan scan = {
+        .arena = arena,
+        .ctx = ctx,
+        .result = out,
+        .file = file,
+    };
+
+    cond_begin(&scan.stack, ctx -> conditions);
+    lex_directives(buffer, size, scan_directive, &scan);
+}
+
+// Spellings of a cached record, resolved against path
+static void resolve_record(Arena* arena, const ScanContext* ctx, const CacheRecord* record, const char* path, ScanResult* result) {
+    CondStack stack;
+    cond_begin(&stack, ctx -> conditions);
+
+    for (uint32_t i = 0; i < record -> spelling_count; i++) {
+        const char* spelling = cache_record_spelling(ctx -> cache, record, i);
+
+        if (!spelling) {
+            result -> error = "Corrupt cache entry!";
+            return;
+        }
+
+        push_spelling(arena, result, spelling);
+        resolve_spelling(arena, ctx, result, &stack, path, spelling);
+    }
+}
+
+// Whether the includes a scan resolved are the edges a record was written
+// with. graph_freeze dropped repeated includes from those, keeping the first,
+// so an include is either the next edge or one already matched.
+static int includes_match(const CachedFiles* cache, const CacheRecord* record, const ScanResult* result) {
+    uint32_t matched = 0;
+
+    for (size_t k = 0; k < result -> include_count; k++) {
+        const CacheRecord* dep = cache_record_dependency(cache, record, matched);
+        if (dep && (FileId) (dep - cache -> records) == result -> includes[k]) {
+            matched++;
+            continue;
+        }
+
+        uint32_t i = 0;
+        while (i < matched && (FileId) (cache_record_dependency(cache, record, i) - cache -> records) != result -> includes[k]) {
+            i++;
+        }
+
+        if (i == matched) {
+            return 0;
+        }
+    }
+
+    return matched == record -> edge_count;
+}
+
+// Whether the cached edges were resolved under this run's variants
+static int edges_comparable(const ScanContext* ctx) {
+    return ctx -> cache -> header -> conditions_hash == scan_conditions_hash(ctx);
+}
+
+// The file's own record. Its spellings are resolved again rather than its
+// edges trusted: a header added earlier on the search path, or next to a quote
+// include's includer, takes over without any change to config.cat, and the
+// existence checks behind resolving are memoized. When the edges come out
+// different the file is dirty, its includers now pull in other headers. Edges
+// resolved under other variants, or without -p, differ by the includes the
+// conditions drop and say nothing about the headers.
+static void restore_includes(Arena* arena, const ScanContext* ctx, const CacheRecord* record, const char* path, ScanResult* result) {
+    resolve_record(arena, ctx, record, path, result);
+
+    if (!result -> error && edges_comparable(ctx) && !includes_match(ctx -> cache, record, result)) {
+        result -> dirty = 1;
+    }
+}
+
+// Same bytes, same include list: a record with this content hash, the file's
+// own or another's, has its spellings resolved against this path instead of
+// scanning
+static int replay_includes(Arena* arena, const ScanContext* ctx, const char* path, ScanResult* result) {
+    const CacheRecord* memo = cache_find_content(ctx -> cache, result -> content_hash);
+    if (!memo) {
+        return 0;
+    }
+
+    resolve_record(arena, ctx, memo, path, result);
+    return 1;
+}
+
+static int replay_stored(Arena* arena, const ScanContext* ctx, const char* path, ScanResult* result) {
+    const char** spellings = NULL;
+    size_t count = 0;
+
+    if (store_find_content(ctx -> store, arena, result -> content_hash, &spellings, &count) != 0) {
+        return 0;
+    }
+
+    CondStack stack;
+    cond_begin(&stack, ctx -> conditions);
+
+    for (size_t i = 0; i < count; i++) {
+        push_spelling(arena, result, spellings[i]);
+        resolve_spelling(arena, ctx, result, &stack, path, spellings[i]);
+    }
+
+    return 1;
+}
+
+// The local cache first, then the machine-wide store. Whichever list is
+// replayed, the edges are compared with the file's own record when it has one,
+// as restore_includes does.
+static int replay(Arena* arena, const ScanContext* ctx, const CacheRecord* cached, const char* path, ScanResult* result) {
+    if (!(ctx -> cache && replay_includes(arena, ctx, path, result)) && !(ctx -> store && replay_stored(arena, ctx, path, result))) {
+        return 0;
+    }
+
+    if (!result -> error && cached && edges_comparable(ctx) && !includes_match(ctx -> cache, cached, result)) {
+        result -> dirty = 1;
+    }
+
+    return 1;
+}
+
+// Everything a stat alone settles: an unchanged file replays its cached edges,
+// a known inode replays the store, an empty file has nothing to scan. Returns
+// 0 when the contents are needed.
+static int scan_stat(Arena* arena, const ScanContext* ctx, FileId id, const struct stat* st, ScanResult* result) {
+    CachedFiles* cache = ctx -> cache;
+    const Store* store = ctx -> store;
+    const char* path = ht_node(ctx -> ht, id) -> path;
+
+    result -> stat = file_stat(st);
+    const CacheRecord* cached = cache ? cache_record(cache, id) : NULL;
+
+    if (cached && cache_stat_matches(cache, cached, &result -> stat)) {
+        result -> content_hash = cached -> content_hash;
+        restore_includes(arena, ctx, cached, path, result);
+        return 1;
+    }
+
+    // Same inode seen by another checkout path, neither read nor hashed
+    if (store && store_find_stat(store, &result -> stat, &result -> content_hash) == 0) {
+        result -> stat_stored = 1;
+
+        if (replay(arena, ctx, cached, path, result)) {
+            result -> dirty |= !cached || cached -> content_hash != result -> content_hash;
+            return 1;
+        }
+    }
+
+    if (st -> st_size == 0) {
+        result -> content_hash = hash_buffer("", 0);
+        result -> dirty = !cached || cached -> content_hash != result -> content_hash;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void scan_contents(Arena* arena, const ScanContext* ctx, FileId id, const char* buffer, size_t size, ScanResult* result) {
+    const Store* store = ctx -> store;
+    const char* path = ht_node(ctx -> ht, id) -> path;
+    const CacheRecord* cached = ctx -> cache ? cache_record(ctx -> cache, id) : NULL;
+
+    result -> content_hash = hash_buffer(buffer, size);
+    result -> dirty = !cached || cached -> content_hash != result -> content_hash;
+
+    // Store writes are best effort, a failed one is just a later miss
+    if (!replay(arena, ctx, cached, path, result)) {
+        search_for_preprocessor(arena, ctx, result, buffer, size, path);
+
+        if (store && !result -> error) {
+            store_put_content(store, result -> content_hash, result -> spellings, result -> spelling_count);
+        }
+    }
+
+    // Only a missing or racy stat entry is written, each put is a temp file
+    // and a rename
+    if (store && !result -> error && !result -> stat_stored) {
+        store_put_stat(store, &result -> stat, result -> content_hash);
+    }
+}
+
+// Blocking open and read, or mmap for larger files
+static void scan_read(Arena* arena, const ScanContext* ctx, FileId id, const struct stat* st, ScanResult* result) {
+    const char* path = ht_node(ctx -> ht, id) -> path;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        result -> error = "File not found!";
+        return;
+    }
+
+    char* buffer = NULL;
+    int alloc_method = 0;
+
+    if (st -> st_size < 8192) {
+        buffer = malloc(st -> st_size);
+        ssize_t bytes_read = read(fd, buffer, st -> st_size);
+
+        if (bytes_read != (ssize_t) st -> st_size) {
+            result -> error = "Unable to read file!";
+            free(buffer);
+            close(fd);
+            return;
+        }
+    } else {
+        buffer = mmap(NULL, st -> st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buffer == MAP_FAILED) {
+            result -> error = "Unable to allocate file!";
+            close(fd);
+            return;
+        }
+
+        alloc_method = 1;
+    }
+
+    scan_contents(arena, ctx, id, buffer, st -> st_size, result);
+
+    if (alloc_method == 0) {
+        free(buffer);
+    } else {
+        munmap(buffer, st -> st_size);
+    }
+
+    close(fd);
+}
+
+void scan_file(Arena* arena, const ScanContext* ctx, FileId id, ScanResult* result) {
+    const char* path = ht_node(ctx -> ht, id) -> path;
+
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+        result -> error = "File not found!";
+        result -> missing = 1;
+
+        // Deleted since the last run, the files including it have to rebuild.
+        // One that was missing then too was never hashed and is not dirty.
+        const CacheRecord* cached = ctx -> cache ? cache_record(ctx -> cache, id) : NULL;
+        result -> dirty = cached && cached -> content_hash != 0;
+        return;
+    }
+
+    if (!scan_stat(arena, ctx, id, &st, result)) {
+        scan_read(arena, ctx, id, &st, result);
+    }
+}
+
+// The fields file_stat and scan_read look at. st_dev is encoded the way
+// stat(2) reports it, so cache records match whichever path wrote them.
+static void statx_to_stat(const struct statx* stx, struct stat* st) {
+    memset(st, 0, sizeof(*st));
+    st -> st_mode = stx -> stx_mode;
+    st -> st_size = (off_t) stx -> stx_size;
+    st -> st_ino = (ino_t) stx -> stx_ino;
+    st -> st_dev = makedev(stx -> stx_dev_major, stx -> stx_dev_minor);
+    st -> st_mtim.tv_sec = stx -> stx_mtime.tv_sec;
+    st -> st_mtim.tv_nsec = stx -> stx_mtime.tv_nsec;
+}
+
+// Queues an entry, submitting what is already queued when the ring is full
+static struct io_uring_sqe* next_sqe(Uring* ring) {
+    struct io_uring_sqe* sqe = uring_sqe(ring);
+
+    if (!sqe && uring_submit(ring) == 0) {
+        sqe = uring_sqe(ring);
+    }
+
+    return sqe;
+}
+
+// Waits for the pending completions of one phase and files each result under
+// its user_data, count bounds which ones belong. Phases wait for everything
+// they queued, so only a failed ring, never used again, leaves any behind.
+static int collect(Uring* ring, size_t pending, int32_t* results, size_t count) {
+    if (uring_submit(ring) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < pending; i++) {
+        struct io_uring_cqe cqe;
+        if (uring_wait(ring, &cqe) != 0) {
+            return -1;
+        }
+
+        if (cqe.user_data < count) {
+            results[cqe.user_data] = cqe.res;
+        }
+    }
+
+    return 0;
+}
+
+// scan_file for up to SCAN_BATCH files in three round trips: one statx per
+// file, one openat per file that has to be read, then a read into the file's
+// ring buffer hard-linked to its close. Each read is hashed and scanned as its
+// completion comes in. Anything the ring cannot do, a failed entry or a file
+// larger than a buffer, goes through the blocking path for that file, which
+// also reports its errors exactly as scan_file does.
+//
+// Whatever the kernel writes lives in the ring's buffers, the statx results in
+// the one past the reads, so a ring that failed with entries in flight never
+// writes into the stack or a later batch. Its files all take the blocking path.
+void scan_batch(Arena* arena, const ScanContext* ctx, Uring* ring, const FileId* ids, ScanResult* results, size_t count) {
+    if (ring -> failed) {
+        for (size_t i = 0; i < count; i++) {
+            scan_file(arena, ctx, ids[i], &results[i]);
+        }
+        return;
+    }
+
+    struct statx* stx = (struct statx*) uring_buffer(ring, SCAN_BATCH);
+    struct stat st[SCAN_BATCH];
+    int32_t status[SCAN_BATCH];
+    size_t reads[SCAN_BATCH];
+    size_t read_count = 0;
+    size_t stated = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        status[i] = -EIO;
+    }
+
+    for (; stated < count; stated++) {
+        struct io_uring_sqe* sqe = next_sqe(ring);
+        if (!sqe) {
+            break;
+        }
+
+        sqe -> opcode = IORING_OP_STATX;
+        sqe -> fd = AT_FDCWD;
+        sqe -> addr = (uint64_t) (uintptr_t) ht_node(ctx -> ht, ids[stated]) -> path;
+        sqe -> len = STATX_BASIC_STATS;
+        sqe -> off = (uint64_t) (uintptr_t) &stx[stated];
+        sqe -> user_data = stated;
+    }
+
+    // A statx that never ran, or whose completion never came, reads as failed
+    // and takes the blocking path
+    collect(ring, stated, status, stated);
+
+    for (size_t i = 0; i < count; i++) {
+        if (status[i] < 0 || !S_ISREG(stx[i].stx_mode)) {
+            scan_file(arena, ctx, ids[i], &results[i]);
+            continue;
+        }
+
+        statx_to_stat(&stx[i], &st[i]);
+        if (scan_stat(arena, ctx, ids[i], &st[i], &results[i])) {
+            continue;
+        }
+
+        if (ring -> failed || (size_t) st[i].st_size > ring -> buffer_size) {
+            scan_read(arena, ctx, ids[i], &st[i], &results[i]);
+            continue;
+        }
+
+        reads[read_count++] = i;
+    }
+
+    int32_t fds[SCAN_BATCH];
+    size_t opened = 0;
+
+    for (; opened < read_count; opened++) {
+        struct io_uring_sqe* sqe = next_sqe(ring);
+        if (!sqe) {
+            break;
+        }
+
+        sqe -> opcode = IORING_OP_OPENAT;
+        sqe -> fd = AT_FDCWD;
+        sqe -> addr = (uint64_t) (uintptr_t) ht_node(ctx -> ht, ids[reads[opened]]) -> path;
+        sqe -> open_flags = O_RDONLY;
+        sqe -> user_data = opened;
+        fds[opened] = -EIO;
+    }
+
+    // The descriptors that did come back are closed, the reads go blocking
+    if (collect(ring, opened, fds, opened) != 0) {
+        for (size_t k = 0; k < opened; k++) {
+            if (fds[k] >= 0) {
+                close(fds[k]);
+            }
+        }
+
+        opened = 0;
+    }
+
+    // Buffer k belongs to the k-th read, user_data is k for the read and
+    // SCAN_BATCH + k for the close behind it. From here the ring owns each
+    // descriptor whose close the kernel took, closed_at is where it was queued.
+    size_t queued = 0;
+    uint8_t done[SCAN_BATCH] = {0};
+    unsigned closed_at[SCAN_BATCH];
+
+    for (size_t k = 0; k < opened; k++) {
+        if (fds[k] < 0) {
+            continue;
+        }
+
+        // An entry taken without room for its close is spent as a NOP
+        struct io_uring_sqe* sqe = next_sqe(ring);
+        struct io_uring_sqe* close_sqe = sqe ? next_sqe(ring) : NULL;
+        if (!close_sqe) {
+            if (sqe) {
+                sqe -> opcode = IORING_OP_NOP;
+                sqe -> user_data = SCAN_BATCH + k;
+                queued++;
+            }
+
+            close(fds[k]);
+            fds[k] = -EIO;
+            continue;
+        }
+
+        size_t i = reads[k];
+        sqe -> opcode = ring -> registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe -> fd = fds[k];
+        sqe -> addr = (uint64_t) (uintptr_t) uring_buffer(ring, (unsigned) k);
+        sqe -> len = (uint32_t) st[i].st_size;
+        sqe -> buf_index = (uint16_t) k;
+        sqe -> flags = IOSQE_IO_HARDLINK;
+        sqe -> user_data = k;
+
+        close_sqe -> opcode = IORING_OP_CLOSE;
+        close_sqe -> fd = fds[k];
+        close_sqe -> user_data = SCAN_BATCH + k;
+        closed_at[k] = ring -> sq_tail - 1;
+        queued += 2;
+    }
+
+    // Entries the kernel never took have no completion coming and their
+    // descriptors are still ours
+    if (uring_submit(ring) != 0) {
+        for (size_t k = 0; k < opened; k++) {
+            if (fds[k] >= 0 && !uring_consumed(ring, closed_at[k])) {
+                close(fds[k]);
+            }
+        }
+
+        queued = 0;
+    }
+
+    for (size_t n = 0; n < queued; n++) {
+        struct io_uring_cqe cqe;
+        if (uring_wait(ring, &cqe) != 0) {
+            break;
+        }
+
+        if (cqe.user_data >= opened) {
+            continue;
+        }
+
+        size_t k = cqe.user_data;
+        size_t i = reads[k];
+        done[k] = 1;
+
+        if (cqe.res == st[i].st_size) {
+            scan_contents(arena, ctx, ids[i], uring_buffer(ring, (unsigned) k), (size_t) cqe.res, &results[i]);
+        } else {
+            scan_read(arena, ctx, ids[i], &st[i], &results[i]);
+        }
+    }
+
+    for (size_t k = 0; k < read_count; k++) {
+        if (!done[k]) {
+            scan_read(arena, ctx, ids[reads[k]], &st[reads[k]], &results[reads[k]]);
+        }
+    }
+}
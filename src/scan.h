@@ -0,0 +1,63 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "arena.h"
+#include "cache.h"
+#include "cond.h"
+#include "hashtable.h"
+#include "path.h"
+#include "search.h"
+#include "store.h"
+#include "uring.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// scan_batch takes up to SCAN_BATCH files through one ring, which wants
+// 2 * SCAN_BATCH entries and SCAN_BATCH + 1 buffers, the last one for the
+// batch's statx results. Files larger than a buffer are read the blocking way.
+#define SCAN_BATCH 32
+#define SCAN_BUFFER_SIZE (64 * 1024)
+
+// Everything one file contributes to the graph. Scans run on worker threads,
+// include paths are interned as they are found and the edges are added by the
+// caller once the scan succeeded. spellings keeps the include text as written
+// and the conditionals around it, in the cache format, so the list can be
+// memoized by content hash. include_variants has the variants each include
+// holds for, every variant outside conditional mode. The lists are allocated
+// from the arena given to scan_file and last only as long as it does.
+typedef struct {
+    FileStat stat;
+    uint64_t content_hash;
+    uint8_t dirty;
+    uint8_t missing;
+    uint8_t stat_stored;
+    FileId* includes;
+    uint64_t* include_variants;
+    size_t include_count;
+    size_t include_capacity;
+    const char** spellings;
+    size_t spelling_count;
+    size_t spelling_capacity;
+    const char* error;
+} ScanResult;
+
+// Shared by every scan of a run
+typedef struct {
+    HashTable* ht;
+    CachedFiles* cache;
+    const Store* store;
+    SearchPath* search;
+    PathCache* paths;
+    const Conditions* conditions;
+} ScanContext;
+
+FileStat file_stat(const struct stat* st);
+uint64_t scan_conditions_hash(const ScanContext* ctx);
+
+void search_for_preprocessor(Arena* arena, const ScanContext* ctx, ScanResult* out, const char* buffer, size_t size, const char* file);
+void scan_file(Arena* arena, const ScanContext* ctx, FileId id, ScanResult* result);
+void scan_batch(Arena* arena, const ScanContext* ctx, Uring* ring, const FileId* ids, ScanResult* results, size_t count);
+
+#endif // !SCAN_H
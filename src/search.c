@@ -0,0 +1,144 @@
+#include "search.h"
+
+#include "arena.h"
+#include "config.h"
+#include "hash.h"
+#include "path.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct {
+    const char** items;
+    size_t count;
+    size_t capacity;
+} DirList;
+
+// Normalized with path_concat so "./inc/" and "inc" are one directory, "." is
+// kept as the empty prefix. ".." stays for path_canonical to resolve.
+static void push_dir(Arena* arena, DirList* list, const char* token, size_t token_len) {
+    char dir[PATH_MAX];
+    size_t len = path_concat(dir, sizeof(dir), token, token_len, "");
+    if (len == 0) {
+        return;
+    }
+
+    if (len == 1 && dir[0] == '.') {
+        len = 0;
+    }
+
+    for (size_t i = 0; i < list -> count; i++) {
+        if (strlen(list -> items[i]) == len && memcmp(list -> items[i], dir, len) == 0) {
+            return;
+        }
+    }
+
+    if (list -> count >= list -> capacity) {
+        size_t capacity = list -> capacity ? list -> capacity * 2 : 4;
+        list -> items = arena_realloc(arena, list -> items, sizeof(char*) * list -> capacity, sizeof(char*) * capacity);
+        list -> capacity = capacity;
+    }
+
+    char* copy = arena_alloc(arena, len + 1);
+    memcpy(copy, dir, len);
+    copy[len] = 0;
+
+    list -> items[list -> count++] = copy;
+}
+
+// -Idir, -I dir and the same two forms of -iquote and -isystem
+static void parse_flags(Arena* arena, const char* flags, DirList* quote, DirList* include, DirList* system) {
+    static const struct { const char* flag; size_t len; int kind; } options[] = {
+        { "-iquote", 7, 0 },
+        { "-isystem", 8, 2 },
+        { "-I", 2, 1 },
+    };
+
+    const char* cursor = flags;
+    DirList* expecting = NULL;
+
+    while (*cursor) {
+        while (isspace((unsigned char) *cursor)) cursor++;
+
+        const char* token = cursor;
+        while (*cursor && !isspace((unsigned char) *cursor)) cursor++;
+
+        size_t len = cursor - token;
+        if (len == 0) {
+            break;
+        }
+
+        if (expecting) {
+            push_dir(arena, expecting, token, len);
+            expecting = NULL;
+            continue;
+        }
+
+        for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+            if (len < options[i].len || memcmp(token, options[i].flag, options[i].len) != 0) {
+                continue;
+            }
+
+            DirList* list = options[i].kind == 0 ? quote : options[i].kind == 1 ? include : system;
+            if (len == options[i].len) {
+                expecting = list;
+            } else {
+                push_dir(arena, list, token + options[i].len, len - options[i].len);
+            }
+            break;
+        }
+    }
+}
+
+SearchPath* search_path_create(Arena* arena, const Config* config) {
+    DirList quote = {0};
+    DirList include = {0};
+    DirList system = {0};
+
+    parse_flags(arena, config -> default_flags, &quote, &include, &system);
+    for (size_t t = 0; t < config -> target_count; t++) {
+        parse_flags(arena, config -> targets[t].flags, &quote, &include, &system);
+    }
+
+    SearchPath* search = arena_alloc(arena, sizeof(SearchPath));
+    memset(search, 0, sizeof(*search));
+
+    // GCC searches every -I directory before the first -isystem one
+    for (size_t i = 0; i < system.count; i++) {
+        push_dir(arena, &include, system.items[i], strlen(system.items[i]));
+    }
+
+    search -> quote_dirs = quote.items;
+    search -> quote_count = quote.count;
+    search -> dirs = include.items;
+    search -> dir_count = include.count;
+
+    memo_init(&search -> exists);
+
+    return search;
+}
+
+void search_path_destroy(SearchPath* search) {
+    if (search) {
+        memo_destroy(&search -> exists);
+    }
+}
+
+// The stat runs outside the memo's locks, see memo.h
+int search_path_exists(SearchPath* search, const char* path, size_t len) {
+    uint64_t hash = hash_buffer(path, len);
+
+    const MemoEntry* entry = memo_find(&search -> exists, hash, path, len);
+    if (entry) {
+        return *(const uint8_t*) memo_value(entry);
+    }
+
+    struct stat st;
+    uint8_t exists = stat(path, &st) == 0 && S_ISREG(st.st_mode);
+
+    memo_insert(&search -> exists, hash, path, len, &exists, 1);
+    return exists;
+}
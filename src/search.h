@@ -0,0 +1,34 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "arena.h"
+#include "config.h"
+#include "memo.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Include search path built from the -iquote, -I and -isystem flags in
+// config.cat: default_flags first, then every target in order, with each
+// directory kept once. All targets share one include graph, so a header is
+// looked up in the union of their paths.
+//
+// As in GCC, "x.h" is tried next to the including file, then in the -iquote,
+// -I and -isystem directories. <x.h> only goes through -I and -isystem. Whether
+// a candidate path exists is remembered, so a header missing from the first
+// directories costs one failing stat per directory for the whole run instead of
+// one per include.
+
+typedef struct {
+    const char** quote_dirs;
+    size_t quote_count;
+    const char** dirs;
+    size_t dir_count;
+    MemoTable exists;
+} SearchPath;
+
+SearchPath* search_path_create(Arena* arena, const Config* config);
+void search_path_destroy(SearchPath* search);
+int search_path_exists(SearchPath* search, const char* path, size_t len);
+
+#endif // !SEARCH_H
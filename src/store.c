@@ -0,0 +1,253 @@
+#include "store.h"
+
+#include "arena.h"
+#include "cache.h"
+#include "hash.h"
+#include "hashtable.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Spelling text of a single file, anything larger is not a file we wrote
+#define STORE_MAX_TEXT (16 * 1024 * 1024)
+
+static int make_dir(const char* path) {
+    return mkdir(path, 0755) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+Store* store_open(Arena* arena) {
+    const char* base = getenv("XDG_CACHE_HOME");
+    const char* suffix = "";
+
+    // The spec ignores relative paths
+    if (!base || base[0] != '/') {
+        base = getenv("HOME");
+        suffix = "/.cache";
+
+        if (!base || base[0] != '/') {
+            return NULL;
+        }
+    }
+
+    Store* store = arena_alloc(arena, sizeof(Store));
+    int len = snprintf(store -> root, sizeof(store -> root), "%s%s", base, suffix);
+
+    if (len < 0 || (size_t) len + sizeof("/catalyze") > sizeof(store -> root)) {
+        return NULL;
+    }
+
+    if (make_dir(store -> root) != 0) {
+        return NULL;
+    }
+
+    store -> root_len = len + snprintf(store -> root + len, sizeof(store -> root) - len, "/catalyze");
+    if (make_dir(store -> root) != 0) {
+        return NULL;
+    }
+
+    char dir[PATH_MAX];
+    const char* kinds[] = { "content", "stat" };
+
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        snprintf(dir, sizeof(dir), "%s/%s", store -> root, kinds[i]);
+        if (make_dir(dir) != 0) {
+            return NULL;
+        }
+    }
+
+    return store;
+}
+
+static void entry_path(const Store* store, const char* kind, uint64_t key, char* path) {
+    snprintf(path, PATH_MAX, "%s/%s/%02x/%016" PRIx64, store -> root, kind, (unsigned) (key >> 56), key);
+}
+
+static int read_all(int fd, void* data, size_t len) {
+    char* cursor = data;
+
+    while (len > 0) {
+        ssize_t got = read(fd, cursor, len);
+        if (got <= 0) {
+            return -1;
+        }
+
+        cursor += got;
+        len -= got;
+    }
+
+    return 0;
+}
+
+// Entries are not fsynced, see store.h
+static const AtomicWrite entry_write = { .make_parent = 1 };
+
+int store_find_content(const Store* store, Arena* arena, uint64_t content_hash, const char*** spellings, size_t* count) {
+    char path[PATH_MAX];
+    entry_path(store, "content", content_hash, path);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    StoreContent header;
+    char* text = NULL;
+
+    int found = read_all(fd, &header, sizeof(header)) == 0
+        && header.magic == STORE_MAGIC
+        && header.version == STORE_VERSION
+        && header.content_hash == content_hash
+        && header.header_crc == crc32c(&header, offsetof(StoreContent, header_crc))
+        && header.text_size <= STORE_MAX_TEXT;
+
+    if (found) {
+        text = arena_alloc(arena, header.text_size + 1);
+        found = read_all(fd, text, header.text_size) == 0 && crc32c(text, header.text_size) == header.text_crc;
+    }
+
+    close(fd);
+
+    if (!found) {
+        return -1;
+    }
+
+    const char** list = arena_array(arena, const char*, header.spelling_count ? header.spelling_count : 1);
+    const char* cursor = text;
+    const char* end = text + header.text_size;
+    size_t n = 0;
+
+    while (cursor < end && n < header.spelling_count) {
+        const char* nul = memchr(cursor, 0, end - cursor);
+        if (!nul) {
+            return -1;
+        }
+
+        list[n++] = cursor;
+        cursor = nul + 1;
+    }
+
+    if (n != header.spelling_count || cursor != end) {
+        return -1;
+    }
+
+    *spellings = list;
+    *count = n;
+    return 0;
+}
+
+int store_put_content(const Store* store, uint64_t content_hash, const char* const* spellings, size_t count) {
+    size_t text_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        text_size += strlen(spellings[i]) + 1;
+    }
+
+    if (text_size > STORE_MAX_TEXT) {
+        return -1;
+    }
+
+    char* buffer = malloc(sizeof(StoreContent) + text_size);
+    if (!buffer) {
+        return -1;
+    }
+
+    char* text = buffer + sizeof(StoreContent);
+    char* cursor = text;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(spellings[i]) + 1;
+        memcpy(cursor, spellings[i], len);
+        cursor += len;
+    }
+
+    StoreContent header = {
+        .magic = STORE_MAGIC,
+        .version = STORE_VERSION,
+        .content_hash = content_hash,
+        .spelling_count = (uint32_t) count,
+        .text_size = (uint32_t) text_size,
+        .text_crc = crc32c(text, text_size),
+    };
+    header.header_crc = crc32c(&header, offsetof(StoreContent, header_crc));
+    memcpy(buffer, &header, sizeof(header));
+
+    char path[PATH_MAX];
+    entry_path(store, "content", content_hash, path);
+
+    struct iovec part = { buffer, sizeof(StoreContent) + text_size };
+    int result = write_file_atomic(path, &part, 1, &entry_write);
+
+    free(buffer);
+    return result;
+}
+
+int store_find_stat(const Store* store, const FileStat* st, uint64_t* content_hash) {
+    char path[PATH_MAX];
+    entry_path(store, "stat", hash_buffer(st, sizeof(*st)), path);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    StoreStat entry;
+    int found = read_all(fd, &entry, sizeof(entry)) == 0
+        && entry.magic == STORE_MAGIC
+        && entry.version == STORE_VERSION
+        && entry.header_crc == crc32c(&entry, offsetof(StoreStat, header_crc))
+        && memcmp(&entry.stat, st, sizeof(*st)) == 0
+        && st -> mtime_ns < entry.written_ns;
+
+    close(fd);
+
+    if (!found) {
+        return -1;
+    }
+
+    *content_hash = entry.content_hash;
+    return 0;
+}
+
+// Stamped with the temp file's own mtime, the clock file mtimes come from. A
+// racy entry would never be used, it is dropped instead.
+static int stamp_stat(int fd, void* ctx) {
+    StoreStat* entry = ctx;
+
+    struct stat created;
+    if (fstat(fd, &created) != 0) {
+        return -1;
+    }
+
+    entry -> written_ns = (uint64_t) created.st_mtim.tv_sec * 1000000000ULL + (uint64_t) created.st_mtim.tv_nsec;
+    if (entry -> stat.mtime_ns >= entry -> written_ns) {
+        return 1;
+    }
+
+    entry -> header_crc = crc32c(entry, offsetof(StoreStat, header_crc));
+    return pwrite(fd, entry, sizeof(*entry), 0) == (ssize_t) sizeof(*entry) ? 0 : -1;
+}
+
+int store_put_stat(const Store* store, const FileStat* st, uint64_t content_hash) {
+    char path[PATH_MAX];
+    entry_path(store, "stat", hash_buffer(st, sizeof(*st)), path);
+
+    StoreStat entry = {
+        .magic = STORE_MAGIC,
+        .version = STORE_VERSION,
+        .stat = *st,
+        .content_hash = content_hash,
+    };
+
+    AtomicWrite options = entry_write;
+    options.finish = stamp_stat;
+    options.ctx = &entry;
+
+    return write_file_atomic(path, NULL, 0, &options);
+}
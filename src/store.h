@@ -0,0 +1,70 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "arena.h"
+#include "hashtable.h"
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Optional machine-wide store shared by every checkout on the host, under
+// $XDG_CACHE_HOME/catalyze or ~/.cache/catalyze:
+//
+//   content/<hh>/<content hash>     StoreContent, then NUL terminated spellings
+//   stat/<hh>/<stat key>            StoreStat, the content hash of a FileStat
+//
+// <hh> is the top byte of the hex name. Every entry is its own file, written
+// to a unique temp name and renamed into place, so concurrent processes never
+// see a partial entry and the last writer of identical data wins. Entries are
+// not fsynced, one torn by a crash fails its CRC and is treated as a miss.
+//
+// Spellings are in the catalyze.cache format and are resolved against the path
+// of the file being scanned, so one entry serves every copy of the same bytes.
+// A stat entry is keyed by the whole FileStat, device, inode, size and mtime,
+// so it only holds for the very same inode: a checkout reached through another
+// path, a bind mount or hardlinked copies. It saves the read and the hash
+// there. A fresh clone, worktree or CI checkout has new inodes and mtimes and
+// never hits it, its files are still read and hashed and only the content
+// entries are shared. A stat entry is written only when the lookup missed.
+// Like the cache, a stat entry not older than the file's mtime is racy and
+// ignored. Nothing is evicted, removing the directory is always safe.
+
+#define STORE_MAGIC 0x53544143 // "CATS"
+#define STORE_VERSION 3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t content_hash;
+    uint32_t spelling_count;
+    uint32_t text_size;
+    uint32_t text_crc;
+    uint32_t header_crc;
+} StoreContent;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    FileStat stat;
+    uint64_t content_hash;
+    uint64_t written_ns;
+    uint32_t reserved;
+    uint32_t header_crc;
+} StoreStat;
+
+// Leaves room for the entry and temp names below the root
+typedef struct {
+    char root[PATH_MAX - 128];
+    size_t root_len;
+} Store;
+
+Store* store_open(Arena* arena);
+
+int store_find_content(const Store* store, Arena* arena, uint64_t content_hash, const char*** spellings, size_t* count);
+int store_put_content(const Store* store, uint64_t content_hash, const char* const* spellings, size_t count);
+
+int store_find_stat(const Store* store, const FileStat* st, uint64_t* content_hash);
+int store_put_stat(const Store* store, const FileStat* st, uint64_t content_hash);
+
+#endif // !STORE_H
@@ -0,0 +1,216 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static int ring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int ring_register(int fd, unsigned opcode, const void* arg, unsigned count) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static void* map_ring(int fd, size_t size, uint64_t offset) {
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, (off_t) offset);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+static int register_buffers(Uring* ring) {
+    struct iovec iovecs[ring -> buffer_count];
+
+    for (unsigned i = 0; i < ring -> buffer_count; i++) {
+        iovecs[i].iov_base = uring_buffer(ring, i);
+        iovecs[i].iov_len = ring -> buffer_size;
+    }
+
+    return ring_register(ring -> fd, IORING_REGISTER_BUFFERS, iovecs, ring -> buffer_count);
+}
+
+int uring_init(Uring* ring, unsigned entries, unsigned buffer_count, size_t buffer_size) {
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring -> fd = ring_setup(entries, &params);
+    if (ring -> fd < 0) {
+        ring -> fd = -1;
+        return -1;
+    }
+
+    ring -> sq_entries = params.sq_entries;
+    ring -> cq_entries = params.cq_entries;
+    ring -> sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring -> cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // One mapping holds both rings on kernels since 5.4
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring -> cq_ring_size > ring -> sq_ring_size) {
+            ring -> sq_ring_size = ring -> cq_ring_size;
+        }
+
+        ring -> sq_ring = map_ring(ring -> fd, ring -> sq_ring_size, IORING_OFF_SQ_RING);
+        ring -> cq_ring = ring -> sq_ring;
+    } else {
+        ring -> sq_ring = map_ring(ring -> fd, ring -> sq_ring_size, IORING_OFF_SQ_RING);
+        ring -> cq_ring = map_ring(ring -> fd, ring -> cq_ring_size, IORING_OFF_CQ_RING);
+    }
+
+    ring -> sqes = map_ring(ring -> fd, params.sq_entries * sizeof(struct io_uring_sqe), IORING_OFF_SQES);
+    ring -> stash = malloc(params.cq_entries * sizeof(struct io_uring_cqe));
+
+    if (!ring -> sq_ring || !ring -> cq_ring || !ring -> sqes || !ring -> stash) {
+        uring_destroy(ring);
+        return -1;
+    }
+
+    char* sq = ring -> sq_ring;
+    char* cq = ring -> cq_ring;
+
+    ring -> sq_head_ptr = (unsigned*) (sq + params.sq_off.head);
+    ring -> sq_tail_ptr = (unsigned*) (sq + params.sq_off.tail);
+    ring -> sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring -> sq_array = (unsigned*) (sq + params.sq_off.array);
+    ring -> cq_head_ptr = (unsigned*) (cq + params.cq_off.head);
+    ring -> cq_tail_ptr = (unsigned*) (cq + params.cq_off.tail);
+    ring -> cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring -> cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    ring -> sq_tail = *ring -> sq_tail_ptr;
+
+    if (buffer_count > 0) {
+        ring -> buffers = mmap(NULL, (size_t) buffer_count * buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring -> buffers == MAP_FAILED) {
+            ring -> buffers = NULL;
+            uring_destroy(ring);
+            return -1;
+        }
+
+        ring -> buffer_size = buffer_size;
+        ring -> buffer_count = buffer_count;
+        ring -> registered = register_buffers(ring) == 0;
+    }
+
+    return 0;
+}
+
+void uring_destroy(Uring* ring) {
+    if (ring -> buffers) {
+        munmap(ring -> buffers, (size_t) ring -> buffer_count * ring -> buffer_size);
+    }
+
+    if (ring -> sqes) {
+        munmap(ring -> sqes, ring -> sq_entries * sizeof(struct io_uring_sqe));
+    }
+
+    if (ring -> cq_ring && ring -> cq_ring != ring -> sq_ring) {
+        munmap(ring -> cq_ring, ring -> cq_ring_size);
+    }
+
+    if (ring -> sq_ring) {
+        munmap(ring -> sq_ring, ring -> sq_ring_size);
+    }
+
+    if (ring -> fd >= 0) {
+        close(ring -> fd);
+    }
+
+    free(ring -> stash);
+    memset(ring, 0, sizeof(*ring));
+    ring -> fd = -1;
+}
+
+// A zeroed entry, NULL when every slot is queued and not yet consumed
+struct io_uring_sqe* uring_sqe(Uring* ring) {
+    unsigned head = __atomic_load_n(ring -> sq_head_ptr, __ATOMIC_ACQUIRE);
+    if (ring -> sq_tail - head >= ring -> sq_entries) {
+        return NULL;
+    }
+
+    unsigned index = ring -> sq_tail & *ring -> sq_mask;
+    struct io_uring_sqe* sqe = &ring -> sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring -> sq_array[index] = index;
+    ring -> sq_tail++;
+
+    return sqe;
+}
+
+// Moves the completions already posted into the stash, making room for the
+// ones the kernel holds back. Fails when the stash has no room left.
+static int drain(Uring* ring) {
+    unsigned head = *ring -> cq_head_ptr;
+    unsigned tail = __atomic_load_n(ring -> cq_tail_ptr, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        if (ring -> stash_count == ring -> cq_entries) {
+            __atomic_store_n(ring -> cq_head_ptr, head, __ATOMIC_RELEASE);
+            return -1;
+        }
+
+        ring -> stash[(ring -> stash_head + ring -> stash_count++) % ring -> cq_entries] = ring -> cqes[head & *ring -> cq_mask];
+    }
+
+    __atomic_store_n(ring -> cq_head_ptr, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Hands every queued entry to the kernel. EBUSY and EAGAIN mean completions
+// have to be reaped first: the posted ones are drained and a GETEVENTS enter
+// lets the kernel post those it held back before trying again.
+int uring_submit(Uring* ring) {
+    __atomic_store_n(ring -> sq_tail_ptr, ring -> sq_tail, __ATOMIC_RELEASE);
+
+    for (;;) {
+        unsigned pending = ring -> sq_tail - __atomic_load_n(ring -> sq_head_ptr, __ATOMIC_ACQUIRE);
+        if (pending == 0) {
+            return 0;
+        }
+
+        if (ring_enter(ring -> fd, pending, 0, 0) >= 0 || errno == EINTR) {
+            continue;
+        }
+
+        if ((errno != EAGAIN && errno != EBUSY) || drain(ring) != 0) {
+            ring -> failed = 1;
+            return -1;
+        }
+
+        ring_enter(ring -> fd, 0, 0, IORING_ENTER_GETEVENTS);
+    }
+}
+
+// Copies out the next completion, blocking until there is one
+int uring_wait(Uring* ring, struct io_uring_cqe* cqe) {
+    if (ring -> stash_count > 0) {
+        *cqe = ring -> stash[ring -> stash_head];
+        ring -> stash_head = (ring -> stash_head + 1) % ring -> cq_entries;
+        ring -> stash_count--;
+        return 0;
+    }
+
+    for (;;) {
+        unsigned head = *ring -> cq_head_ptr;
+
+        if (head != __atomic_load_n(ring -> cq_tail_ptr, __ATOMIC_ACQUIRE)) {
+            *cqe = ring -> cqes[head & *ring -> cq_mask];
+            __atomic_store_n(ring -> cq_head_ptr, head + 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+
+        if (ring_enter(ring -> fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            ring -> failed = 1;
+            return -1;
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A bare io_uring over the raw syscalls, one per worker thread, with a pool
+// of buffers registered for IORING_OP_READ_FIXED. When the kernel refuses the
+// registration the buffers are still used, with plain IORING_OP_READ.
+// uring_init fails when io_uring is missing or disabled, callers then keep to
+// blocking syscalls. A submit or wait that fails sets failed: entries may still
+// be in flight with no completion coming for them, the ring is not used again.
+// A submit the kernel turns away while the completion queue is backed up moves
+// the completions into stash, where uring_wait takes them from first.
+
+typedef struct {
+    int fd;
+    unsigned sq_entries;
+    unsigned sq_tail;
+    unsigned* sq_head_ptr;
+    unsigned* sq_tail_ptr;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head_ptr;
+    unsigned* cq_tail_ptr;
+    unsigned* cq_mask;
+    unsigned cq_entries;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    struct io_uring_cqe* stash;
+    unsigned stash_head;
+    unsigned stash_count;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+
+    char* buffers;
+    size_t buffer_size;
+    unsigned buffer_count;
+    int registered;
+    int failed;
+} Uring;
+
+int uring_init(Uring* ring, unsigned entries, unsigned buffer_count, size_t buffer_size);
+void uring_destroy(Uring* ring);
+
+struct io_uring_sqe* uring_sqe(Uring* ring);
+int uring_submit(Uring* ring);
+int uring_wait(Uring* ring, struct io_uring_cqe* cqe);
+
+// Whether the kernel took the entry queued when sq_tail was position
+static inline int uring_consumed(const Uring* ring, unsigned position) {
+    return (int) (__atomic_load_n(ring -> sq_head_ptr, __ATOMIC_ACQUIRE) - position) > 0;
+}
+
+static inline char* uring_buffer(const Uring* ring, unsigned index) {
+    return ring -> buffers + (size_t) index * ring -> buffer_size;
+}
+
+#endif // !URING_H
@@ -0,0 +1,30 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// A failed CHECK reports where and carries on, each suite runs to the end and
+// test_main counts what failed
+
+extern int test_failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+void test_hash(void);
+void test_cache(void);
+void test_graph(void);
+void test_lex(void);
+void test_cond(void);
+void test_pool(void);
+void test_table(void);
+void test_store(void);
+void test_path(void);
+void test_arena(void);
+void test_scan(void);
+
+#endif // !TEST_H
@@ -0,0 +1,322 @@
+#include "test.h"
+
+#include "arena.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static int all_bytes(const char* ptr, int value, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (ptr[i] != (char) value) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// The last allocation grows where it is, anything else is copied, and the
+// grown part is zero either way
+static void check_realloc(void) {
+    Arena arena = {0};
+
+    char* first = arena_alloc(&arena, 24);
+    memset(first, 'x', 24);
+
+    char* grown = arena_realloc(&arena, first, 24, 100);
+    CHECK(grown == first);
+    CHECK(all_bytes(grown, 'x', 24) && all_bytes(grown + 24, 0, 76));
+    CHECK(total_usage(&arena) == align_size(100));
+
+    CHECK(arena_realloc(&arena, grown, 100, 10) == grown);
+
+    char* after = arena_alloc(&arena, 8);
+    char* moved = arena_realloc(&arena, grown, 100, 200);
+    CHECK(moved != grown && moved == after + 8);
+    CHECK(all_bytes(moved, 'x', 24) && all_bytes(moved + 24, 0, 176));
+
+    // The copy left the old bytes behind
+    CHECK(total_usage(&arena) == align_size(100) + 8 + align_size(200));
+
+    char* fresh = arena_realloc(&arena, NULL, 0, 16);
+    CHECK(fresh != NULL && all_bytes(fresh, 0, 16));
+
+    // The last allocation of a block that has no room left moves to the next one
+    ArenaBlock* block = arena.end;
+    size_t room = block -> capacity - block -> usage;
+    char* tail = arena_alloc(&arena, room);
+    memset(tail, 'y', room);
+
+    char* spilled = arena_realloc(&arena, tail, room, room + 64);
+    CHECK(spilled != tail && arena.end != block);
+    CHECK(all_bytes(spilled, 'y', room) && all_bytes(spilled + room, 0, 64));
+
+    arena_free(&arena);
+}
+
+static void check_aligned(void) {
+    Arena arena = {0};
+
+    arena_alloc(&arena, 8);
+    for (size_t alignment = 16; alignment <= 128; alignment *= 2) {
+        uintptr_t at = (uintptr_t) arena_alloc_aligned(&arena, 10, alignment);
+        CHECK(at % alignment == 0);
+        arena_alloc(&arena, 8);
+    }
+
+    // With the padding past the end of the block the allocation is rounded
+    // up inside the next one
+    ArenaBlock* block = arena.end;
+    arena_alloc(&arena, block -> capacity - block -> usage - 8);
+
+    char* row = arena_alloc_aligned(&arena, 256, 64);
+    CHECK((uintptr_t) row % 64 == 0);
+    CHECK(arena.end != block);
+    CHECK(row >= (char*) arena.end -> data && row + 256 <= (char*) arena.end -> data + arena.end -> usage);
+
+    // Reused memory comes back zeroed through arena_array_zero
+    arena_reset(&arena);
+    memset(arena_alloc(&arena, 64), 0xFF, 64);
+    arena_reset(&arena);
+
+    uint64_t* words = arena_array_zero(&arena, uint64_t, 8);
+    CHECK(all_bytes((const char*) words, 0, 64));
+
+    arena_free(&arena);
+}
+
+// Every block is at least twice the one before it, a request larger than
+// that gets a block of its own size, and after arena_reset the same requests
+// are served from the same blocks without mapping any more
+static void check_growth(void) {
+    Arena arena = {0};
+    CHECK(total_capacity(&arena) == 0 && total_usage(&arena) == 0);
+
+    for (size_t i = 0; i < 64; i++) {
+        arena_alloc(&arena, 4096);
+    }
+
+    CHECK(arena.start -> capacity >= DEFAULT_CAPACITY * sizeof(uintptr_t));
+
+    size_t blocks = 0;
+    for (ArenaBlock* block = arena.start; block != NULL; block = block -> next) {
+        if (block -> next) {
+            CHECK(block -> next -> capacity >= 2 * block -> capacity);
+        }
+        blocks++;
+    }
+
+    CHECK(blocks >= 3 && blocks < 8);
+    CHECK(arena.end -> next == NULL);
+
+    size_t capacity = total_capacity(&arena);
+    ArenaBlock* last = arena.end;
+
+    arena_reset(&arena);
+    CHECK(total_usage(&arena) == 0 && arena.end == arena.start);
+    CHECK((char*) arena_alloc(&arena, 4096) == (char*) arena.start -> data);
+
+    for (size_t i = 1; i < 64; i++) {
+        arena_alloc(&arena, 4096);
+    }
+
+    CHECK(total_capacity(&arena) == capacity);
+    CHECK(arena.end == last);
+    CHECK(total_usage(&arena) == 64 * 4096);
+
+    // Too big for any kept block, a new one goes in after the current block
+    size_t huge = 4 * capacity;
+    char* big = arena_alloc(&arena, huge);
+    CHECK(arena.end -> capacity >= huge && big == (char*) arena.end -> data);
+    CHECK(total_capacity(&arena) >= capacity + huge);
+
+    arena_free(&arena);
+    CHECK(arena.start == NULL && arena.end == NULL);
+}
+
+// Takes count allocations of size bytes and returns how many blocks the
+// arena has after them
+static size_t fill(Arena* arena, size_t count, size_t size) {
+    for (size_t i = 0; i < count; i++) {
+        memset(arena_alloc(arena, size), 'z', size);
+    }
+
+    size_t blocks = 0;
+    for (ArenaBlock* block = arena -> start; block != NULL; block = block -> next) {
+        blocks++;
+    }
+
+    return blocks;
+}
+
+// Rewinding past block boundaries empties every block taken since the mark
+// and keeps it, the next allocation lands right where the mark stood and
+// what came before the mark is untouched
+static void check_rewind(void) {
+    Arena arena = {0};
+
+    // A mark of an empty arena rewinds to its first block
+    ArenaMark empty = arena_mark(&arena);
+    arena_rewind(&arena, empty);
+    CHECK(arena.start == NULL && arena.end == NULL);
+
+    fill(&arena, 3, 4096);
+    arena_rewind(&arena, empty);
+    CHECK(total_usage(&arena) == 0 && arena.end == arena.start);
+
+    char* kept = arena_alloc(&arena, 100);
+    memset(kept, 'k', 100);
+
+    ArenaMark outer = arena_mark(&arena);
+    size_t outer_usage = total_usage(&arena);
+    CHECK(outer.block == arena.start && outer.usage == align_size(100));
+
+    size_t blocks = fill(&arena, 8, 4096);
+    CHECK(blocks >= 2 && arena.end != outer.block);
+
+    ArenaMark inner = arena_mark(&arena);
+    size_t inner_usage = total_usage(&arena);
+    ArenaBlock* inner_block = arena.end;
+
+    CHECK(fill(&arena, 32, 4096) > blocks);
+    size_t capacity = total_capacity(&arena);
+
+    arena_rewind(&arena, inner);
+    CHECK(arena.end == inner_block);
+    CHECK(total_usage(&arena) == inner_usage);
+    CHECK(total_capacity(&arena) == capacity);
+
+    arena_rewind(&arena, outer);
+    CHECK(arena.end == outer.block);
+    CHECK(total_usage(&arena) == outer_usage);
+    CHECK(all_bytes(kept, 'k', 100));
+    CHECK((char*) arena_alloc(&arena, 8) == kept + align_size(100));
+
+    // The same work again maps nothing new
+    fill(&arena, 40, 4096);
+    CHECK(total_capacity(&arena) == capacity);
+
+    // One scope after another, as per file scratch is used, maps blocks for
+    // the first and none after it
+    ArenaMark scope = arena_mark(&arena);
+    for (size_t i = 0; i < 16; i++) {
+        fill(&arena, 12, 4096);
+        arena_rewind(&arena, scope);
+        CHECK(arena.end == scope.block && arena.end -> usage == scope.usage);
+
+        if (i == 0) {
+            capacity = total_capacity(&arena);
+        }
+    }
+    CHECK(total_capacity(&arena) == capacity);
+
+    arena_free(&arena);
+}
+
+// total_usage counts what was asked for, aligned, and not the tail a block
+// was left with when the next allocation did not fit in it
+static void check_usage(void) {
+    Arena arena = {0};
+
+    arena_alloc(&arena, 13);
+    size_t asked = align_size(13);
+
+    size_t room = arena.end -> capacity - arena.end -> usage;
+    arena_alloc(&arena, room + 8);
+    asked += room + 8;
+
+    CHECK(total_usage(&arena) == asked);
+    CHECK(total_capacity(&arena) - total_usage(&arena) == room + arena.end -> capacity - arena.end -> usage);
+
+    arena_free(&arena);
+}
+
+#ifdef ARENA_STATS
+
+typedef struct {
+    uint64_t live;
+    uint64_t blocks;
+    uint64_t abandoned;
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t site_abandoned;
+} Snapshot;
+
+// The counters as arena_stats_write has them, with every site in this file
+// added together
+static Snapshot snapshot(void) {
+    Snapshot shot = {0};
+    FILE* file = tmpfile();
+    if (!file) {
+        return shot;
+    }
+
+    arena_stats_write(file);
+    rewind(file);
+
+    const char* prefix = __FILE__ ":";
+    size_t prefix_len = strlen(prefix);
+
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        uint64_t count, bytes, abandoned;
+
+        sscanf(line, "blocks\t%" SCNu64, &shot.live);
+        sscanf(line, "block_count\t%" SCNu64, &shot.blocks);
+        sscanf(line, "abandoned\t%" SCNu64, &shot.abandoned);
+
+        char* tag = line + 5;
+        if (strncmp(line, "site\t", 5) == 0 && strncmp(tag, prefix, prefix_len) == 0) {
+            char* fields = strchr(tag, '\t');
+            if (fields && sscanf(fields, "\t%" SCNu64 "\t%" SCNu64 "\t%" SCNu64, &count, &bytes, &abandoned) == 3) {
+                shot.count += count;
+                shot.bytes += bytes;
+                shot.site_abandoned += abandoned;
+            }
+        }
+    }
+
+    fclose(file);
+    return shot;
+}
+
+// Allocations are counted under their call sites, a realloc that grew in
+// place adds what it grew by and one that copied abandons the old size
+static void check_stats(void) {
+    Snapshot before = snapshot();
+    Arena arena = {0};
+
+    char* row = arena_alloc(&arena, 24);
+    row = arena_realloc(&arena, row, 24, 100);
+    arena_alloc(&arena, 8);
+    arena_realloc(&arena, row, 100, 200);
+    arena_alloc(&arena, 2 * arena.end -> capacity);
+
+    Snapshot after = snapshot();
+    CHECK(after.count - before.count == 5);
+    CHECK(after.bytes - before.bytes == 24 + 76 + 8 + 200 + 2 * arena.start -> capacity);
+    CHECK(after.abandoned - before.abandoned == 100);
+    CHECK(after.site_abandoned - before.site_abandoned == 100);
+    CHECK(after.blocks - before.blocks == 2);
+    CHECK(after.live - before.live == 2);
+
+    arena_free(&arena);
+    CHECK(snapshot().live == before.live);
+}
+
+#endif // ARENA_STATS
+
+void test_arena(void) {
+    check_realloc();
+    check_aligned();
+    check_growth();
+    check_rewind();
+    check_usage();
+
+#ifdef ARENA_STATS
+    check_stats();
+#endif
+}
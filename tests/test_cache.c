@@ -0,0 +1,241 @@
+#include "test.h"
+
+#include "arena.h"
+#include "cache.h"
+#include "hashtable.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A table as a scan leaves it: two sources, one header they include and one
+// node nothing reaches, which cache_write drops
+static HashTable* build_table(Arena* arena) {
+    HashTable* ht = create_hashtable(arena, 16);
+    if (!ht) {
+        return NULL;
+    }
+
+    FileId a = intern_path(ht, "src/a.c");
+    FileId x = intern_path(ht, "src/x.h");
+    FileId unused = intern_path(ht, "src/unused.h");
+    FileId b = intern_path(ht, "src/b.c");
+
+    if (a != 0 || x != 1 || unused != 2 || b != 3) {
+        return NULL;
+    }
+
+    static const char* const a_spellings[] = { "#ifdef A", "\"x.h", "#endif" };
+    Node* node = ht_node(ht, a);
+    node -> discovered = 1;
+    node -> scanned = 1;
+    node -> content_hash = 0x1111;
+    node -> stat = (FileStat) { .mtime_ns = 1000, .size = 10, .ino = 7, .dev = 3 };
+
+    if (set_spellings(ht, node, a_spellings, 3) != 0 || add_dependency(ht, a, x, VARIANTS_ALL) != 0) {
+        return NULL;
+    }
+
+    // Written after the cache, so its stat is racy
+    node = ht_node(ht, x);
+    node -> scanned = 1;
+    node -> content_hash = 0x2222;
+    node -> stat = (FileStat) { .mtime_ns = UINT64_MAX, .size = 20, .ino = 8, .dev = 3 };
+
+    ht_node(ht, unused) -> scanned = 1;
+    ht_node(ht, b) -> discovered = 1;
+
+    return ht;
+}
+
+static void check_round_trip(const char* path) {
+    Arena arena = {0};
+    HashTable* ht = build_table(&arena);
+    CHECK(ht != NULL);
+    if (!ht) {
+        return;
+    }
+
+    CHECK(cache_write(ht, 0xABCD, path, NULL) == 0);
+
+    CachedFiles* cache = cache_load(&arena, path);
+    CHECK(cache != NULL);
+    if (!cache) {
+        arena_free(&arena);
+        return;
+    }
+
+    CHECK(cache -> header -> conditions_hash == 0xABCD);
+    CHECK(cache -> header -> record_count == 3);
+    CHECK(cache -> header -> edge_count == 1);
+
+    const CacheRecord* a = cache_record(cache, 0);
+    const CacheRecord* x = cache_record(cache, 1);
+    const CacheRecord* b = cache_record(cache, 2);
+    CHECK(cache_record(cache, 3) == NULL);
+
+    CHECK(strcmp(cache_record_path(cache, a), "src/a.c") == 0);
+    CHECK(strcmp(cache_record_path(cache, x), "src/x.h") == 0);
+    CHECK(strcmp(cache_record_path(cache, b), "src/b.c") == 0);
+
+    CHECK(a -> content_hash == 0x1111);
+    CHECK(cache_record_dependency(cache, a, 0) == x);
+    CHECK(cache_record_dependency(cache, a, 1) == NULL);
+    CHECK(x -> edge_count == 0);
+
+    CHECK(a -> spelling_count == 3);
+    CHECK(strcmp(cache_record_spelling(cache, a, 0), "#ifdef A") == 0);
+    CHECK(strcmp(cache_record_spelling(cache, a, 1), "\"x.h") == 0);
+    CHECK(strcmp(cache_record_spelling(cache, a, 2), "#endif") == 0);
+    CHECK(cache_record_spelling(cache, a, 3) == NULL);
+
+    // Only scanned records are found by content
+    CHECK(cache -> header -> content_count == 2);
+    CHECK(cache_find_content(cache, 0x1111) == a);
+    CHECK(cache_find_content(cache, 0x2222) == x);
+    CHECK(cache_find_content(cache, 0x3333) == NULL);
+
+    FileStat a_stat = { .mtime_ns = 1000, .size = 10, .ino = 7, .dev = 3 };
+    FileStat a_touched = { .mtime_ns = 1001, .size = 10, .ino = 7, .dev = 3 };
+    FileStat x_stat = { .mtime_ns = UINT64_MAX, .size = 20, .ino = 8, .dev = 3 };
+    CHECK(cache_stat_matches(cache, a, &a_stat));
+    CHECK(!cache_stat_matches(cache, a, &a_touched));
+    CHECK(!cache_stat_matches(cache, x, &x_stat));
+
+    // Interned first, every record lands on its own index as FileId
+    HashTable* fresh = create_hashtable(&arena, 16);
+    CHECK(fresh && cache_intern(fresh, cache) == 0);
+    CHECK(fresh && get_ht(fresh, "src/b.c") && get_ht(fresh, "src/b.c") -> id == 2);
+    CHECK(fresh && get_ht(fresh, "src/unused.h") == NULL);
+
+    cache_unload(cache);
+    arena_free(&arena);
+}
+
+static int write_bytes(const char* path, const char* data, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    int ok = write(fd, data, size) == (ssize_t) size;
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+static int loads(const char* path) {
+    Arena arena = {0};
+    CachedFiles* cache = cache_load(&arena, path);
+    int loaded = cache != NULL;
+
+    cache_unload(cache);
+    arena_free(&arena);
+    return loaded;
+}
+
+// Nothing but the cache itself is left in dir, the temp file was renamed
+static int only_cache_in(const char* dir) {
+    DIR* listing = opendir(dir);
+    if (!listing) {
+        return 0;
+    }
+
+    int others = 0;
+    struct dirent* entry;
+    while ((entry = readdir(listing)) != NULL) {
+        others += strcmp(entry -> d_name, ".") != 0 && strcmp(entry -> d_name, "..") != 0 && strcmp(entry -> d_name, "catalyze.cache") != 0;
+    }
+
+    closedir(listing);
+    return others == 0;
+}
+
+// One flipped byte in any section, or a cut short file, and the cache is
+// ignored as a whole
+static void check_corruption(const char* dir, const char* path) {
+    Arena arena = {0};
+    HashTable* ht = build_table(&arena);
+    CHECK(ht && cache_write(ht, 0xABCD, path, NULL) == 0);
+    CHECK(only_cache_in(dir));
+    arena_free(&arena);
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        CHECK(!"stat");
+        return;
+    }
+
+    size_t size = (size_t) st.st_size;
+    char* original = malloc(size);
+    char* copy = malloc(size);
+    int fd = open(path, O_RDONLY);
+
+    CHECK(original && copy && fd != -1 && read(fd, original, size) == (ssize_t) size);
+    if (fd != -1) {
+        close(fd);
+    }
+
+    const CacheHeader* header = (const CacheHeader*) original;
+    uint64_t sections[] = {
+        offsetof(CacheHeader, conditions_hash),
+        header -> records_offset,
+        header -> edges_offset,
+        header -> strings_offset,
+        header -> spellings_offset,
+        header -> spelling_text_offset,
+        header -> content_offset,
+    };
+
+    CHECK(loads(path));
+
+    for (size_t i = 0; i < sizeof(sections) / sizeof(sections[0]); i++) {
+        memcpy(copy, original, size);
+        copy[sections[i]] ^= 0x40;
+
+        CHECK(write_bytes(path, copy, size) == 0);
+        if (loads(path)) {
+            fprintf(stderr, "cache: flipped byte at %" PRIu64 " was not caught\n", sections[i]);
+            CHECK(!"corrupt cache loaded");
+        }
+    }
+
+    CHECK(write_bytes(path, original, size - 1) == 0);
+    CHECK(!loads(path));
+
+    CHECK(write_bytes(path, original, sizeof(CacheHeader) - 1) == 0);
+    CHECK(!loads(path));
+
+    CHECK(write_bytes(path, original, size) == 0);
+    CHECK(loads(path));
+
+    free(original);
+    free(copy);
+}
+
+void test_cache(void) {
+    char dir[] = "/tmp/catalyze-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+
+    char path[sizeof(dir) + 32];
+    snprintf(path, sizeof(path), "%s/catalyze.cache", dir);
+
+    Arena arena = {0};
+    CHECK(cache_load(&arena, path) == NULL);
+    arena_free(&arena);
+
+    check_round_trip(path);
+    check_corruption(dir, path);
+
+    unlink(path);
+    rmdir(dir);
+}
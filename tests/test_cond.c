@@ -0,0 +1,167 @@
+#include "test.h"
+
+#include "arena.h"
+#include "cond.h"
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Variant bits, in the order the targets below first produce them
+#define V_TRACE 1  // LEVEL=2 DEBUG TRACE=1
+#define V_PLAIN 2  // LEVEL=2
+#define V_HIGH 4   // LEVEL=3 DEBUG, TRACE undefined by -U
+#define V_ALL 7
+
+static Target targets[] = {
+    { .name = "trace", .flags = "-DDEBUG -D TRACE=1" },
+    { .name = "plain", .flags = "-O3" },
+    { .name = "high", .flags = "-DDEBUG -UTRACE -DLEVEL=3" },
+    { .name = "again", .flags = "-DTRACE=1 -DDEBUG" },
+};
+
+static Config config = {
+    .default_flags = "-Wall -DLEVEL=2",
+    .targets = targets,
+    .target_count = 4,
+};
+
+// The variants that may compile what follows the records, given in order and
+// ending with NULL
+static uint64_t active(const Conditions* conditions, ...) {
+    CondStack stack;
+    cond_begin(&stack, conditions);
+
+    va_list records;
+    va_start(records, conditions);
+
+    const char* record;
+    while ((record = va_arg(records, const char*)) != NULL) {
+        cond_apply(&stack, record);
+    }
+
+    va_end(records);
+    return cond_active(&stack);
+}
+
+#define ACTIVE(...) active(conditions, __VA_ARGS__, NULL)
+
+static void check_variants(const Conditions* conditions) {
+    CHECK(conditions -> variant_count == 3);
+    CHECK(conditions -> all == V_ALL);
+    CHECK(conditions -> target_variants[0] == V_TRACE);
+    CHECK(conditions -> target_variants[1] == V_PLAIN);
+    CHECK(conditions -> target_variants[2] == V_HIGH);
+    CHECK(conditions -> target_variants[3] == V_TRACE);
+}
+
+static void check_expressions(const Conditions* conditions) {
+    CHECK(ACTIVE("#ifdef DEBUG") == (V_TRACE | V_HIGH));
+    CHECK(ACTIVE("#ifndef DEBUG") == V_PLAIN);
+    CHECK(ACTIVE("#ifdef TRACE") == V_TRACE);
+    CHECK(ACTIVE("#if TRACE") == V_TRACE);
+    CHECK(ACTIVE("#if LEVEL >= 3") == V_HIGH);
+    CHECK(ACTIVE("#if LEVEL == 2 && defined(TRACE)") == V_TRACE);
+    CHECK(ACTIVE("#if defined DEBUG || LEVEL > 2") == (V_TRACE | V_HIGH));
+    CHECK(ACTIVE("#if !defined(TRACE)") == (V_PLAIN | V_HIGH));
+    CHECK(ACTIVE("#if (LEVEL + 1) * 2 == 8") == V_HIGH);
+    CHECK(ACTIVE("#if LEVEL == 2 ? 1 : 0") == (V_TRACE | V_PLAIN));
+    CHECK(ACTIVE("#if 0x10 >> 4 == 1 && -1 < 0") == V_ALL);
+    CHECK(ACTIVE("#if 0") == 0);
+}
+
+// What the flags do not decide is kept, unless the other side of && or ||
+// decides on its own
+static void check_unknown(const Conditions* conditions) {
+    CHECK(ACTIVE("#if UNCONFIGURED") == V_ALL);
+    CHECK(ACTIVE("#ifdef UNCONFIGURED") == V_ALL);
+    CHECK(ACTIVE("#if MACRO(1)") == V_ALL);
+    CHECK(ACTIVE("#if UNCONFIGURED && 0") == 0);
+    CHECK(ACTIVE("#if UNCONFIGURED && DEBUG") == (V_TRACE | V_HIGH));
+    CHECK(ACTIVE("#if UNCONFIGURED || DEBUG") == V_ALL);
+    CHECK(ACTIVE("#if LEVEL ==") == V_ALL);
+}
+
+static void check_branches(const Conditions* conditions) {
+    CHECK(ACTIVE("#if LEVEL == 3", "#elif defined(TRACE)") == V_TRACE);
+    CHECK(ACTIVE("#if LEVEL == 3", "#elif defined(TRACE)", "#else") == V_PLAIN);
+    CHECK(ACTIVE("#if 0", "#elifdef DEBUG") == (V_TRACE | V_HIGH));
+    CHECK(ACTIVE("#if 0", "#elifndef DEBUG") == V_PLAIN);
+    CHECK(ACTIVE("#if 1", "#else") == 0);
+
+    // A branch that may or may not be taken leaves the later ones in, until
+    // one of them is surely taken
+    CHECK(ACTIVE("#if UNCONFIGURED", "#else") == V_ALL);
+    CHECK(ACTIVE("#if UNCONFIGURED", "#elif DEBUG") == (V_TRACE | V_HIGH));
+    CHECK(ACTIVE("#if UNCONFIGURED", "#elif DEBUG", "#else") == V_PLAIN);
+
+    CHECK(ACTIVE("#ifdef DEBUG", "#if LEVEL == 2") == V_TRACE);
+    CHECK(ACTIVE("#ifdef DEBUG", "#if LEVEL == 2", "#else") == V_HIGH);
+    CHECK(ACTIVE("#ifdef DEBUG", "#if LEVEL == 2", "#endif") == (V_TRACE | V_HIGH));
+    CHECK(ACTIVE("#ifdef DEBUG", "#if LEVEL == 2", "#endif", "#endif") == V_ALL);
+
+    // Stray branches and closes outside any conditional change nothing
+    CHECK(ACTIVE("#else", "#endif", "#elif 0") == V_ALL);
+}
+
+// Levels past COND_MAX_DEPTH keep every branch and still pair their #endif
+static void check_depth(const Conditions* conditions) {
+    CondStack stack;
+    cond_begin(&stack, conditions);
+
+    cond_apply(&stack, "#ifdef DEBUG");
+    for (size_t i = 0; i < COND_MAX_DEPTH + 2; i++) {
+        cond_apply(&stack, "#if 1");
+    }
+
+    cond_apply(&stack, "#else");
+    CHECK(cond_active(&stack) == (V_TRACE | V_HIGH));
+
+    for (size_t i = 0; i < COND_MAX_DEPTH + 2; i++) {
+        cond_apply(&stack, "#endif");
+    }
+
+    CHECK(cond_active(&stack) == (V_TRACE | V_HIGH));
+    cond_apply(&stack, "#endif");
+    CHECK(cond_active(&stack) == V_ALL);
+}
+
+static void check_hash(Arena* arena, const Conditions* conditions) {
+    Conditions* same = conditions_create(arena, &config);
+    CHECK(same && same -> hash == conditions -> hash);
+
+    Config changed = config;
+    changed.default_flags = "-Wall -DLEVEL=4";
+
+    Conditions* other = conditions_create(arena, &changed);
+    CHECK(other && other -> hash != conditions -> hash);
+
+    // No targets, the default flags alone are one variant
+    Config bare = { .default_flags = "-DLEVEL=2" };
+    Conditions* single = conditions_create(arena, &bare);
+    CHECK(single && single -> variant_count == 1 && single -> all == 1);
+}
+
+void test_cond(void) {
+    CHECK(cond_kind("ifdef", 5) == COND_OPEN);
+    CHECK(cond_kind("elifndef", 8) == COND_BRANCH);
+    CHECK(cond_kind("endif", 5) == COND_CLOSE);
+    CHECK(cond_kind("include", 7) == COND_NONE);
+
+    Arena arena = {0};
+    Conditions* conditions = conditions_create(&arena, &config);
+    CHECK(conditions != NULL);
+
+    if (conditions) {
+        check_variants(conditions);
+        check_expressions(conditions);
+        check_unknown(conditions);
+        check_branches(conditions);
+        check_depth(conditions);
+        check_hash(&arena, conditions);
+    }
+
+    arena_free(&arena);
+}
@@ -0,0 +1,249 @@
+#include "test.h"
+
+#include "arena.h"
+#include "graph.h"
+#include "hashtable.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// n0 includes n1 twice and n5, the latter only in variant 1
+//
+//     n1 -> n2 -> n3 -> n1    a cycle of three
+//     n3 -> n4, n6 -> n4      n4 is a leaf reached twice
+//     n5 -> n5, n5 -> n6      a file including itself
+//     n8 -> n9 -> n10 -> n8   a cycle with a chord n9 -> n8
+//     n7                      on its own
+static const struct { FileId from; FileId to; uint64_t variants; } edges[] = {
+    { 0, 1, VARIANTS_ALL }, { 0, 1, VARIANTS_ALL }, { 0, 5, 2 },
+    { 1, 2, VARIANTS_ALL }, { 2, 3, VARIANTS_ALL }, { 3, 1, VARIANTS_ALL }, { 3, 4, VARIANTS_ALL },
+    { 5, 5, VARIANTS_ALL }, { 5, 6, VARIANTS_ALL }, { 6, 4, VARIANTS_ALL },
+    { 8, 9, VARIANTS_ALL }, { 9, 10, VARIANTS_ALL }, { 10, 8, VARIANTS_ALL }, { 9, 8, VARIANTS_ALL },
+};
+
+#define NODE_COUNT 11
+
+static HashTable* build_table(Arena* arena) {
+    HashTable* ht = create_hashtable(arena, 16);
+
+    for (FileId id = 0; ht && id < NODE_COUNT; id++) {
+        char path[16];
+        snprintf(path, sizeof(path), "n%u", id);
+
+        if (intern_path(ht, path) != id) {
+            return NULL;
+        }
+    }
+
+    for (size_t i = 0; ht && i < sizeof(edges) / sizeof(edges[0]); i++) {
+        if (add_dependency(ht, edges[i].from, edges[i].to, edges[i].variants) != 0) {
+            return NULL;
+        }
+    }
+
+    return ht;
+}
+
+static int has_edge(const Graph* graph, FileId from, FileId to) {
+    const FileId* deps = graph_edges(&graph -> forward, from);
+
+    for (uint32_t k = 0; k < graph_degree(&graph -> forward, from); k++) {
+        if (deps[k] == to) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void check_edges(const Graph* graph) {
+    CHECK(graph -> node_count == NODE_COUNT);
+    CHECK(graph_degree(&graph -> forward, 0) == 2);
+    CHECK(graph_edges(&graph -> forward, 0)[0] == 1);
+    CHECK(graph_edges(&graph -> forward, 0)[1] == 5);
+
+    CHECK(graph_degree(&graph -> reverse, 4) == 2);
+    CHECK(graph_edges(&graph -> reverse, 4)[0] == 3);
+    CHECK(graph_edges(&graph -> reverse, 4)[1] == 6);
+    CHECK(graph_degree(&graph -> reverse, 7) == 0);
+}
+
+// Both directions cover the same 13 distinct edges: offsets run from 0 to
+// edge_count without going back, and reverse is forward transposed with each
+// file's includers in FileId order
+static void check_csr(const Graph* graph) {
+    CHECK(graph -> edge_count == 13);
+
+    const GraphEdges* sides[] = { &graph -> forward, &graph -> reverse };
+    for (size_t s = 0; s < 2; s++) {
+        CHECK(sides[s] -> offsets[0] == 0);
+        CHECK(sides[s] -> offsets[NODE_COUNT] == graph -> edge_count);
+
+        for (FileId id = 0; id < NODE_COUNT; id++) {
+            CHECK(sides[s] -> offsets[id] <= sides[s] -> offsets[id + 1]);
+        }
+    }
+
+    size_t matched = 0;
+    for (FileId to = 0; to < NODE_COUNT; to++) {
+        const FileId* includers = graph_edges(&graph -> reverse, to);
+
+        for (uint32_t k = 0; k < graph_degree(&graph -> reverse, to); k++) {
+            CHECK(k == 0 || includers[k - 1] < includers[k]);
+            CHECK(has_edge(graph, includers[k], to));
+            matched++;
+        }
+    }
+
+    CHECK(matched == graph -> edge_count);
+}
+
+// A cycle starts at the component's first member, stays inside it, visits
+// each file once and closes
+static void check_cycle(const Graph* graph, const Components* components, uint32_t c, size_t longest) {
+    FileId path[NODE_COUNT];
+    size_t len = component_cycle(graph, components, c, path);
+
+    CHECK(len > 0 && len <= longest);
+    if (len == 0) {
+        return;
+    }
+
+    CHECK(path[0] == components -> members[components -> offsets[c]]);
+
+    for (size_t i = 0; i < len; i++) {
+        CHECK(components -> component[path[i]] == c);
+        CHECK(has_edge(graph, path[i], path[(i + 1) % len]));
+
+        for (size_t j = 0; j < i; j++) {
+            CHECK(path[i] != path[j]);
+        }
+    }
+}
+
+static void check_components(const Graph* graph, const Components* components) {
+    const uint32_t* component = components -> component;
+
+    CHECK(components -> count == 7);
+    CHECK(components -> cyclic == 3);
+
+    CHECK(component[1] == component[2] && component[2] == component[3]);
+    CHECK(component[8] == component[9] && component[9] == component[10]);
+    CHECK(component[0] != component[1] && component[3] != component[4]);
+
+    for (FileId id = 0; id < NODE_COUNT; id++) {
+        CHECK(components -> members[components -> position[id]] == id);
+    }
+
+    // Reverse topological: what a file includes completes first
+    for (FileId id = 0; id < NODE_COUNT; id++) {
+        const FileId* deps = graph_edges(&graph -> forward, id);
+
+        for (uint32_t k = 0; k < graph_degree(&graph -> forward, id); k++) {
+            CHECK(component[deps[k]] == component[id] || component[deps[k]] < component[id]);
+        }
+    }
+
+    CHECK(component_is_cycle(graph, components, component[1]));
+    CHECK(component_is_cycle(graph, components, component[5]));
+    CHECK(!component_is_cycle(graph, components, component[4]));
+    CHECK(!component_is_cycle(graph, components, component[0]));
+
+    FileId path[NODE_COUNT];
+    CHECK(component_cycle(graph, components, component[4], path) == 0);
+
+    check_cycle(graph, components, component[1], 3);
+    check_cycle(graph, components, component[5], 1);
+
+    // Through n8 or n9 the chord makes it two long, through n10 three
+    FileId first = components -> members[components -> offsets[component[8]]];
+    check_cycle(graph, components, component[8], first == 10 ? 3 : 2);
+}
+
+// n4 changed: everything that reaches it rebuilds, n7 and the n8 cycle do not
+static void check_dirty(Arena* arena, HashTable* ht, const Graph* graph, const Components* components) {
+    ht_node(ht, 4) -> dirty = 1;
+
+    size_t count = 0;
+    uint64_t* dirty = graph_propagate_dirty(arena, graph, components, ht, &count);
+    CHECK(dirty != NULL);
+    if (!dirty) {
+        return;
+    }
+
+    static const FileId expected[] = { 0, 1, 2, 3, 4, 5, 6 };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        CHECK(bitset_test(dirty, expected[i]));
+    }
+
+    CHECK(!bitset_test(dirty, 7));
+    CHECK(!bitset_test(dirty, 8) && !bitset_test(dirty, 9) && !bitset_test(dirty, 10));
+    CHECK(count == 7);
+
+    ht_node(ht, 4) -> dirty = 0;
+}
+
+// Seeds and the exact set each one has to dirty, as a mask over FileIds: a
+// file inside a cycle takes the whole cycle along, a file nothing includes
+// only itself, and several seeds dirty the union of what each reaches
+static void check_dirty_sets(Arena* arena, HashTable* ht, const Graph* graph, const Components* components) {
+    static const struct { uint32_t seeds; uint32_t expected; } cases[] = {
+        { 1u << 9, 1u << 8 | 1u << 9 | 1u << 10 },
+        { 1u << 0, 1u << 0 },
+        { 1u << 7, 1u << 7 },
+        { 1u << 5, 1u << 0 | 1u << 5 },
+        { 1u << 6 | 1u << 10, 1u << 0 | 1u << 5 | 1u << 6 | 1u << 8 | 1u << 9 | 1u << 10 },
+        { 0, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        for (FileId id = 0; id < NODE_COUNT; id++) {
+            ht_node(ht, id) -> dirty = (cases[i].seeds >> id) & 1;
+        }
+
+        size_t count = 0;
+        uint64_t* dirty = graph_propagate_dirty(arena, graph, components, ht, &count);
+        CHECK(dirty != NULL);
+        if (!dirty) {
+            continue;
+        }
+
+        CHECK(count == (size_t) __builtin_popcount(cases[i].expected));
+        for (FileId id = 0; id < NODE_COUNT; id++) {
+            CHECK(bitset_test(dirty, id) == (int) ((cases[i].expected >> id) & 1));
+        }
+    }
+
+    for (FileId id = 0; id < NODE_COUNT; id++) {
+        ht_node(ht, id) -> dirty = 0;
+    }
+}
+
+void test_graph(void) {
+    Arena arena = {0};
+    HashTable* ht = build_table(&arena);
+    CHECK(ht != NULL);
+    if (!ht) {
+        arena_free(&arena);
+        return;
+    }
+
+    Graph* graph = graph_freeze(&arena, ht, VARIANTS_ALL);
+    Components* components = graph ? graph_components(&arena, graph) : NULL;
+    CHECK(graph && components);
+
+    if (graph && components) {
+        check_edges(graph);
+        check_csr(graph);
+        check_components(graph, components);
+        check_dirty(&arena, ht, graph, components);
+        check_dirty_sets(&arena, ht, graph, components);
+    }
+
+    // Variant 0 does not see n0 -> n5
+    Graph* variant = graph_freeze(&arena, ht, 1);
+    CHECK(variant && graph_degree(&variant -> forward, 0) == 1);
+    CHECK(variant && !has_edge(variant, 0, 5));
+
+    arena_free(&arena);
+}
@@ -0,0 +1,92 @@
+#include "test.h"
+
+#include "hash.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Four blocks and a bit: every tail length, every stripe count within a
+// block, and inputs that end exactly on a block
+#define INPUT_LEN (4 * HASH_BLOCK_STRIPES * HASH_STRIPE_LEN + HASH_STRIPE_LEN + 1)
+
+static uint8_t input[INPUT_LEN];
+
+static void fill_input(void) {
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+
+    for (size_t i = 0; i < INPUT_LEN; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        input[i] = (uint8_t) x;
+    }
+}
+
+static void hash_all(uint64_t* digests) {
+    for (size_t len = 0; len <= INPUT_LEN; len++) {
+        digests[len] = hash_buffer(input, len);
+    }
+}
+
+// Fed in uneven pieces the digest is the one-shot one
+static void check_streaming(void) {
+    static const size_t pieces[] = { 1, 7, 63, 64, 65, 1000 };
+
+    for (size_t p = 0; p < sizeof(pieces) / sizeof(pieces[0]); p++) {
+        HashState state;
+        hash_init(&state);
+
+        for (size_t at = 0; at < INPUT_LEN; at += pieces[p]) {
+            size_t n = INPUT_LEN - at < pieces[p] ? INPUT_LEN - at : pieces[p];
+            hash_update(&state, input + at, n);
+        }
+
+        CHECK(hash_digest(&state) == hash_buffer(input, INPUT_LEN));
+    }
+}
+
+static void check_crc32c(void) {
+    CHECK(crc32c("123456789", 9) == 0xE3069283U);
+    CHECK(crc32c("", 0) == 0);
+}
+
+void test_hash(void) {
+    static uint64_t scalar[INPUT_LEN + 1];
+    static uint64_t avx2[INPUT_LEN + 1];
+
+    fill_input();
+
+    CHECK(hash_set_backend("scalar") == 0);
+    CHECK(strcmp(hash_backend(), "scalar") == 0);
+    hash_all(scalar);
+    check_streaming();
+
+    // One byte more, or one bit flipped, is another digest
+    CHECK(scalar[0] != scalar[1]);
+    CHECK(scalar[INPUT_LEN - 1] != scalar[INPUT_LEN]);
+
+    input[100] ^= 1;
+    CHECK(hash_buffer(input, INPUT_LEN) != scalar[INPUT_LEN]);
+    input[100] ^= 1;
+
+    // Zero padding of the tail does not collide with real zeros
+    uint8_t zeros[HASH_STRIPE_LEN] = {0};
+    CHECK(hash_buffer(zeros, 1) != hash_buffer(zeros, 2));
+
+    if (hash_set_backend("avx2") == 0) {
+        hash_all(avx2);
+        check_streaming();
+
+        for (size_t len = 0; len <= INPUT_LEN; len++) {
+            if (scalar[len] != avx2[len]) {
+                fprintf(stderr, "hash: scalar and avx2 differ at length %zu\n", len);
+                CHECK(scalar[len] == avx2[len]);
+                break;
+            }
+        }
+    } else {
+        printf("hash: no AVX2 on this CPU, only the scalar kernel checked\n");
+    }
+
+    check_crc32c();
+}
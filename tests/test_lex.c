@@ -0,0 +1,125 @@
+#include "test.h"
+
+#include "lex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_DIRECTIVES 8
+
+// Each directive as "name|text"
+typedef struct {
+    char seen[MAX_DIRECTIVES][128];
+    size_t count;
+} Collected;
+
+static void collect(void* ctx, const Directive* directive) {
+    Collected* collected = ctx;
+
+    if (collected -> count < MAX_DIRECTIVES) {
+        snprintf(collected -> seen[collected -> count], sizeof(collected -> seen[0]), "%.*s|%.*s",
+                 (int) directive -> name_len, directive -> name, (int) directive -> text_len, directive -> text);
+    }
+
+    collected -> count++;
+}
+
+// expected ends with NULL. The source is copied to a buffer of exactly size
+// bytes, so a sanitizer build catches a read past the end.
+static void check_lex(const char* source, size_t size, const char* const* expected) {
+    Collected collected = {0};
+    char* buffer = malloc(size ? size : 1);
+    if (!buffer) {
+        CHECK(!"malloc");
+        return;
+    }
+
+    memcpy(buffer, source, size);
+    lex_directives(buffer, size, collect, &collected);
+    free(buffer);
+
+    size_t count = 0;
+    while (expected[count]) {
+        count++;
+    }
+
+    int same = collected.count == count;
+    for (size_t i = 0; same && i < count; i++) {
+        same = strcmp(collected.seen[i], expected[i]) == 0;
+    }
+
+    if (!same) {
+        fprintf(stderr, "lex: unexpected directives from:\n%.*s\n", (int) size, source);
+        for (size_t i = 0; i < collected.count && i < MAX_DIRECTIVES; i++) {
+            fprintf(stderr, "  got %s\n", collected.seen[i]);
+        }
+    }
+
+    CHECK(same);
+}
+
+#define LEX(source, ...) check_lex(source, strlen(source), (const char* const[]) { __VA_ARGS__, NULL })
+
+static void check_comments(void) {
+    LEX("#include \"a.h\"\n  #  include <b.h>\n", "include|\"a.h\"", "include|<b.h>");
+    LEX("// #include \"no.h\"\n/* #include \"no.h\" */\n#include \"yes.h\"\n", "include|\"yes.h\"");
+    LEX("/* one\n#include \"no.h\"\n*/\n/* c */ #include \"yes.h\"\n", "include|\"yes.h\"");
+    LEX("x = a / b; /**/#include \"no.h\"\n#include \"yes.h\"\n", "include|\"yes.h\"");
+
+    // Comments inside a directive are its text as written
+    LEX("#include \"a.h\" // trailing\n", "include|\"a.h\" // trailing");
+}
+
+static void check_literals(void) {
+    LEX("s = \"#include \\\"no.h\\\"\";\n#include \"yes.h\"\n", "include|\"yes.h\"");
+    LEX("char q = '\"';\nchar e = '\\'';\n#include \"yes.h\"\n", "include|\"yes.h\"");
+    LEX("r = R\"x(\n#include \"no.h\"\n)\" )x\";\n#include \"yes.h\"\n", "include|\"yes.h\"");
+    LEX("r = u8R\"(\n#include \"no.h\"\n)\";\n#include \"yes.h\"\n", "include|\"yes.h\"");
+
+    // A digit separator opens no character literal
+    LEX("int n = 1'000;\nint m = 0x1'2'3;\n#include \"yes.h\"\n", "include|\"yes.h\"");
+}
+
+static void check_continuations(void) {
+    LEX("#define X \\\n#include \"no.h\"\n#include \"yes.h\"\n", "define|X \\\n#include \"no.h\"", "include|\"yes.h\"");
+    LEX("// comment \\\n#include \"no.h\"\n#include \"yes.h\"\n", "include|\"yes.h\"");
+    LEX("s = \"abc\\\n#include \\\"no.h\\\"\";\n#include \"yes.h\"\n", "include|\"yes.h\"");
+    LEX("#include \\\n \"cont.h\"\n", "include|\"cont.h\"");
+}
+
+static void check_edges(void) {
+    LEX("#if X\n#endif\n# \n#\n", "if|X", "endif|");
+    LEX("#include \"last.h\"", "include|\"last.h\"");
+
+    // size is the end, whatever follows it
+    const char* cut = "#include \"cut.h\"\n#include \"no.h\"\n";
+    check_lex(cut, strlen("#include \"cut"), (const char* const[]) { "include|\"cut", NULL });
+}
+
+// The directive lands on every offset around the 64 byte chunks the bytes are
+// classified in, after code, a comment or a string that crosses the boundary
+static void check_chunks(void) {
+    static const char* const prefixes[] = { "x", "/*", "\"", "//" };
+    static const char* const closers[] = { ";\n", "*/\n", "\";\n", "\n" };
+    char source[256];
+
+    for (size_t p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); p++) {
+        for (size_t pad = 0; pad < 140; pad++) {
+            size_t len = (size_t) snprintf(source, sizeof(source), "%s", prefixes[p]);
+            memset(source + len, 'a', pad);
+            len += pad;
+            len += (size_t) snprintf(source + len, sizeof(source) - len, "%s#include \"x.h\"\n", closers[p]);
+
+            LEX(source, "include|\"x.h\"");
+        }
+    }
+}
+
+void test_lex(void) {
+    check_comments();
+    check_literals();
+    check_continuations();
+    check_edges();
+    check_chunks();
+}
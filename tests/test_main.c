@@ -0,0 +1,46 @@
+#include "test.h"
+
+#include <stdio.h>
+
+// Unit tests for the modules under src/, linked against every source but
+// main.c:
+//
+//     cc -std=gnu11 -mavx2 -pthread -Isrc tests/*.c $(ls src/*.c | grep -v main.c) -o checksum_test
+//
+// Suites that touch the filesystem work in a temporary directory of their own.
+// Add -DARENA_STATS to check the arena statistics as well.
+
+int test_failures = 0;
+
+typedef struct {
+    const char* name;
+    void (*run)(void);
+} Suite;
+
+static const Suite suites[] = {
+    { "hash", test_hash },
+    { "cache", test_cache },
+    { "graph", test_graph },
+    { "lex", test_lex },
+    { "cond", test_cond },
+    { "pool", test_pool },
+    { "table", test_table },
+    { "store", test_store },
+    { "path", test_path },
+    { "arena", test_arena },
+    { "scan", test_scan },
+};
+
+int main(void) {
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(suites) / sizeof(suites[0]); i++) {
+        int before = test_failures;
+        suites[i].run();
+
+        printf("%-8s %s\n", suites[i].name, test_failures == before ? "ok" : "FAILED");
+        failed += test_failures != before;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+#include "test.h"
+
+#include "arena.h"
+#include "path.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int joins_to(const char* dir, const char* name, const char* expected) {
+    char out[PATH_MAX];
+    size_t len = path_join(out, sizeof(out), dir, strlen(dir), name);
+
+    if (len != strlen(expected) || strcmp(out, expected) != 0) {
+        fprintf(stderr, "path: join(\"%s\", \"%s\") gave \"%s\"\n", dir, name, out);
+        return 0;
+    }
+
+    return 1;
+}
+
+static int canonical_is(PathCache* cache, const char* dir, const char* name, const char* expected) {
+    char out[PATH_MAX];
+    size_t len = path_canonical(cache, out, sizeof(out), dir, strlen(dir), name);
+
+    if (len != strlen(expected) || strcmp(out, expected) != 0) {
+        fprintf(stderr, "path: canonical(\"%s\", \"%s\") gave \"%s\"\n", dir, name, len ? out : "");
+        return 0;
+    }
+
+    return 1;
+}
+
+static void check_join(void) {
+    CHECK(joins_to("src", "x.h", "src/x.h"));
+    CHECK(joins_to("src/", "./x.h", "src/x.h"));
+    CHECK(joins_to("src//lib/.", "x.h", "src/lib/x.h"));
+    CHECK(joins_to("src/lib", "../x.h", "src/x.h"));
+    CHECK(joins_to("src", "../../x.h", "../x.h"));
+    CHECK(joins_to("", "x.h", "x.h"));
+    CHECK(joins_to("src", "..", "."));
+    CHECK(joins_to("", ".", "."));
+    CHECK(joins_to("/usr/include", "../lib/x.h", "/usr/lib/x.h"));
+    CHECK(joins_to("/", "../x.h", "/x.h"));
+    CHECK(joins_to("src", "/usr/include/x.h", "/usr/include/x.h"));
+
+    char out[PATH_MAX];
+    CHECK(path_concat(out, sizeof(out), "src/link", 8, "../x.h") > 0 && strcmp(out, "src/link/../x.h") == 0);
+    CHECK(path_concat(out, sizeof(out), "src/./link", 10, "./x.h") > 0 && strcmp(out, "src/link/x.h") == 0);
+
+    char small[8];
+    CHECK(path_join(small, sizeof(small), "src/lib", 7, "x.h") == 0);
+}
+
+// Paths under the temp directory, which is far shorter than PATH_MAX
+static void under(char* out, const char* base, const char* rel) {
+    if (snprintf(out, PATH_MAX, "%s/%s", base, rel) >= PATH_MAX) {
+        out[0] = 0;
+    }
+}
+
+// base/src/link points at base/real/inc/sub, so "src/link/.." is real/inc and
+// not src, and base/src/alias.h is a symlink to a.c
+static int make_tree(const char* base) {
+    char path[PATH_MAX];
+    const char* dirs[] = { "src", "real", "real/inc", "real/inc/sub" };
+
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        under(path, base, dirs[i]);
+        if (mkdir(path, 0755) != 0) {
+            return -1;
+        }
+    }
+
+    const char* files[] = { "src/a.c", "real/inc/x.h", "real/inc/sub/y.h" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        under(path, base, files[i]);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            return -1;
+        }
+        close(fd);
+    }
+
+    under(path, base, "src/link");
+    if (symlink("../real/inc/sub", path) != 0) {
+        return -1;
+    }
+
+    under(path, base, "src/alias.h");
+    return symlink("a.c", path);
+}
+
+static void remove_tree(const char* base) {
+    const char* entries[] = {
+        "src/alias.h", "src/link", "src/a.c", "real/inc/sub/y.h", "real/inc/x.h",
+        "real/inc/sub", "real/inc", "real", "src",
+    };
+
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+        under(path, base, entries[i]);
+        remove(path);
+    }
+
+    rmdir(base);
+}
+
+// Outside the working directory results are absolute
+static void check_absolute(const char* base) {
+    Arena arena = {0};
+    PathCache* cache = path_cache_create(&arena);
+    CHECK(cache != NULL);
+    if (!cache) {
+        return;
+    }
+
+    char dir[PATH_MAX];
+    char expected[PATH_MAX];
+
+    under(dir, base, "src/link");
+    under(expected, base, "real/inc/x.h");
+    CHECK(canonical_is(cache, dir, "../x.h", expected));
+
+    // Asked twice, the second answer comes from the memo
+    CHECK(canonical_is(cache, dir, "../x.h", expected));
+
+    under(expected, base, "real/inc/sub/y.h");
+    CHECK(canonical_is(cache, dir, "./y.h", expected));
+
+    under(dir, base, "src");
+    under(expected, base, "src/alias.h");
+    CHECK(canonical_is(cache, dir, "alias.h", expected));
+
+    under(expected, base, "real/inc/sub/y.h");
+    CHECK(canonical_is(cache, dir, "link/y.h", expected));
+
+    // A directory that does not exist is taken lexically
+    under(expected, base, "src/y.h");
+    CHECK(canonical_is(cache, dir, "missing/../y.h", expected));
+
+    path_cache_destroy(cache);
+    arena_free(&arena);
+}
+
+// Under the working directory results are relative to it, with no "./"
+static void check_relative(const char* base) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)) || chdir(base) != 0) {
+        CHECK(!"chdir");
+        return;
+    }
+
+    Arena arena = {0};
+    PathCache* cache = path_cache_create(&arena);
+    CHECK(cache != NULL);
+
+    if (cache) {
+        CHECK(canonical_is(cache, "src/link", "../x.h", "real/inc/x.h"));
+        CHECK(canonical_is(cache, "", "./src/a.c", "src/a.c"));
+        CHECK(canonical_is(cache, "src", "../real/inc/x.h", "real/inc/x.h"));
+        CHECK(canonical_is(cache, "src/link", "../../../src/a.c", "src/a.c"));
+
+        // A name ending in ".." has no file to keep and is joined lexically
+        CHECK(canonical_is(cache, "src", "link/..", "src"));
+
+        char out[PATH_MAX];
+        CHECK(path_canonical_dir(cache, out, sizeof(out), "src/link", 8) == 12 && strcmp(out, "real/inc/sub") == 0);
+        CHECK(path_canonical_dir(cache, out, sizeof(out), "", 0) == 0 && out[0] == 0);
+        CHECK(path_canonical_dir(cache, out, sizeof(out), base, strlen(base)) == 0 && out[0] == 0);
+        CHECK(path_canonical_dir(cache, out, 4, "src/link", 8) == SIZE_MAX);
+    }
+
+    path_cache_destroy(cache);
+    arena_free(&arena);
+
+    if (chdir(cwd) != 0) {
+        CHECK(!"chdir back");
+    }
+}
+
+void test_path(void) {
+    check_join();
+
+    char dir[] = "/tmp/catalyze-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+
+    // The temp directory may itself sit behind a symlink
+    char base[PATH_MAX];
+    if (!realpath(dir, base) || make_tree(base) != 0) {
+        CHECK(!"make_tree");
+    } else {
+        check_absolute(base);
+        check_relative(base);
+    }
+
+    remove_tree(dir);
+}
@@ -0,0 +1,82 @@
+#include "test.h"
+
+#include "pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WORKERS 4
+#define ITEMS 64
+
+typedef struct {
+    uint32_t runs[ITEMS];
+    size_t worker[ITEMS];
+    size_t slow;
+} Run;
+
+static void record(void* ctx, size_t worker, size_t item) {
+    Run* run = ctx;
+
+    if (item < run -> slow) {
+        usleep(2000);
+    }
+
+    __atomic_fetch_add(&run -> runs[item], 1, __ATOMIC_RELAXED);
+    run -> worker[item] = worker;
+}
+
+static void check_each_once(Pool* pool, size_t count) {
+    Run run;
+    memset(&run, 0, sizeof(run));
+
+    pool_run(pool, count, record, &run);
+
+    for (size_t i = 0; i < ITEMS; i++) {
+        CHECK(run.runs[i] == (i < count));
+    }
+}
+
+// Worker 0 starts with the first ITEMS / WORKERS items and each of them is
+// slow, the others run out at once and have to take them from it
+static void check_stealing(Pool* pool) {
+    Run run;
+    memset(&run, 0, sizeof(run));
+    run.slow = ITEMS / WORKERS;
+
+    pool_run(pool, ITEMS, record, &run);
+
+    size_t stolen = 0;
+    for (size_t i = 0; i < ITEMS; i++) {
+        CHECK(run.runs[i] == 1);
+        stolen += i < run.slow && run.worker[i] != 0;
+    }
+
+    CHECK(stolen > 0);
+}
+
+void test_pool(void) {
+    Pool* pool = pool_create(WORKERS);
+    CHECK(pool != NULL);
+    if (!pool) {
+        return;
+    }
+
+    check_each_once(pool, ITEMS);
+    check_each_once(pool, WORKERS - 1);
+    check_each_once(pool, 1);
+    check_each_once(pool, 0);
+    check_stealing(pool);
+
+    // A later batch starts from fresh ranges
+    check_each_once(pool, ITEMS);
+    pool_destroy(pool);
+
+    Pool* single = pool_create(1);
+    CHECK(single != NULL);
+    if (single) {
+        check_each_once(single, ITEMS);
+        pool_destroy(single);
+    }
+}
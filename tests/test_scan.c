@@ -0,0 +1,372 @@
+#include "test.h"
+
+#include "arena.h"
+#include "cache.h"
+#include "config.h"
+#include "hashtable.h"
+#include "path.h"
+#include "scan.h"
+#include "search.h"
+#include "uring.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEADERS 40
+#define MAX_FILES (HEADERS + 8)
+
+// Removes what make_tree wrote, directories and regular files only
+static void remove_tree(const char* path) {
+    DIR* listing = opendir(path);
+
+    if (listing) {
+        struct dirent* entry;
+        while ((entry = readdir(listing)) != NULL) {
+            if (strcmp(entry -> d_name, ".") != 0 && strcmp(entry -> d_name, "..") != 0) {
+                char child[PATH_MAX];
+                snprintf(child, sizeof(child), "%s/%s", path, entry -> d_name);
+                remove_tree(child);
+            }
+        }
+
+        closedir(listing);
+    }
+
+    remove(path);
+}
+
+static int write_file(const char* path, const char* text, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    ssize_t written = write(fd, text, len);
+    close(fd);
+
+    return written == (ssize_t) len ? 0 : -1;
+}
+
+// Under the working directory: src/a.c includes a header next to it, one from
+// -Iinc, one that does not exist and one under #ifdef. src/big.c is larger
+// than a ring buffer, so a batch reads it the blocking way. The headers chain
+// into each other, enough of them for two batches.
+static int make_tree(void) {
+    if (mkdir("src", 0755) != 0 || mkdir("inc", 0755) != 0) {
+        return -1;
+    }
+
+    static const char a[] =
+        "#include \"x.h\"\n"
+        "#include <lib.h>\n"
+        "#include \"missing.h\"\n"
+        "#ifdef DEBUG\n"
+        "#include \"h00.h\"\n"
+        "#endif\n"
+        "int main(void) { return 0; }\n";
+
+    static const char x[] = "#pragma once\n#include \"../inc/lib.h\"\n";
+    static const char lib[] = "// lib\n";
+
+    if (write_file("src/a.c", a, sizeof(a) - 1) != 0 ||
+        write_file("src/x.h", x, sizeof(x) - 1) != 0 ||
+        write_file("inc/lib.h", lib, sizeof(lib) - 1) != 0 ||
+        write_file("src/empty.h", "", 0) != 0) {
+        return -1;
+    }
+
+    size_t size = SCAN_BUFFER_SIZE + 4096;
+    char* big = malloc(size + 64);
+    if (!big) {
+        return -1;
+    }
+
+    memset(big, ' ', size);
+    for (size_t i = 79; i < size; i += 80) {
+        big[i] = '\n';
+    }
+
+    int length = snprintf(big + size, 64, "#include \"x.h\"\n");
+    int status = length > 0 ? write_file("src/big.c", big, size + (size_t) length) : -1;
+    free(big);
+
+    for (int i = 0; i < HEADERS && status == 0; i++) {
+        char path[32];
+        char text[64];
+        snprintf(path, sizeof(path), "src/h%02d.h", i);
+        int len = snprintf(text, sizeof(text), "#include \"h%02d.h\"\n#include <lib.h>\n", (i + 1) % HEADERS);
+        status = write_file(path, text, (size_t) len);
+    }
+
+    return status;
+}
+
+// The files to scan, one of them never written
+static size_t collect_ids(HashTable* ht, FileId* ids) {
+    static const char* const names[] = { "src/a.c", "src/x.h", "inc/lib.h", "src/empty.h", "src/big.c", "src/gone.c" };
+    size_t count = 0;
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        ids[count++] = intern_path(ht, names[i]);
+    }
+
+    for (int i = 0; i < HEADERS; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "src/h%02d.h", i);
+        ids[count++] = intern_path(ht, path);
+    }
+
+    return count;
+}
+
+static int same_result(const ScanResult* left, const ScanResult* right) {
+    if ((left -> error == NULL) != (right -> error == NULL) ||
+        (left -> error && strcmp(left -> error, right -> error) != 0)) {
+        return 0;
+    }
+
+    if (left -> missing != right -> missing || left -> dirty != right -> dirty ||
+        left -> content_hash != right -> content_hash ||
+        left -> stat.mtime_ns != right -> stat.mtime_ns || left -> stat.size != right -> stat.size ||
+        left -> stat.ino != right -> stat.ino || left -> stat.dev != right -> stat.dev) {
+        return 0;
+    }
+
+    if (left -> include_count != right -> include_count || left -> spelling_count != right -> spelling_count) {
+        return 0;
+    }
+
+    for (size_t k = 0; k < left -> include_count; k++) {
+        if (left -> includes[k] != right -> includes[k] || left -> include_variants[k] != right -> include_variants[k]) {
+            return 0;
+        }
+    }
+
+    for (size_t k = 0; k < left -> spelling_count; k++) {
+        if (strcmp(left -> spellings[k], right -> spellings[k]) != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Whatever reads them, blocking calls or a ring in batches of up to
+// SCAN_BATCH, the same files give the same results
+static void check_uring(const ScanContext* ctx, const FileId* ids, size_t count) {
+    Arena arena = {0};
+    ScanResult* expected = arena_array_zero(&arena, ScanResult, count);
+    ScanResult* batched = arena_array_zero(&arena, ScanResult, count);
+
+    for (size_t i = 0; i < count; i++) {
+        scan_file(&arena, ctx, ids[i], &expected[i]);
+    }
+
+    // Spot checks that the blocking results are the ones to compare against.
+    // missing.h is an edge to a node that turns out missing when scanned.
+    Node* lib = get_ht(ctx -> ht, "inc/lib.h");
+    CHECK(lib != NULL);
+    CHECK(lib && expected[0].include_count == 4 && expected[0].includes[1] == lib -> id);
+    CHECK(expected[0].spelling_count == 6);
+    CHECK(expected[4].include_count == 1 && !expected[4].error);
+    CHECK(expected[5].missing && expected[5].error);
+
+    Uring ring;
+    if (uring_init(&ring, 2 * SCAN_BATCH, SCAN_BATCH + 1, SCAN_BUFFER_SIZE) != 0) {
+        fprintf(stderr, "scan: io_uring unavailable, batches not compared\n");
+        arena_free(&arena);
+        return;
+    }
+
+    for (size_t first = 0; first < count; first += SCAN_BATCH) {
+        size_t batch = count - first < SCAN_BATCH ? count - first : SCAN_BATCH;
+        scan_batch(&arena, ctx, &ring, ids + first, batched + first, batch);
+    }
+
+    CHECK(!ring.failed);
+
+    for (size_t i = 0; i < count; i++) {
+        if (!same_result(&expected[i], &batched[i])) {
+            fprintf(stderr, "scan: %s differs read through the ring\n", ht_node(ctx -> ht, ids[i]) -> path);
+            CHECK(!"same result");
+        }
+    }
+
+    uring_destroy(&ring);
+    arena_free(&arena);
+}
+
+// An hour back plus seconds, well before any cache written from now on
+static int set_mtime(const char* path, time_t seconds) {
+    struct timespec times[2] = { { time(NULL) - 3600 + seconds, 0 }, { time(NULL) - 3600 + seconds, 0 } };
+    return utimensat(AT_FDCWD, path, times, 0);
+}
+
+// What load_hashtable keeps of a scan, every file counted as a source
+static int keep_result(HashTable* ht, FileId id, const ScanResult* result) {
+    Node* node = ht_node(ht, id);
+    node -> content_hash = result -> content_hash;
+    node -> stat = result -> stat;
+    node -> discovered = 1;
+    node -> scanned = 1;
+
+    if (set_spellings(ht, node, result -> spellings, result -> spelling_count) != 0) {
+        return -1;
+    }
+
+    for (size_t k = 0; k < result -> include_count; k++) {
+        if (add_dependency(ht, id, result -> includes[k], result -> include_variants[k]) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+#define CACHED 4
+
+// Against a cache written after a first scan: a file whose stat matches is
+// taken from its record without being read, even with other bytes behind the
+// same stat, a touched file with the same bytes is read again and is not
+// dirty, and a file with new bytes is dirty. The ring agrees on each.
+static void check_cached(const Config* config, PathCache* paths) {
+    static const char* const names[CACHED] = { "src/a.c", "src/x.h", "inc/lib.h", "src/empty.h" };
+    Arena arena = {0};
+
+    for (size_t i = 0; i < CACHED; i++) {
+        CHECK(set_mtime(names[i], 0) == 0);
+    }
+
+    HashTable* ht = create_hashtable(&arena, 64);
+    SearchPath* search = search_path_create(&arena, config);
+    ScanContext first = { .ht = ht, .search = search, .paths = paths };
+
+    FileId ids[CACHED];
+    uint64_t hashes[CACHED];
+    for (size_t i = 0; i < CACHED; i++) {
+        ScanResult result = {0};
+        ids[i] = intern_path(ht, names[i]);
+        scan_file(&arena, &first, ids[i], &result);
+
+        CHECK(!result.error && result.dirty);
+        CHECK(keep_result(ht, ids[i], &result) == 0);
+        hashes[i] = result.content_hash;
+    }
+
+    search_path_destroy(search);
+    CHECK(cache_write(ht, 0, "catalyze.cache", NULL) == 0);
+
+    struct stat before;
+    CHECK(stat("src/x.h", &before) == 0);
+
+    static const char x[] = "#pragma once\n#include \"../inc/lob.h\"\n";
+    static const char a[] = "#include \"x.h\"\n";
+    CHECK(write_file("src/x.h", x, sizeof(x) - 1) == 0);
+    CHECK(utimensat(AT_FDCWD, "src/x.h", (struct timespec[2]) { before.st_mtim, before.st_mtim }, 0) == 0);
+    CHECK(set_mtime("inc/lib.h", 10) == 0);
+    CHECK(write_file("src/a.c", a, sizeof(a) - 1) == 0);
+
+    Arena second_arena = {0};
+    HashTable* second_ht = create_hashtable(&second_arena, 64);
+    CachedFiles* cache = cache_load(&second_arena, "catalyze.cache");
+    CHECK(cache != NULL);
+    if (!cache || cache_intern(second_ht, cache) != 0) {
+        CHECK(!"cache_intern");
+        arena_free(&second_arena);
+        arena_free(&arena);
+        return;
+    }
+
+    search = search_path_create(&second_arena, config);
+    ScanContext second = { .ht = second_ht, .cache = cache, .search = search, .paths = paths };
+
+    ScanResult results[CACHED];
+    memset(results, 0, sizeof(results));
+    for (size_t i = 0; i < CACHED; i++) {
+        ids[i] = intern_path(second_ht, names[i]);
+        scan_file(&second_arena, &second, ids[i], &results[i]);
+        CHECK(!results[i].error);
+    }
+
+    CHECK(results[0].dirty && results[0].content_hash != hashes[0]);
+
+    Node* lib = get_ht(second_ht, "inc/lib.h");
+    CHECK(!results[1].dirty && results[1].content_hash == hashes[1]);
+    CHECK(lib && results[1].include_count == 1 && results[1].includes[0] == lib -> id);
+
+    CHECK(!results[2].dirty && results[2].content_hash == hashes[2]);
+    CHECK(results[2].stat.mtime_ns != cache_record(cache, ids[2]) -> stat.mtime_ns);
+    CHECK(!results[3].dirty && results[3].content_hash == hashes[3]);
+
+    Uring ring;
+    if (uring_init(&ring, 2 * SCAN_BATCH, SCAN_BATCH + 1, SCAN_BUFFER_SIZE) == 0) {
+        ScanResult batched[CACHED];
+        memset(batched, 0, sizeof(batched));
+        scan_batch(&second_arena, &second, &ring, ids, batched, CACHED);
+
+        for (size_t i = 0; i < CACHED; i++) {
+            CHECK(same_result(&results[i], &batched[i]));
+        }
+
+        uring_destroy(&ring);
+    }
+
+    search_path_destroy(search);
+    cache_unload(cache);
+    arena_free(&second_arena);
+    arena_free(&arena);
+}
+
+void test_scan(void) {
+    char dir[] = "/tmp/catalyze-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)) || chdir(dir) != 0) {
+        CHECK(!"chdir");
+        rmdir(dir);
+        return;
+    }
+
+    Arena arena = {0};
+    char flags[] = "-Iinc";
+    Config config = { .default_flags = flags };
+
+    HashTable* ht = create_hashtable(&arena, 64);
+    PathCache* paths = path_cache_create(&arena);
+    SearchPath* search = search_path_create(&arena, &config);
+    CHECK(ht != NULL && paths != NULL);
+
+    if (make_tree() != 0) {
+        CHECK(!"make_tree");
+    } else if (ht && paths) {
+        ScanContext ctx = { .ht = ht, .search = search, .paths = paths };
+
+        FileId ids[MAX_FILES];
+        size_t count = collect_ids(ht, ids);
+
+        check_uring(&ctx, ids, count);
+        check_cached(&config, paths);
+    }
+
+    search_path_destroy(search);
+    path_cache_destroy(paths);
+    arena_free(&arena);
+
+    if (chdir(cwd) != 0) {
+        CHECK(!"chdir back");
+    }
+
+    remove_tree(dir);
+}
@@ -0,0 +1,140 @@
+#include "test.h"
+
+#include "arena.h"
+#include "hashtable.h"
+#include "store.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CONTENT_HASH 0xAB00000000000001ULL
+
+// The store only holds directories and regular files
+static void remove_tree(const char* path) {
+    DIR* listing = opendir(path);
+
+    if (listing) {
+        struct dirent* entry;
+        while ((entry = readdir(listing)) != NULL) {
+            if (strcmp(entry -> d_name, ".") != 0 && strcmp(entry -> d_name, "..") != 0) {
+                char child[PATH_MAX];
+                snprintf(child, sizeof(child), "%s/%s", path, entry -> d_name);
+                remove_tree(child);
+            }
+        }
+
+        closedir(listing);
+    }
+
+    remove(path);
+}
+
+// Spellings come back as they went in, an empty list included, and a hash
+// nothing was stored under is a miss
+static void check_content(const Store* store) {
+    static const char* const spellings[] = { "\"x.h", "#ifdef DEBUG", "<lib/y.h", "#endif" };
+    Arena arena = {0};
+
+    CHECK(store_put_content(store, CONTENT_HASH, spellings, 4) == 0);
+    CHECK(store_put_content(store, CONTENT_HASH + 1, NULL, 0) == 0);
+
+    const char** found = NULL;
+    size_t count = 0;
+
+    CHECK(store_find_content(store, &arena, CONTENT_HASH, &found, &count) == 0);
+    CHECK(count == 4);
+    for (size_t i = 0; i < count && i < 4; i++) {
+        CHECK(strcmp(found[i], spellings[i]) == 0);
+    }
+
+    CHECK(store_find_content(store, &arena, CONTENT_HASH + 1, &found, &count) == 0);
+    CHECK(count == 0);
+
+    CHECK(store_find_content(store, &arena, CONTENT_HASH + 2, &found, &count) != 0);
+
+    arena_free(&arena);
+}
+
+// A flipped byte in the spellings fails the CRC and reads as a miss
+static void check_damaged(const Store* store) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/content/%02x/%016" PRIx64, store -> root, (unsigned) (CONTENT_HASH >> 56), (uint64_t) CONTENT_HASH);
+
+    int fd = open(path, O_RDWR);
+    CHECK(fd != -1);
+    if (fd == -1) {
+        return;
+    }
+
+    char byte = 0;
+    CHECK(pread(fd, &byte, 1, sizeof(StoreContent)) == 1);
+    byte ^= 0x40;
+    CHECK(pwrite(fd, &byte, 1, sizeof(StoreContent)) == 1);
+    close(fd);
+
+    Arena arena = {0};
+    const char** found = NULL;
+    size_t count = 0;
+
+    CHECK(store_find_content(store, &arena, CONTENT_HASH, &found, &count) != 0);
+    arena_free(&arena);
+}
+
+// A stat entry only answers for the very same FileStat, and one for a file
+// modified after the entry would be written is never kept
+static void check_stat(const Store* store) {
+    FileStat st = { .mtime_ns = 1000, .size = 10, .ino = 7, .dev = 3 };
+    uint64_t content_hash = 0;
+
+    CHECK(store_find_stat(store, &st, &content_hash) != 0);
+    CHECK(store_put_stat(store, &st, CONTENT_HASH) == 0);
+    CHECK(store_find_stat(store, &st, &content_hash) == 0);
+    CHECK(content_hash == CONTENT_HASH);
+
+    FileStat moved = st;
+    moved.ino = 8;
+    CHECK(store_find_stat(store, &moved, &content_hash) != 0);
+
+    FileStat future = st;
+    future.mtime_ns = UINT64_MAX;
+    CHECK(store_put_stat(store, &future, CONTENT_HASH) == 0);
+    CHECK(store_find_stat(store, &future, &content_hash) != 0);
+}
+
+void test_store(void) {
+    char dir[] = "/tmp/catalyze-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        CHECK(!"mkdtemp");
+        return;
+    }
+
+    const char* saved = getenv("XDG_CACHE_HOME");
+    char* previous = saved ? strdup(saved) : NULL;
+    setenv("XDG_CACHE_HOME", dir, 1);
+
+    Arena arena = {0};
+    Store* store = store_open(&arena);
+    CHECK(store != NULL);
+
+    if (store) {
+        check_content(store);
+        check_damaged(store);
+        check_stat(store);
+    }
+
+    if (previous) {
+        setenv("XDG_CACHE_HOME", previous, 1);
+        free(previous);
+    } else {
+        unsetenv("XDG_CACHE_HOME");
+    }
+
+    arena_free(&arena);
+    remove_tree(dir);
+}
@@ -0,0 +1,194 @@
+#include "test.h"
+
+#include "arena.h"
+#include "hashtable.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define THREADS 8
+#define PATHS 4000
+
+static char paths[PATHS][32];
+
+static void fill_paths(void) {
+    for (size_t i = 0; i < PATHS; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "src/d%zu/h%zu.h", i % 37, i);
+    }
+}
+
+typedef struct {
+    HashTable* ht;
+    size_t thread;
+    FileId ids[PATHS];
+    size_t wrong;
+} Interner;
+
+// Every thread interns every path, each starting at a different point, and
+// looks up a path another thread may be inserting as it goes. A lookup finds
+// nothing or the node for that path, never another one.
+static void* intern_all(void* arg) {
+    Interner* interner = arg;
+
+    for (size_t k = 0; k < PATHS; k++) {
+        size_t i = (k + interner -> thread * (PATHS / THREADS)) % PATHS;
+        interner -> ids[i] = intern_path(interner -> ht, paths[i]);
+
+        size_t j = (i * 7 + 1) % PATHS;
+        Node* node = get_ht(interner -> ht, paths[j]);
+        if (node && node != ht_node(interner -> ht, node -> id)) {
+            interner -> wrong++;
+        }
+        if (node && strcmp(node -> path, paths[j]) != 0) {
+            interner -> wrong++;
+        }
+    }
+
+    return NULL;
+}
+
+// Starting from 16 slots the table grows many times while the threads insert
+static void check_concurrent(void) {
+    Arena arena = {0};
+    HashTable* ht = create_hashtable(&arena, 16);
+    CHECK(ht != NULL);
+    if (!ht) {
+        return;
+    }
+
+    static Interner interners[THREADS];
+    pthread_t threads[THREADS];
+
+    for (size_t t = 0; t < THREADS; t++) {
+        interners[t].ht = ht;
+        interners[t].thread = t;
+        interners[t].wrong = 0;
+        CHECK(pthread_create(&threads[t], NULL, intern_all, &interners[t]) == 0);
+    }
+
+    for (size_t t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        CHECK(interners[t].wrong == 0);
+    }
+
+    CHECK(ht -> count == PATHS);
+    CHECK(ht -> node_count == PATHS);
+    CHECK(ht -> capacity >= PATHS);
+
+    // One id per path, the same one for every thread, and the ids are dense
+    static uint8_t seen[PATHS];
+    memset(seen, 0, sizeof(seen));
+
+    for (size_t i = 0; i < PATHS; i++) {
+        FileId id = interners[0].ids[i];
+        CHECK(id < PATHS);
+        if (id >= PATHS) {
+            continue;
+        }
+
+        CHECK(!seen[id]);
+        seen[id] = 1;
+
+        for (size_t t = 1; t < THREADS; t++) {
+            CHECK(interners[t].ids[i] == id);
+        }
+
+        Node* node = get_ht(ht, paths[i]);
+        CHECK(node && node -> id == id && strcmp(node -> path, paths[i]) == 0);
+        CHECK(ht_node(ht, id) == node);
+    }
+
+    arena_free(&arena);
+}
+
+// One thread, so every growth is forced by the load factor: nothing inserted
+// before a rehash is lost by it and the table never gets past 7/8 full
+static void check_rehash(void) {
+    Arena arena = {0};
+    HashTable* ht = create_hashtable(&arena, 16);
+    CHECK(ht != NULL);
+    if (!ht) {
+        return;
+    }
+
+    size_t capacity = ht -> capacity;
+    size_t grown = 0;
+
+    for (size_t i = 0; i < PATHS; i++) {
+        Node* node = insert_ht(ht, paths[i], i);
+        CHECK(node && node -> id == i && node -> content_hash == i);
+
+        if (ht -> capacity != capacity) {
+            CHECK(ht -> capacity == capacity * 2);
+            capacity = ht -> capacity;
+            grown++;
+        }
+
+        CHECK(ht -> count <= ht -> capacity - ht -> capacity / 8);
+    }
+
+    CHECK(grown > 0);
+    CHECK(capacity % HT_GROUP_SIZE == 0 && (capacity & (capacity - 1)) == 0);
+
+    for (size_t i = 0; i < PATHS; i++) {
+        Node* node = get_ht(ht, paths[i]);
+        CHECK(node && node -> id == i && strcmp(node -> path, paths[i]) == 0);
+    }
+
+    CHECK(get_ht(ht, "src/d0/missing.h") == NULL);
+
+    // insert_ht of a known path updates its content hash, intern_path leaves it
+    CHECK(insert_ht(ht, paths[5], 99) == ht_node(ht, 5));
+    CHECK(ht_node(ht, 5) -> content_hash == 99);
+    CHECK(intern_path(ht, paths[5]) == 5);
+    CHECK(ht_node(ht, 5) -> content_hash == 99);
+    CHECK(ht -> count == PATHS && ht -> node_count == PATHS);
+
+    arena_free(&arena);
+}
+
+// Nodes are keyed by the full path, files sharing a basename are separate
+// nodes and the name index chains all of them
+static void check_names(void) {
+    Arena arena = {0};
+    HashTable* ht = create_hashtable(&arena, 16);
+    CHECK(ht != NULL);
+    if (!ht) {
+        return;
+    }
+
+    CHECK(hash_path("test/lib/lib.h") != hash_path("test/lib2/lib.h"));
+
+    FileId first = intern_path(ht, "test/lib/lib.h");
+    FileId second = intern_path(ht, "test/lib2/lib.h");
+    FileId top = intern_path(ht, "lib.h");
+    FileId other = intern_path(ht, "test/lib/other.h");
+
+    CHECK(first != second && second != top && top != other);
+    CHECK(strcmp(ht_node(ht, first) -> name, "lib.h") == 0);
+    CHECK(strcmp(ht_node(ht, top) -> name, "lib.h") == 0);
+
+    size_t found = 0;
+    uint8_t seen = 0;
+    for (Node* node = search_name(ht, "lib.h"); node; node = node -> next_name) {
+        CHECK(strcmp(node -> name, "lib.h") == 0);
+        found++;
+        seen |= (node -> id == first) | (node -> id == second) << 1 | (node -> id == top) << 2;
+    }
+
+    CHECK(found == 3 && seen == 7);
+    CHECK(search_name(ht, "other.h") == ht_node(ht, other));
+    CHECK(search_name(ht, "missing.h") == NULL);
+
+    arena_free(&arena);
+}
+
+void test_table(void) {
+    fill_paths();
+    check_names();
+    check_rehash();
+    check_concurrent();
+}